@@ -10,13 +10,16 @@ struct Node;
 #define ARM_PSTATE_LEN 8704
 #define BATCH_SIZE 1
 #define CONFIG "pruned_cifar10"
+#define CONV_TILINGS_LEN 2
 #define CPU_BUFFER_SIZE 400
 #define DEFAULT_TILE_H 32
 #define EXTRA_INFO_LEN 3
 #define FIRST_SAMPLE_OUTPUTS {4.8955, 4.331344, 4.631835, 11.602396, 4.454658, 10.819544, 5.423588, 6.451203, 5.806091, 5.272837}
 #define HAWAII 1
+#define HAWAII_JOURNAL 0
 #define INDIRECT_RECOVERY 0
 #define INPUTS_DATA_LEN 0
+#define INTERMEDIATE_VALUES_ARENA_SIZE 64472l
 #define INTERMITTENT 1
 #define JAPARI 0
 #define LEA_BUFFER_SIZE 18000
@@ -26,9 +29,10 @@ struct Node;
 #define MAX_ROW_LEN_CONV 0
 #define MAX_ROW_LEN_FC 0
 #define METHOD "HAWAII"
-#define MODEL_NODES_LEN 30
+#define MODEL_NODES_LEN 19
 #define NODE_NAME_LEN 60
 #define NUM_INPUTS 3
+#define NUM_SLOTS 2
 #define NVM_SIZE 524288
 #define N_INPUT 25
 #define N_SAMPLES 20
@@ -45,7 +49,6 @@ struct Node;
 #define PARAM_BIN 0
 #define SCALE 2
 #define INPUT_SCALE 4
-#define NUM_SLOTS 3
 #define INTERMEDIATE_VALUES_SIZE 65000l
 #define N_ALL_SAMPLES 10000
 #define OP_FILTERS 4
@@ -60,23 +63,24 @@ struct Node;
 #define OpRelu 4
 #define OpSoftmax 5
 #define OpSqueeze 6
-void alloc_concat(struct Model *model, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
-void handle_concat(struct Model *model, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
-void alloc_conv(struct Model *model, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
-void handle_conv(struct Model *model, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
-void alloc_globalaveragepool(struct Model *model, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
-void handle_globalaveragepool(struct Model *model, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
-void alloc_maxpool(struct Model *model, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
-void handle_maxpool(struct Model *model, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
-void alloc_relu(struct Model *model, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
-void handle_relu(struct Model *model, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
-void alloc_softmax(struct Model *model, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
-void handle_softmax(struct Model *model, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
-void alloc_squeeze(struct Model *model, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
-void handle_squeeze(struct Model *model, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
+void alloc_concat(struct InferenceContext *ctx, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
+void handle_concat(struct InferenceContext *ctx, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
+void alloc_conv(struct InferenceContext *ctx, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
+void handle_conv(struct InferenceContext *ctx, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
+void alloc_globalaveragepool(struct InferenceContext *ctx, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
+void handle_globalaveragepool(struct InferenceContext *ctx, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
+void alloc_maxpool(struct InferenceContext *ctx, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
+void handle_maxpool(struct InferenceContext *ctx, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
+void alloc_relu(struct InferenceContext *ctx, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
+void handle_relu(struct InferenceContext *ctx, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
+void alloc_softmax(struct InferenceContext *ctx, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
+void handle_softmax(struct InferenceContext *ctx, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
+void alloc_squeeze(struct InferenceContext *ctx, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
+void handle_squeeze(struct InferenceContext *ctx, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);
 #define NHWC2NCHW 1
 #define CHANNEL_FIRST 2
 #define SEPARATE_TILING 4
+#define FUSED_RELU 8
 #ifdef __MSP430__ 
 #define DATA_SECTION_NVM _Pragma("DATA_SECTION(\".nvm2\")")
 #else
@@ -90,16 +94,16 @@ extern const uint8_t * const samples_data;
 #define SAMPLES_DATA_LEN 6144
 
 extern const uint8_t * const model_data;
-#define MODEL_DATA_LEN 14
+#define MODEL_DATA_LEN 12
 
 extern const uint8_t * const nodes_data;
-#define NODES_DATA_LEN 4920
+#define NODES_DATA_LEN 3192
 
 extern const uint8_t * const model_parameters_info_data;
 #define MODEL_PARAMETERS_INFO_DATA_LEN 700
 
 extern const uint8_t * const intermediate_parameters_info_data;
-#define INTERMEDIATE_PARAMETERS_INFO_DATA_LEN 840
+#define INTERMEDIATE_PARAMETERS_INFO_DATA_LEN 532
 
 extern const uint8_t * const labels_data;
 #define LABELS_DATA_LEN 20
@@ -4,13 +4,11 @@
 #include "op_utils.h"
 #include "intermittent-cnn.h"
 
-ParameterInfo intermediate_parameters_info_vm[MODEL_NODES_LEN];
-
-const ParameterInfo* get_parameter_info(uint16_t i) {
+const ParameterInfo* get_parameter_info(InferenceContext *ctx, uint16_t i) {
     if (i < N_INPUT) {
         return reinterpret_cast<const ParameterInfo*>(model_parameters_info_data) + i;
     } else {
-        return get_intermediate_parameter_info(i - N_INPUT);
+        return get_intermediate_parameter_info(ctx, i - N_INPUT);
     }
 }
 
@@ -22,9 +20,9 @@ const Node* get_node(const ParameterInfo* param) {
     return get_node(param->parameter_info_idx - N_INPUT);
 }
 
-SlotInfo* get_slot_info(Model* model, uint8_t i) {
+SlotInfo* get_slot_info(InferenceContext *ctx, uint8_t i) {
     if (i < NUM_SLOTS) {
-        return model->slots_info + i;
+        return ctx->model_vm.slots_info + i;
     } else if (i >= SLOT_CONSTANTS_MIN) {
         return nullptr;
     } else {
@@ -78,11 +76,11 @@ const uint8_t* get_param_first_tile_index_base_pointer(const ParameterInfo *para
 }
 #endif
 
-int16_t get_q15_param(Model* model, const ParameterInfo *param, uint16_t i) {
+int16_t get_q15_param(InferenceContext *ctx, const ParameterInfo *param, uint16_t i) {
     MY_ASSERT(param->bitwidth == 16);
     if (param->slot == SLOT_TEST_SET) {
         int16_t ret;
-        read_from_samples(&ret, i, sizeof(int16_t));
+        read_from_samples(ctx, &ret, i, sizeof(int16_t));
         return ret;
     } else if (param->slot >= SLOT_CONSTANTS_MIN) {
         uint32_t limit;
@@ -92,13 +90,13 @@ int16_t get_q15_param(Model* model, const ParameterInfo *param, uint16_t i) {
         return *ret;
     } else {
         int16_t ret;
-        my_memcpy_from_param(model, &ret, param, i, sizeof(int16_t));
+        my_memcpy_from_param(ctx, &ret, param, i, sizeof(int16_t));
         return ret;
     }
 }
 
-void put_q15_param(ParameterInfo *param, uint16_t i, int16_t val) {
-    my_memcpy_to_param(param, i, &val, sizeof(int16_t), 0);
+void put_q15_param(InferenceContext *ctx, ParameterInfo *param, uint16_t i, int16_t val) {
+    my_memcpy_to_param(ctx, param, i, &val, sizeof(int16_t), 0);
 }
 
 int64_t get_int64_param(const ParameterInfo *param, size_t i) {
@@ -110,47 +108,30 @@ int64_t get_int64_param(const ParameterInfo *param, size_t i) {
     return *ret;
 }
 
-uint16_t get_next_slot(Model *model, const ParameterInfo *param) {
-    uint16_t slot_id = param->slot;
-    /* pick the next unused slot */
-    uint16_t next_slot_id = slot_id;
-    uint8_t cycle_count = 0;
-    while (1) {
-        next_slot_id++;
-        // Fail if the loop has run a cycle
-        if (next_slot_id >= NUM_SLOTS) {
-            next_slot_id = 0;
-            cycle_count++;
-            MY_ASSERT(cycle_count <= 1);
-        }
-        int16_t slot_user_id = get_slot_info(model, next_slot_id)->user;
-        if (slot_user_id < 0) {
-            break;
-        }
-        // previously allocated, most likely in a previous power cycle
-        if (slot_user_id == model->layer_idx) {
-            break;
-        }
-        const Node *slot_user = get_node(slot_user_id);
-        if (slot_user->max_output_id < model->layer_idx) {
-            break;
-        }
-        // The recorded slot user is not the actual user. This happens when Concat
-        // uses a new slot for scaled IFM. The old slot is actually used by nobody
-        // and available for allocation.
-        if (get_parameter_info(N_INPUT + slot_user_id)->slot != next_slot_id) {
-            break;
-        }
-    }
+const int16_t* get_channel_scales(const ParameterInfo *param, uint16_t first_channel, uint16_t n_channels) {
+    // transform.py stores a _q15 scale for each output channel after packed values
+    MY_ASSERT(param->bitwidth < 16 && param->slot >= SLOT_CONSTANTS_MIN && first_channel + n_channels <= param->dims[0]);
+    uint32_t limit;
+    const uint8_t *baseptr = get_param_base_pointer(param, &limit);
+    uint32_t total_offset = param->params_offset + param->params_len - (param->dims[0] - first_channel) * sizeof(int16_t);
+    MY_ASSERT(total_offset + n_channels * sizeof(int16_t) <= limit);
+    // Read in place as in get_q15_param, as constants are mapped into the address space
+    return reinterpret_cast<const int16_t*>(baseptr + total_offset);
+}
+
+uint16_t get_next_slot(InferenceContext *ctx) {
+    // Slots are assigned in transform.py, so that outputs used at the same time are in different slots
+    uint16_t next_slot_id = intermediate_values_placements[ctx->model_vm.layer_idx].slot;
+    MY_ASSERT(next_slot_id < NUM_SLOTS);
     my_printf_debug("next_slot_id = %d" NEWLINE, next_slot_id);
-    get_slot_info(model, next_slot_id)->user = model->layer_idx;
+    get_slot_info(ctx, next_slot_id)->user = ctx->model_vm.layer_idx;
     return next_slot_id;
 }
 
 #if SPARSE
-void my_memcpy_from_param_col(Model* model, void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n) {
+void my_memcpy_from_param_col(InferenceContext *ctx, void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n) {
     if (param->slot == SLOT_TEST_SET) {
-        read_from_samples(dest, offset_in_word, n);
+        read_from_samples(ctx, dest, offset_in_word, n);
     } else if (param->slot >= SLOT_CONSTANTS_MIN) {
         uint32_t limit;
         const uint8_t *baseptr = get_param_col_base_pointer(param, &limit);
@@ -158,13 +139,13 @@ void my_memcpy_from_param_col(Model* model, void *dest, const ParameterInfo *par
         MY_ASSERT(total_offset + n <= limit);
         my_memcpy(dest, baseptr + total_offset, n);
     } else {
-        my_memcpy_from_intermediate_values(dest, param, offset_in_word, n);
+        my_memcpy_from_intermediate_values(ctx, dest, param, offset_in_word, n);
     }
 }
 
-void my_memcpy_from_param_row(Model* model, void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n) {
+void my_memcpy_from_param_row(InferenceContext *ctx, void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n) {
     if (param->slot == SLOT_TEST_SET) {
-        read_from_samples(dest, offset_in_word, n);
+        read_from_samples(ctx, dest, offset_in_word, n);
     } else if (param->slot >= SLOT_CONSTANTS_MIN) {
         uint32_t limit;
         const uint8_t *baseptr = get_param_row_base_pointer(param, &limit);
@@ -172,13 +153,13 @@ void my_memcpy_from_param_row(Model* model, void *dest, const ParameterInfo *par
         MY_ASSERT(total_offset + n <= limit);
         my_memcpy(dest, baseptr + total_offset, n);
     } else {
-        my_memcpy_from_intermediate_values(dest, param, offset_in_word, n);
+        my_memcpy_from_intermediate_values(ctx, dest, param, offset_in_word, n);
     }
 }
 
-void my_memcpy_from_param_first_tile_index(Model* model, void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n) {
+void my_memcpy_from_param_first_tile_index(InferenceContext *ctx, void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n) {
     if (param->slot == SLOT_TEST_SET) {
-        read_from_samples(dest, offset_in_word, n);
+        read_from_samples(ctx, dest, offset_in_word, n);
     } else if (param->slot >= SLOT_CONSTANTS_MIN) {
         uint32_t limit;
         const uint8_t *baseptr = get_param_first_tile_index_base_pointer(param, &limit);
@@ -186,17 +167,17 @@ void my_memcpy_from_param_first_tile_index(Model* model, void *dest, const Param
         MY_ASSERT(total_offset + n <= limit);
         my_memcpy(dest, baseptr + total_offset, n);
     } else {
-        my_memcpy_from_intermediate_values(dest, param, offset_in_word, n);
+        my_memcpy_from_intermediate_values(ctx, dest, param, offset_in_word, n);
     }
 }
 #endif
 
 #if SPARSE
-uint16_t get_col_first_tile_index(Model *model, const ParameterInfo *params, uint16_t filter_tile_index) {
+uint16_t get_col_first_tile_index(InferenceContext *ctx, const ParameterInfo *params, uint16_t filter_tile_index) {
     my_printf_debug("Load first tile index from cols %d\n", filter_tile_index);
     int16_t first_tile_index = 0;
     my_memcpy_from_param_first_tile_index(
-            model,
+            ctx,
             &first_tile_index,
             params,
             filter_tile_index,
@@ -204,11 +185,11 @@ uint16_t get_col_first_tile_index(Model *model, const ParameterInfo *params, uin
     return first_tile_index;
 }
 
-uint16_t get_row_val(Model *model, const ParameterInfo *params, uint16_t row_index) {
+uint16_t get_row_val(InferenceContext *ctx, const ParameterInfo *params, uint16_t row_index) {
     my_printf_debug("Load row values from row index %d\n", row_index);
     int16_t next_row_val = 0;
     my_memcpy_from_param_row(
-            model,
+            ctx,
             &next_row_val,
             params,
             row_index,
@@ -216,11 +197,11 @@ uint16_t get_row_val(Model *model, const ParameterInfo *params, uint16_t row_ind
     return next_row_val;
 }
 
-uint16_t get_col_val(Model *model, const ParameterInfo *params, uint16_t col_index) {
+uint16_t get_col_val(InferenceContext *ctx, const ParameterInfo *params, uint16_t col_index) {
     my_printf_debug("Load col values from col index %d\n", col_index);
     int16_t col_val = 0;
     my_memcpy_from_param_col(
-            model,
+            ctx,
             &col_val,
             params,
             col_index, // cur_row_val + cur_n_cols
@@ -229,9 +210,9 @@ uint16_t get_col_val(Model *model, const ParameterInfo *params, uint16_t col_ind
 }
 #endif // SPARSE
 
-void my_memcpy_from_param(Model* model, void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n) {
+void my_memcpy_from_param(InferenceContext *ctx, void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n) {
     if (param->slot == SLOT_TEST_SET) {
-        read_from_samples(dest, offset_in_word, n);
+        read_from_samples(ctx, dest, offset_in_word, n);
     } else if (param->slot >= SLOT_CONSTANTS_MIN) {
         uint32_t limit;
         const uint8_t *baseptr = get_param_base_pointer(param, &limit);
@@ -239,7 +220,50 @@ void my_memcpy_from_param(Model* model, void *dest, const ParameterInfo *param,
         MY_ASSERT(total_offset + n <= limit);
         my_memcpy(dest, baseptr + total_offset, n);
     } else {
-        my_memcpy_from_intermediate_values(dest, param, offset_in_word, n);
+        my_memcpy_from_intermediate_values(ctx, dest, param, offset_in_word, n);
+    }
+}
+
+/* Like my_memcpy_from_param, while values with bitwidth < 16 are widened to
+ * q15 after a single DMA of packed values. Widened values are multiplied by
+ * scales of their columns in col_scales, where values are in rows of n_cols
+ * values starting from the first column. n is the size of widened values in
+ * bytes. */
+void my_memcpy_from_param_widened(InferenceContext *ctx, int16_t *dest, const ParameterInfo *param, uint16_t offset_in_value, size_t n,
+                                  const int16_t *col_scales, uint16_t n_cols) {
+    if (param->bitwidth == 16) {
+        my_memcpy_from_param(ctx, dest, param, offset_in_value, n);
+        return;
+    }
+    MY_ASSERT((param->bitwidth == 8 || param->bitwidth == 4) && param->slot >= SLOT_CONSTANTS_MIN);
+    uint8_t bitwidth = param->bitwidth;
+    uint8_t values_per_word = 16 / bitwidth;
+    uint16_t n_values = n / sizeof(int16_t);
+    // DMA transfers words, so start from the word containing the first value
+    uint16_t skipped_values = offset_in_value % values_per_word;
+    uint16_t n_words = (skipped_values + n_values + values_per_word - 1) / values_per_word;
+    MY_ASSERT(n_words <= n_values);
+    uint32_t limit;
+    const uint8_t *baseptr = get_param_base_pointer(param, &limit);
+    uint32_t total_offset = param->params_offset + (offset_in_value / values_per_word) * sizeof(int16_t);
+    MY_ASSERT(total_offset + n_words * sizeof(int16_t) <= limit);
+    // Packed values are put at the end of dest, so that widening from the beginning
+    // never overwrites values that are not widened yet
+    int16_t *packed_dest = dest + n_values - n_words;
+    my_memcpy(packed_dest, baseptr + total_offset, n_words * sizeof(int16_t));
+    consume_cpu_energy(CpuOp::MUL, n_values);
+    const uint8_t *packed = reinterpret_cast<const uint8_t*>(packed_dest);
+    for (uint16_t idx = 0, value_idx = skipped_values, col = 0; idx < n_values; idx++, value_idx++) {
+        uint8_t val = packed[value_idx * bitwidth / 8];
+        if (bitwidth == 4) {
+            val = (value_idx & 1) ? (val >> 4) : (val & 0x0f);
+        }
+        int16_t widened = static_cast<int16_t>(static_cast<uint16_t>(val) << (16 - bitwidth));
+        dest[idx] = (static_cast<int32_t>(widened) * col_scales[col]) >> 15;
+        col++;
+        if (col == n_cols) {
+            col = 0;
+        }
     }
 }
 
@@ -273,29 +297,31 @@ float Scale::toFloat() const {
 }
 
 #if ENABLE_COUNTERS
+// Counters are updated in DSP wrappers as well, which have no contexts
 Counters *counters() {
 #if ENABLE_PER_LAYER_COUNTERS
-    return counters_data + get_model()->layer_idx;
+    return counters_data + get_model(get_context())->layer_idx;
 #else
     return counters_data;
 #endif
 }
 
-void reset_counters() {
+void reset_counters(InferenceContext *ctx) {
     memset(counters_data, 0, sizeof(Counters) * COUNTERS_LEN);
+#if !ENABLE_PER_LAYER_COUNTERS
+    ctx->last_progress = 0;
+#endif
 }
 
 #if !ENABLE_PER_LAYER_COUNTERS
-void report_progress() {
-    static uint8_t last_progress = 0;
-
+void report_progress(InferenceContext *ctx) {
     if (!total_jobs) {
         return;
     }
     uint32_t cur_jobs = counters()->job_preservation / 2;
     uint8_t cur_progress = 100 * cur_jobs / total_jobs;
     // report only when the percentage is changed to avoid high UART overheads
-    if (cur_progress != last_progress) {
+    if (cur_progress != ctx->last_progress) {
         // Somehow printing all values in one my_printf() does not work
         my_printf("P,%d,%d,", cur_progress,
                   counters()->job_preservation/1024);
@@ -303,7 +329,7 @@ void report_progress() {
                   counters()->dma_bytes_r/1024);
         my_printf("%d" NEWLINE,
                   counters()->dma_bytes_w/1024);
-        last_progress = cur_progress;
+        ctx->last_progress = cur_progress;
     }
 }
 #endif // !ENABLE_PER_LAYER_COUNTERS
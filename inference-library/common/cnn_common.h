@@ -10,16 +10,31 @@
 // Some demo codes assume counters are accumulated across layers
 static_assert((!ENABLE_PER_LAYER_COUNTERS) || (!DEMO), "ENABLE_PER_LAYER_COUNTERS and DEMO are mutually exclusive");
 
+#ifdef POSIX_BUILD
+// Data outside InferenceContext (scratch buffers, counters) are per thread, as
+// the host may simulate several devices in parallel
+#define PER_DEVICE thread_local
+#else
+#define PER_DEVICE
+#endif
+
 /**********************************
  *        Data structures         *
  **********************************/
 
+struct ConvTiling {
+    uint8_t output_tile_w;
+    uint8_t output_tile_h;
+    // numbers of output tiles along W and H, from transform.py as MSP430 has no hardware divider
+    uint8_t n_tiles_w;
+    uint8_t n_tiles_h;
+};
+
 struct ConvNodeFlags {
     uint16_t input_tile_c;
     uint16_t output_tile_c;
-    uint16_t output_tile_w;
-    uint16_t output_tile_h;
     uint8_t pads[4];
+    ConvTiling tilings[CONV_TILINGS_LEN]; // from large to small (see select_conv_tiling)
 };
 
 struct MaxPoolFlags {
@@ -54,7 +69,7 @@ struct NodeFlags {
     ExtraNodeFlags extra;
 };
 
-static_assert(sizeof(NodeFlags) == 16, "Unexpected size for NodeFlags");
+static_assert(sizeof(NodeFlags) == 20, "Unexpected size for NodeFlags");
 
 typedef struct Node {
     char name[NODE_NAME_LEN];
@@ -66,7 +81,8 @@ typedef struct Node {
     NodeFlags flags;
 #if HAWAII
     struct Footprint {
-        uint16_t dummy;
+        uint8_t tiling; // for Conv
+        uint8_t dummy;
         uint16_t sub_layer_idx;
         uint16_t value;
         uint8_t version;
@@ -74,7 +90,35 @@ typedef struct Node {
 #endif
 } Node;
 
-static_assert(sizeof(Node) == NODE_NAME_LEN * 2 + 22 + NUM_INPUTS * 2 + HAWAII * 16, "Unexpected size for Node");
+static_assert(sizeof(Node) == NODE_NAME_LEN * 2 + 26 + NUM_INPUTS * 2 + HAWAII * 16, "Unexpected size for Node");
+
+#if HAWAII_JOURNAL
+// An entry in the progress journal, which replaces footprints in nodes (see platform.cpp)
+struct JournalEntry {
+    uint16_t sub_layer_idx;
+    uint16_t value;
+    uint8_t layer_idx;
+    uint8_t tiling;
+    uint8_t seq; // must be the last field in this struct, and 0 for empty entries
+};
+
+static_assert(MODEL_NODES_LEN < UINT8_MAX, "Too many nodes for JournalEntry::layer_idx");
+#endif
+
+#if HAWAII
+/* States for adapting intervals between footprint commits and Conv tilings to
+ * power cycles (see platform.cpp). Recovery is correct with any interval, and
+ * tilings in use are recorded in footprints, so that these states are neither
+ * versioned nor reset for each inference. */
+struct FootprintIntervals {
+    // The footprint found at the last boot, for the progress in a power cycle
+    uint16_t boot_layer_idx;
+    uint16_t boot_sub_layer_idx;
+    uint16_t boot_value;
+    uint8_t shifts[MODEL_NODES_LEN]; // log2 of intervals in batches
+    uint8_t tilings[MODEL_NODES_LEN]; // for layers not started yet
+};
+#endif
 
 struct Scale {
     int16_t fract;
@@ -100,6 +144,8 @@ typedef struct ParameterInfo {
     uint32_t first_tile_index_offset; // for bias
 #endif
     /* Known bitwidth values:
+     * 4: packed int4 Conv filters (lower nibble first), followed by per-channel scales
+     * 8: int8 Conv filters, followed by per-channel scales
      * 16: q15
      * 32: iq31
      * 64: INT64 (from ONNX)
@@ -123,6 +169,15 @@ typedef struct ParameterInfo {
     static_assert(sizeof(ParameterInfo) == 28, "Unexpected size for ParameterInfo");
 #endif
 
+// Where the output of a node is stored in NVM, planned with lifetimes of outputs in transform.py
+struct IntermediateValuesPlacement {
+    uint32_t offset; // from INTERMEDIATE_VALUES_OFFSET
+    uint32_t len;    // in bytes
+    // For outputs of Concat inputs, placed at their channels in the output of Concat, and 0 otherwise
+    uint16_t channel_stride;
+    uint8_t slot;
+};
+
 typedef struct SlotInfo {
 #if INDIRECT_RECOVERY
     int8_t state_bit;
@@ -163,15 +218,16 @@ struct Counters {
     uint32_t job_preservation;
     uint32_t footprint_preservation;
     uint32_t macs;
+    uint32_t divisions;
 
     uint32_t progress_seeking;
 };
 
-extern uint32_t total_jobs;
-extern Counters *counters_data;
+extern PER_DEVICE uint32_t total_jobs;
+extern PER_DEVICE Counters *counters_data;
 Counters *counters();
-void reset_counters();
-void report_progress();
+void reset_counters(InferenceContext *ctx);
+void report_progress(InferenceContext *ctx);
 #endif
 
 #if ENABLE_COUNTERS && !DEMO
@@ -183,7 +239,23 @@ void stop_cpu_counter(uint32_t Counters::* mem_ptr);
 #define stop_cpu_counter(mem_ptr)
 #endif
 
-extern ParameterInfo intermediate_parameters_info_vm[MODEL_NODES_LEN];
+// Divisions by variables are done in software on MSP430, which has no hardware divider.
+// Those in the Conv path use counted_div and counted_mod, so that the Divisions counter covers them.
+template<typename T, typename U>
+inline auto counted_div(T a, U b) -> decltype(a / b) {
+#if ENABLE_COUNTERS
+    counters()->divisions++;
+#endif
+    return a / b;
+}
+
+template<typename T, typename U>
+inline auto counted_mod(T a, U b) -> decltype(a % b) {
+#if ENABLE_COUNTERS
+    counters()->divisions++;
+#endif
+    return a % b;
+}
 
 
 /**********************************
@@ -203,31 +275,37 @@ extern ParameterInfo intermediate_parameters_info_vm[MODEL_NODES_LEN];
 /**********************************
  * Helpers for the model & nodes  *
  **********************************/
+struct InferenceContext;
 const uint8_t* get_param_base_pointer(const ParameterInfo *param, uint32_t *limit_p);
 const uint8_t* get_param_row_base_pointer(const ParameterInfo *param, uint32_t *limit_p);
 const uint8_t* get_param_col_base_pointer(const ParameterInfo *param, uint32_t *limit_p);
 const uint8_t* get_param_first_tile_index_base_pointer(const ParameterInfo *param, uint32_t *limit_p);
-int16_t get_q15_param(Model* model, const ParameterInfo *param, uint16_t offset_in_word);
-void put_q15_param(ParameterInfo *param, uint16_t offset_in_word, int16_t val);
+int16_t get_q15_param(InferenceContext *ctx, const ParameterInfo *param, uint16_t offset_in_word);
+void put_q15_param(InferenceContext *ctx, ParameterInfo *param, uint16_t offset_in_word, int16_t val);
 int64_t get_int64_param(const ParameterInfo *param, size_t i);
-uint16_t get_next_slot(Model *model, const ParameterInfo *param);
-const ParameterInfo* get_parameter_info(uint16_t i);
+const int16_t* get_channel_scales(const ParameterInfo *param, uint16_t first_channel, uint16_t n_channels);
+uint16_t get_next_slot(InferenceContext *ctx);
+const ParameterInfo* get_parameter_info(InferenceContext *ctx, uint16_t i);
 const Node* get_node(size_t i);
 const Node* get_node(const ParameterInfo* param);
-SlotInfo * get_slot_info(Model* model, uint8_t i);
-void my_memcpy_from_param(Model* model, void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n);
-void my_memcpy_from_param_row(Model* model, void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n);
-void my_memcpy_from_param_col(Model* model, void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n);
-void my_memcpy_from_param_first_tile_index(Model* model, void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n);
-uint16_t get_col_first_tile_index(Model *model, const ParameterInfo *params, uint16_t filter_tile_index);
-uint16_t get_row_val(Model *model, const ParameterInfo *params, uint16_t row_index);
-uint16_t get_col_val(Model *model, const ParameterInfo *params, uint16_t col_index);
+SlotInfo * get_slot_info(InferenceContext *ctx, uint8_t i);
+void my_memcpy_from_param(InferenceContext *ctx, void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n);
+void my_memcpy_from_param_widened(InferenceContext *ctx, int16_t *dest, const ParameterInfo *param, uint16_t offset_in_value, size_t n,
+                                  const int16_t *col_scales, uint16_t n_cols);
+void my_memcpy_from_param_row(InferenceContext *ctx, void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n);
+void my_memcpy_from_param_col(InferenceContext *ctx, void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n);
+void my_memcpy_from_param_first_tile_index(InferenceContext *ctx, void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n);
+uint16_t get_col_first_tile_index(InferenceContext *ctx, const ParameterInfo *params, uint16_t filter_tile_index);
+uint16_t get_row_val(InferenceContext *ctx, const ParameterInfo *params, uint16_t row_index);
+uint16_t get_col_val(InferenceContext *ctx, const ParameterInfo *params, uint16_t col_index);
 
 /**********************************
  *       Operation handlers       *
  **********************************/
-typedef void (*handler)(Model *model, const ParameterInfo *input[], ParameterInfo *output, const Node* node);
-typedef void (*allocator)(Model *model, const ParameterInfo *input[], ParameterInfo *output, const Node* node);
+typedef void (*handler)(InferenceContext *ctx, const ParameterInfo *input[], ParameterInfo *output, const Node* node);
+typedef void (*allocator)(InferenceContext *ctx, const ParameterInfo *input[], ParameterInfo *output, const Node* node);
 // below are defined in ops.c
 extern const handler handlers[];
 extern const allocator allocators[];
+// indexed by nodes, in data.cpp
+extern const IntermediateValuesPlacement intermediate_values_placements[];
@@ -7,6 +7,7 @@
 #include "intermittent-cnn.h"
 #include "my_dsplib.h"
 #include "platform.h"
+#include "inference_context.h"
 
 // TODO: make these adjustable on runtime
 #if !USE_ARM_CMSIS
@@ -26,71 +27,10 @@ static inline int16_t int16_max(int16_t a, int16_t b) {
     return a > b ? a : b;
 }
 
-#define CONV_TASK_FLAG_PROCESSED_FILTERS_BASE 2
-typedef struct ConvTaskParams {
-    Model* model;
-    const ParameterInfo *conv_input;
-    const ParameterInfo *real_conv_input; // for separate channel tiling
-    const ParameterInfo *conv_filter;
-    const ParameterInfo *conv_bias;
-    ParameterInfo *output;
-    const NodeFlags* flags;
-
-    /* aux vars remaining constant for a conv layer */
-    uint16_t H;
-    uint16_t W;
-    // OUTPUT_H and OUTPUT_W to handle stride != 1
-    uint16_t OUTPUT_H;
-    uint16_t OUTPUT_W;
-    uint16_t kH;
-    uint16_t kW;
-    uint16_t CHANNEL; // Cannot use C as a variable name here as C is a macro on MSP430 :(
-    uint16_t OUTPUT_CHANNEL;
-    uint16_t N_FILTERS;
-    uint16_t stride_h;
-    uint16_t stride_w;
-    uint16_t input_tile_c_offset;
-    uint16_t input_tile_c_index;
-    int16_t tile_h;
-    int16_t tile_w;
-    uint8_t cur_input_tile_c;
-    uint16_t cur_filter_tile_c;
-    uint16_t n_tiles_c;
-    int16_t dest_offset;
-    int16_t filter_offset;
-    // For 1x1 conv
-    int16_t kX;
-    int16_t kY;
-#if SPARSE
-    int16_t row_index; // it can also be used to indicate #channel which are computed now (row_index * input_tile_c)
-    int16_t cur_row_val;
-    int16_t next_row_val;
-    int16_t n_cols; // row[row_index] - row[row_index - 1]
-    int16_t cur_n_cols; // [0, n_cols)
-#endif
-    uint8_t truncated;
-    uint16_t filter_idx;
-    uint16_t filter_tile_index;
-    // (h, w) for left-top corner of each input window
-    int16_t input_h;
-    int16_t input_w;
-    int16_t input_h_first, input_h_last;
-    int16_t input_w_first, input_w_last;
-    int16_t *filter_buffer_addr;
-    int16_t cached_filter_idx;
-    int16_t cached_input_h;
-    int16_t cached_input_w;
-    uint16_t cached_input_tile_c_offset;
-    int16_t cached_kX;
-    int16_t cached_kY;
-
-    uint8_t psum_buffer_version;
-    int8_t cur_op;
-} ConvTaskParams;
-
-static ConvTaskParams conv_params_obj;
-
-int16_t *matrix_mpy_results = lea_buffer + LEA_BUFFER_SIZE;
+// filter_idx % output_tile_c without a division, as filter_idx is always in the filter tile filter_tile_index
+static inline uint16_t filter_offset_in_tile(const ConvTaskParams *conv_params) {
+    return conv_params->filter_idx - conv_params->filter_tile_index * conv_params->flags->extra.conv.output_tile_c;
+}
 
 #if INDIRECT_RECOVERY
 static void flip_filter_state_bits(ConvTaskParams *conv_params, uint16_t n_filters, uint16_t len, uint8_t first_round) {
@@ -128,65 +68,21 @@ static void flip_filter_state_bits(ConvTaskParams *conv_params, uint16_t n_filte
 }
 #endif
 
-static void convTask(int16_t cur_input_w, int16_t cur_input_h, ConvTaskParams *conv_params) {
-    // cur_output_tile_c should be signed, or MAX_VAL below is broken with TI's compiler
-    int16_t output_tile_c = conv_params->flags->extra.conv.output_tile_c;
-    int16_t cur_output_tile_c = output_tile_c - conv_params->filter_idx % output_tile_c;
-    int16_t output_tile_w = conv_params->flags->extra.conv.output_tile_w;
-    int16_t output_tile_h = conv_params->flags->extra.conv.output_tile_h;
-
-    my_printf_debug("cur_output_tile_c = %d" NEWLINE, cur_output_tile_c);
-    MY_ASSERT(cur_output_tile_c > 0);
-
-    int16_t n_filters = cur_output_tile_c;
-    int16_t values_to_preserve = n_filters;
-
-#if !STABLE_POWER
-    int16_t channel_offset_c = conv_params->filter_idx % output_tile_c;
-#endif // STABLE_POWER
-    uint16_t output_h = (cur_input_h - conv_params->input_h_first - conv_params->kX) / conv_params->stride_h,
-             output_w = (cur_input_w - conv_params->input_w_first - conv_params->kY) / conv_params->stride_w;
-    // use NWHC so that output is written continuously on the address space
-#if STABLE_POWER
-    uint32_t cur_output_data_offset = ((output_w % output_tile_w) * output_tile_h  + (output_h % output_tile_h)) * output_tile_c;
-#else // STABLE_POWER
-    // 2 * OUTPUT_W * OUTPUT_H * OUTPUT_CHANNEL is the offset of result of psum cmd
-    uint32_t cur_output_data_offset =
-        2 * conv_params->OUTPUT_W * conv_params->OUTPUT_H * conv_params->OUTPUT_CHANNEL +           // n
-        ((output_h % output_tile_h) * output_tile_w  + (output_w % output_tile_w)) * output_tile_c +// hwc
-        channel_offset_c;                                                                           // c
-    my_printf_debug("channel_offset_c: %d" NEWLINE, channel_offset_c);
-#endif // STABLE_POWER
-    my_printf_debug("output_tile_w: %d" NEWLINE, output_tile_w);
-    my_printf_debug("output_tile_h: %d" NEWLINE, output_tile_h);
-    my_printf_debug("cur_output_data_offset: %d" NEWLINE, cur_output_data_offset);
-#if INDIRECT_RECOVERY
-    SlotInfo *cur_slot_info = conv_params->cur_slot_info;
-    int16_t n_keep_state_bits = n_filters;
-    if (conv_params->turning_point_idx <= cur_slot_info->n_turning_points && conv_params->next_turning_point != INVALID_TURNING_POINT) {
-        my_printf_debug("next_turning_point = %d" NEWLINE, conv_params->next_turning_point);
-        uint16_t ending_offset = MAX_VAL(conv_params->next_turning_point, cur_output_data_offset);
-        if (ending_offset < cur_output_data_offset + n_filters) {
-            n_keep_state_bits -= cur_output_data_offset + n_filters - ending_offset;
-        }
-    }
-    my_printf_debug("n_keep_state_bits = %d" NEWLINE, n_keep_state_bits);
-    MY_ASSERT(n_keep_state_bits >= 0);
-#endif
-
-    /* copy filter data */
+/* copy filter data */
+static void load_conv_filters(ConvTaskParams *conv_params, int16_t n_filters) {
     if (conv_params->cached_filter_idx != conv_params->filter_idx ||
         conv_params->cached_input_tile_c_offset != conv_params->input_tile_c_offset ||
         conv_params->cached_kX != conv_params->kX ||
         conv_params->cached_kY != conv_params->kY) {
 
-        conv_params->filter_buffer_addr = matrix_mpy_results - conv_params->filter_offset * (n_filters + TEMP_FILTER_WIDTH);
+        conv_params->filter_buffer_addr = conv_params->matrix_mpy_results - conv_params->filter_offset * (n_filters + TEMP_FILTER_WIDTH);
         my_fill_q15(0, conv_params->filter_buffer_addr, conv_params->filter_offset * n_filters);
 
-        int16_t *filter_tmp = matrix_mpy_results - conv_params->filter_offset; // before transpose
+#if SPARSE
+        int16_t *filter_tmp = conv_params->matrix_mpy_results - conv_params->filter_offset; // before transpose
         uint16_t fill_length = conv_params->filter_offset;
         my_fill_q15(0, filter_tmp, fill_length);
-#if SPARSE
+        int16_t output_tile_c = conv_params->flags->extra.conv.output_tile_c;
         // buffer_size represents the number of data one DMA transfered
         // Load fliter according to index
         uint16_t filter_offset = conv_params->cur_input_tile_c;
@@ -195,45 +91,22 @@ static void convTask(int16_t cur_input_w, int16_t cur_input_h, ConvTaskParams *c
         uint16_t buffer_size = sizeof(int16_t) * filter_offset;
         uint16_t filter_src_offset = col_index * block_size;
         int16_t *filter_dest_ptr = filter_tmp;
-#else // SPARSE
-        uint16_t buffer_size = sizeof(int16_t) * conv_params->cur_filter_tile_c;
-        uint16_t filter_len = conv_params->kH * conv_params->kW * conv_params->CHANNEL;
-#endif // SPARSE
-        for (uint16_t idx = 0; idx < cur_output_tile_c; idx++) {
+        for (uint16_t idx = 0; idx < n_filters; idx++) {
             my_printf_debug("Copying filter %d" NEWLINE, conv_params->filter_idx + idx);
-#if SPARSE
             // XXX: Need re-checking
-            uint16_t cur_filter_src_offset = filter_src_offset + (conv_params->filter_idx % output_tile_c + idx) * filter_offset;
+            uint16_t cur_filter_src_offset = filter_src_offset + (filter_offset_in_tile(conv_params) + idx) * filter_offset;
 #if ENABLE_COUNTERS
             start_cpu_counter();
 #endif // ENABLE_COUNTERS
-            my_memcpy_from_param(conv_params->model, filter_dest_ptr, conv_params->conv_filter, cur_filter_src_offset, buffer_size);
+            my_memcpy_from_param(conv_params->ctx, filter_dest_ptr, conv_params->conv_filter, cur_filter_src_offset, buffer_size);
 #if ENABLE_COUNTERS
             stop_cpu_counter(&Counters::dma_read_filter);
 #endif // ENABLE_COUNTERS
-#else // SPARSE
-#if ENABLE_COUNTERS
-            start_cpu_counter();
-#endif // ENABLE_COUNTERS
-            uint16_t filter_src_offset = (conv_params->filter_idx + idx) * filter_len;
-            // only load one vector
-            int16_t *filter_dest_ptr = filter_tmp;
-            uint16_t cur_filter_src_offset = filter_src_offset + conv_params->kX * conv_params->kW * conv_params->CHANNEL + conv_params->input_tile_c_offset;
-            cur_filter_src_offset += conv_params->kY * conv_params->CHANNEL;
-            my_memcpy_from_param(conv_params->model, filter_dest_ptr, conv_params->conv_filter, cur_filter_src_offset, buffer_size);
-#if ENABLE_COUNTERS
-            stop_cpu_counter(&Counters::dma_read_filter);
-#endif // ENABLE_COUNTERS
-#endif // SPARSE
             {
                 // XXX: why is this needed? Should already be zero with my_fill_q15 above
                 filter_tmp[conv_params->filter_offset - 1] = 0;
             }
-#if SPARSE
             if(conv_params->cur_n_cols == 0) {
-#else // SPARSE
-            if (conv_params->input_tile_c_index == 0 && conv_params->kX == 0 && conv_params->kY == 0) {
-#endif // SPARSE
                 my_printf_debug("Append bias!" NEWLINE);
                 // convert int16_t to int32_t first as on MSP430, registers are 20 bit while there are only 16 bits when int16_t is converted to uint16_t
                 // If the dividend is negative, the quotient is wrong
@@ -242,7 +115,7 @@ static void convTask(int16_t cur_input_w, int16_t cur_input_h, ConvTaskParams *c
 #if ENABLE_COUNTERS
                     start_cpu_counter();
 #endif // ENABLE_COUNTERS
-                    bias_val = -static_cast<int32_t>(get_q15_param(conv_params->model, conv_params->conv_bias, conv_params->filter_idx + idx)) / conv_params->conv_input->scale.toFloat();
+                    bias_val = -static_cast<int32_t>(get_q15_param(conv_params->ctx, conv_params->conv_bias, conv_params->filter_idx + idx)) / conv_params->conv_input->scale.toFloat();
 #if ENABLE_COUNTERS
                     stop_cpu_counter(&Counters::dma_read_filter);
 #endif // ENABLE_COUNTERS
@@ -253,18 +126,110 @@ static void convTask(int16_t cur_input_w, int16_t cur_input_h, ConvTaskParams *c
             uint16_t channel = idx;
             my_interleave_q15(filter_tmp, channel, n_filters, conv_params->filter_buffer_addr, conv_params->filter_offset);
         }
+#else // SPARSE
+        /* transform.py stores each filter tile (output_tile_c filters x
+         * cur_filter_tile_c channels at (kX, kY)) as rows of output_tile_c
+         * values, which is the layout of the filter buffer. Filters in the
+         * last filter tile may be fewer than output_tile_c. */
+        uint16_t output_tile_c = conv_params->flags->extra.conv.output_tile_c;
+        uint16_t first_filter_in_tile = conv_params->filter_idx - filter_offset_in_tile(conv_params);
+        uint16_t filter_tile_width = MIN_VAL(output_tile_c, conv_params->N_FILTERS - first_filter_in_tile);
+        uint16_t filter_tile_col = conv_params->filter_idx - first_filter_in_tile;
+        uint16_t n_loaded_filters = MIN_VAL(n_filters, filter_tile_width - filter_tile_col);
+        uint16_t filter_len = conv_params->kH * conv_params->kW * conv_params->CHANNEL;
+        uint16_t filter_src_offset = first_filter_in_tile * filter_len +
+            (conv_params->input_tile_c_offset * conv_params->kH * conv_params->kW +
+             (conv_params->kX * conv_params->kW + conv_params->kY) * conv_params->cur_filter_tile_c) * filter_tile_width +
+            filter_tile_col;
+        my_printf_debug("Copying filters %d-%d" NEWLINE, conv_params->filter_idx, conv_params->filter_idx + n_loaded_filters - 1);
+#if ENABLE_COUNTERS
+        start_cpu_counter();
+#endif // ENABLE_COUNTERS
+        const int16_t *channel_scales = nullptr;
+        if (conv_params->conv_filter->bitwidth < 16) {
+            // int8/int4 filters are relative to scales of output channels (see quantize_conv_filters in transform.py),
+            // which are applied while widening
+            channel_scales = get_channel_scales(conv_params->conv_filter, conv_params->filter_idx, n_loaded_filters);
+        }
+        if (n_loaded_filters == filter_tile_width && n_filters == filter_tile_width) {
+            // the whole filter tile
+            my_memcpy_from_param_widened(conv_params->ctx, conv_params->filter_buffer_addr, conv_params->conv_filter, filter_src_offset,
+                                         conv_params->cur_filter_tile_c * n_filters * sizeof(int16_t), channel_scales, n_filters);
+        } else {
+            // remaining filters after recovery, or padding for the last filter tile
+            for (uint16_t row = 0; row < conv_params->cur_filter_tile_c; row++) {
+                my_memcpy_from_param_widened(conv_params->ctx, conv_params->filter_buffer_addr + row * n_filters, conv_params->conv_filter,
+                                             filter_src_offset + row * filter_tile_width, n_loaded_filters * sizeof(int16_t),
+                                             channel_scales, n_loaded_filters);
+            }
+        }
+        if (conv_params->input_tile_c_index == 0 && conv_params->kX == 0 && conv_params->kY == 0 && conv_params->conv_bias) {
+            my_printf_debug("Append bias!" NEWLINE);
+            // Biases are divided by the scale of conv inputs in transform.py (checked in handle_conv)
+            my_memcpy_from_param(conv_params->ctx, conv_params->filter_buffer_addr + (conv_params->filter_offset - 1) * n_filters,
+                                 conv_params->conv_bias, conv_params->filter_idx, n_loaded_filters * sizeof(int16_t));
+        }
+#if ENABLE_COUNTERS
+        stop_cpu_counter(&Counters::dma_read_filter);
+#endif // ENABLE_COUNTERS
+#endif // SPARSE
         conv_params->cached_filter_idx = conv_params->filter_idx;
         conv_params->cached_input_tile_c_offset = conv_params->input_tile_c_offset;
         conv_params->cached_kX = conv_params->kX;
         conv_params->cached_kY = conv_params->kY;
     }
+}
 
-    int16_t *filter_buffer_addr = conv_params->filter_buffer_addr;
-
-    int16_t *input_buffer_addr =
-        lea_buffer +
+static inline int16_t* conv_input_vector(const ConvTaskParams *conv_params, int16_t cur_input_w, int16_t cur_input_h) {
+    return lea_buffer +
         ((cur_input_w - conv_params->cached_input_w) * conv_params->tile_h + (cur_input_h - conv_params->cached_input_h)) *
         conv_params->dest_offset;
+}
+
+#if !STABLE_POWER
+// tile_w_offset and tile_h_offset locate the output pixel in the output tile
+static void convTask(int16_t cur_input_w, int16_t cur_input_h, int16_t tile_w_offset, int16_t tile_h_offset, ConvTaskParams *conv_params) {
+    // cur_output_tile_c should be signed, or MAX_VAL below is broken with TI's compiler
+    int16_t output_tile_c = conv_params->flags->extra.conv.output_tile_c;
+    int16_t channel_offset_c = filter_offset_in_tile(conv_params);
+    int16_t cur_output_tile_c = output_tile_c - channel_offset_c;
+    int16_t output_tile_w = conv_params->output_tile_w;
+
+    my_printf_debug("cur_output_tile_c = %d" NEWLINE, cur_output_tile_c);
+    MY_ASSERT(cur_output_tile_c > 0);
+
+    int16_t n_filters = cur_output_tile_c;
+    int16_t values_to_preserve = n_filters;
+
+    // use NWHC so that output is written continuously on the address space
+    // 2 * OUTPUT_W * OUTPUT_H * OUTPUT_CHANNEL_STRIDE is the offset of result of psum cmd
+    uint32_t cur_output_data_offset =
+        2 * conv_params->OUTPUT_W * conv_params->OUTPUT_H * conv_params->OUTPUT_CHANNEL_STRIDE + // n
+        (tile_h_offset * output_tile_w + tile_w_offset) * output_tile_c +                        // hwc
+        channel_offset_c;                                                                        // c
+    my_printf_debug("channel_offset_c: %d" NEWLINE, channel_offset_c);
+    my_printf_debug("output_tile_w: %d" NEWLINE, output_tile_w);
+    my_printf_debug("output_tile_h: %d" NEWLINE, conv_params->output_tile_h);
+    my_printf_debug("cur_output_data_offset: %d" NEWLINE, cur_output_data_offset);
+#if INDIRECT_RECOVERY
+    SlotInfo *cur_slot_info = conv_params->cur_slot_info;
+    int16_t n_keep_state_bits = n_filters;
+    if (conv_params->turning_point_idx <= cur_slot_info->n_turning_points && conv_params->next_turning_point != INVALID_TURNING_POINT) {
+        my_printf_debug("next_turning_point = %d" NEWLINE, conv_params->next_turning_point);
+        uint16_t ending_offset = MAX_VAL(conv_params->next_turning_point, cur_output_data_offset);
+        if (ending_offset < cur_output_data_offset + n_filters) {
+            n_keep_state_bits -= cur_output_data_offset + n_filters - ending_offset;
+        }
+    }
+    my_printf_debug("n_keep_state_bits = %d" NEWLINE, n_keep_state_bits);
+    MY_ASSERT(n_keep_state_bits >= 0);
+#endif
+
+    load_conv_filters(conv_params, n_filters);
+
+    int16_t *filter_buffer_addr = conv_params->filter_buffer_addr;
+
+    int16_t *input_buffer_addr = conv_input_vector(conv_params, cur_input_w, cur_input_h);
     my_printf_debug("cur_input_w: %d" NEWLINE, cur_input_w);
     my_printf_debug("cur_input_h: %d" NEWLINE, cur_input_h);
     my_printf_debug("cached_input_w: %d" NEWLINE, conv_params->cached_input_w);
@@ -279,13 +244,8 @@ static void convTask(int16_t cur_input_w, int16_t cur_input_h, ConvTaskParams *c
     my_printf_debug("B_rows: %d /B_cols: %d" NEWLINE, B_rows, B_cols);
     MY_ASSERT(A_rows * B_cols <= OUTPUT_LEN);
     MY_ASSERT(input_buffer_addr + A_rows * A_cols <= filter_buffer_addr);
-#if STABLE_POWER
-        my_matrix_mpy_q15_to_vm(A_rows, A_cols, B_rows, B_cols, input_buffer_addr, filter_buffer_addr, matrix_mpy_results,
-                      conv_params->output, cur_output_data_offset, values_to_preserve, 0, 0);
-#else // STABLE_POWER
-        my_matrix_mpy_q15(A_rows, A_cols, B_rows, B_cols, input_buffer_addr, filter_buffer_addr, matrix_mpy_results,
-                      conv_params->output, cur_output_data_offset, values_to_preserve, 0, 0);
-#endif
+    my_matrix_mpy_q15(A_rows, A_cols, B_rows, B_cols, input_buffer_addr, filter_buffer_addr, conv_params->matrix_mpy_results,
+                      conv_params->ctx, conv_params->output, cur_output_data_offset, values_to_preserve, 0, 0);
     /* START dump data */
     my_printf_debug("input_h=%d" NEWLINE, cur_input_h);
     my_printf_debug("filter_idx=");
@@ -295,7 +255,7 @@ static void convTask(int16_t cur_input_w, int16_t cur_input_h, ConvTaskParams *c
         MY_ASSERT(conv_params->filter_idx + idx < conv_params->N_FILTERS);
     }
 #endif
-    my_printf_debug("output_h=%d output_w=%d" NEWLINE, output_h, output_w);
+    my_printf_debug("tile_h_offset=%d tile_w_offset=%d" NEWLINE, tile_h_offset, tile_w_offset);
 
     my_printf_debug("input" NEWLINE);
     dump_matrix_debug(input_buffer_addr, A_rows, A_cols, ValueInfo(conv_params->conv_input, nullptr), false);
@@ -304,25 +264,21 @@ static void convTask(int16_t cur_input_w, int16_t cur_input_h, ConvTaskParams *c
     dump_matrix_debug(filter_buffer_addr, B_rows, B_cols, ValueInfo(conv_params->conv_filter, nullptr), false);
 
     my_printf_debug("matrix_mpy_results" NEWLINE);
-    dump_matrix_debug(matrix_mpy_results, A_rows, B_cols, ValueInfo(conv_params->output));
+    dump_matrix_debug(conv_params->matrix_mpy_results, A_rows, B_cols, ValueInfo(conv_params->output));
     my_printf_debug(NEWLINE);
 
-#if STABLE_POWER
-    // compare_vm_vm(matrix_mpy_results, conv_params->model, conv_params->output, cur_output_data_offset, values_to_preserve);
-#else // STABLE_POWER
-    compare_vm_nvm(matrix_mpy_results, conv_params->model, conv_params->output, cur_output_data_offset, values_to_preserve);
-#endif // STABLE_POWER
+    compare_vm_nvm(conv_params->matrix_mpy_results, conv_params->ctx, conv_params->output, cur_output_data_offset, values_to_preserve);
     /* END dump data */
 
     my_printf_debug("output_data offset = %d" NEWLINE, cur_output_data_offset);
 
-    MY_ASSERT(cur_output_data_offset + n_filters < INTERMEDIATE_VALUES_SIZE * NUM_SLOTS);
+    MY_ASSERT(cur_output_data_offset + n_filters < INTERMEDIATE_VALUES_SIZE);
 
 #if HAWAII
 #if ENABLE_COUNTERS
     start_cpu_counter();
 #endif
-    hawaii_record_footprints(conv_params->model, values_to_preserve);
+    hawaii_record_footprints(conv_params->ctx, values_to_preserve);
 #if ENABLE_COUNTERS
     stop_cpu_counter(&Counters::dma_write_fp);
 #endif
@@ -338,6 +294,92 @@ static void convTask(int16_t cur_input_w, int16_t cur_input_h, ConvTaskParams *c
     }
 #endif
 }
+#else // STABLE_POWER
+static inline void next_output_pixel(const ConvTaskParams *conv_params, int16_t *cur_input_w, int16_t *cur_input_h, int16_t max_input_h) {
+    *cur_input_h += conv_params->stride_h;
+    if (*cur_input_h > max_input_h) {
+        *cur_input_h = conv_params->input_h;
+        *cur_input_w += conv_params->stride_w;
+    }
+}
+
+/* With stable power, there are no jobs to recover, so all output pixels of a
+ * tile are computed with a few large matrix multiplications instead of one
+ * 1xN multiplication per pixel as in convTask. Input vectors of consecutive
+ * pixels are gathered as rows of a matrix (im2col) in the free space between
+ * the input tile and filters. Each row of the results is accumulated to
+ * cpu_buffer as a psum, and preserve_output writes the tile to NVM after all
+ * (input_tile_c, kX, kY) are done. As each row is the same dot product as in
+ * convTask, results are identical. */
+static void conv_tile_gemm(ConvTaskParams *conv_params, uint16_t inputs_len, int16_t max_input_w, int16_t max_input_h) {
+    int16_t output_tile_c = conv_params->flags->extra.conv.output_tile_c;
+    int16_t output_tile_w = conv_params->output_tile_w;
+    int16_t output_tile_h = conv_params->output_tile_h;
+    // filters are from the first one in a filter tile, as there are no jobs to recover
+    int16_t n_filters = output_tile_c;
+    MY_ASSERT(!filter_offset_in_tile(conv_params));
+
+    load_conv_filters(conv_params, n_filters);
+
+    int16_t *filter_buffer_addr = conv_params->filter_buffer_addr;
+    int16_t *im2col_buffer = lea_buffer + inputs_len;
+    MY_ASSERT(im2col_buffer <= filter_buffer_addr);
+
+    uint16_t A_rows, A_cols, B_rows, B_cols;
+    A_cols = B_rows = conv_params->filter_offset;
+    B_cols = n_filters;
+    // results of a multiplication should fit in the space reserved for the psum of a tile
+    uint16_t max_block_rows = MIN_VAL(counted_div(filter_buffer_addr - im2col_buffer, A_cols),
+                                      output_tile_h * output_tile_w);
+    my_printf_debug("max_block_rows: %d" NEWLINE, max_block_rows);
+
+    int16_t block_input_w = conv_params->input_w, block_input_h = conv_params->input_h;
+    // the output pixel at (block_input_w, block_input_h) in the tile, following next_output_pixel
+    int16_t tile_w_offset = 0, tile_h_offset = 0;
+    while (block_input_w <= max_input_w) {
+        int16_t cur_input_w = block_input_w, cur_input_h = block_input_h;
+        int16_t *input_buffer_addr;
+        if (max_block_rows > 1) {
+            A_rows = 0;
+            while (A_rows < max_block_rows && cur_input_w <= max_input_w) {
+                my_memcpy(im2col_buffer + A_rows * A_cols, conv_input_vector(conv_params, cur_input_w, cur_input_h), A_cols * sizeof(int16_t));
+                A_rows++;
+                next_output_pixel(conv_params, &cur_input_w, &cur_input_h, max_input_h);
+            }
+            input_buffer_addr = im2col_buffer;
+        } else {
+            // no space for gathering; use the input vector in place
+            A_rows = 1;
+            input_buffer_addr = conv_input_vector(conv_params, cur_input_w, cur_input_h);
+        }
+        my_printf_debug("block of %d pixels starting from cur_input_h=%d cur_input_w=%d" NEWLINE, A_rows, block_input_h, block_input_w);
+
+        my_matrix_mpy_q15(A_rows, A_cols, B_rows, B_cols, input_buffer_addr, filter_buffer_addr, conv_params->matrix_mpy_results,
+                          conv_params->ctx, nullptr, 0, 0, 0, 0);
+
+        my_printf_debug("input" NEWLINE);
+        dump_matrix_debug(input_buffer_addr, A_rows, A_cols, ValueInfo(conv_params->conv_input, nullptr), false);
+        my_printf_debug("filter" NEWLINE);
+        dump_matrix_debug(filter_buffer_addr, B_rows, B_cols, ValueInfo(conv_params->conv_filter, nullptr), false);
+        my_printf_debug("matrix_mpy_results" NEWLINE);
+        dump_matrix_debug(conv_params->matrix_mpy_results, A_rows, B_cols, ValueInfo(conv_params->output));
+        my_printf_debug(NEWLINE);
+
+        for (uint16_t row = 0; row < A_rows; row++) {
+            // use NWHC so that output is written continuously on the address space
+            uint16_t cur_output_data_offset = (tile_w_offset * output_tile_h + tile_h_offset) * output_tile_c;
+            my_accumulate_to_vm(conv_params->output, cur_output_data_offset, conv_params->matrix_mpy_results + row * B_cols, B_cols * sizeof(int16_t), 0);
+            next_output_pixel(conv_params, &block_input_w, &block_input_h, max_input_h);
+            if (block_input_h == conv_params->input_h) {
+                tile_h_offset = 0;
+                tile_w_offset++;
+            } else {
+                tile_h_offset++;
+            }
+        }
+    }
+}
+#endif // STABLE_POWER
 
 static inline uint16_t load_input_vector(uint32_t src_addr, int16_t* dest_addr, uint16_t len, const ConvTaskParams* conv_params) {
     my_printf_debug("Load %d IFM values from range [%d, %d) ",
@@ -352,7 +394,7 @@ static inline uint16_t load_input_vector(uint32_t src_addr, int16_t* dest_addr,
         loaded_len = len;
     }
     my_memcpy_from_param(
-        conv_params->model, memcpy_dest_addr,
+        conv_params->ctx, memcpy_dest_addr,
         conv_params->real_conv_input, src_addr,
         len * sizeof(int16_t));
 
@@ -365,23 +407,25 @@ static inline uint16_t load_input_vector(uint32_t src_addr, int16_t* dest_addr,
     return loaded_len;
 }
 
-static void handle_conv_inner_loop(Model *model, ConvTaskParams *conv_params) {
+static void handle_conv_inner_loop(InferenceContext *ctx, ConvTaskParams *conv_params) {
     /* copy input data, col by col */
 
+#if INDIRECT_RECOVERY
+    // Inputs of Concat are kept in their slots (see handle_concat)
     int8_t real_input_index = -1;
     if (conv_params->conv_input->param_flags & SEPARATE_TILING) {
         real_input_index = (2 * conv_params->input_tile_c_index >= conv_params->n_tiles_c) ? 1 : 0;
-        conv_params->real_conv_input = get_parameter_info(conv_params->conv_input->extra_info[real_input_index]);
+        conv_params->real_conv_input = get_parameter_info(ctx, conv_params->conv_input->extra_info[real_input_index]);
     } else {
         conv_params->real_conv_input = conv_params->conv_input;
     }
+#else // INDIRECT_RECOVERY
+    // Inputs of Concat are already placed as one tensor (see transform.py)
+    conv_params->real_conv_input = conv_params->conv_input;
+#endif // INDIRECT_RECOVERY
 
-    int16_t tile_h_offset =
-        ((conv_params->input_h - conv_params->input_h_first - conv_params->kX) / conv_params->stride_h)
-        % conv_params->flags->extra.conv.output_tile_h;
-    int16_t tile_w_offset =
-        ((conv_params->input_w - conv_params->input_w_first - conv_params->kY) / conv_params->stride_w)
-        % conv_params->flags->extra.conv.output_tile_w;
+    int16_t tile_h_offset = conv_params->tile_h_offset;
+    int16_t tile_w_offset = conv_params->tile_w_offset;
     int16_t input_h_tile_begin = conv_params->input_h - conv_params->kX - tile_h_offset * conv_params->stride_h;
     int16_t input_w_tile_begin = conv_params->input_w - conv_params->kY - tile_w_offset * conv_params->stride_w;
     my_printf_debug("tile_h_offset: %d" NEWLINE, tile_h_offset);
@@ -433,7 +477,8 @@ static void handle_conv_inner_loop(Model *model, ConvTaskParams *conv_params) {
         my_fill_q15(0, lea_buffer, inputs_len);
 
         // reserve space for padding 0
-        dest += (w_start - input_w_tile_begin) * conv_params->dest_offset * conv_params->tile_h;
+        dest += (w_start - input_w_tile_begin) * conv_params->dest_offset * conv_params->tile_h +
+                (h_start - input_h_tile_begin) * conv_params->dest_offset;
 
         my_printf_debug("h_start=%" PRId32 " ", h_start);
         my_printf_debug("h_end=%" PRId32 NEWLINE, h_end);
@@ -443,48 +488,77 @@ static void handle_conv_inner_loop(Model *model, ConvTaskParams *conv_params) {
         my_printf_debug("Copying row to lea_buffer + %d" NEWLINE,
                         static_cast<int>(dest - lea_buffer));
         uint16_t cur_input_channel = conv_params->CHANNEL;
+#if INDIRECT_RECOVERY
         if (conv_params->conv_input->param_flags & SEPARATE_TILING) {
             cur_input_channel /= 2;
         }
+#endif // INDIRECT_RECOVERY
         int16_t input_src_offset = h_start * conv_params->W * cur_input_channel + w_start * cur_input_channel;
         input_src_offset += conv_params->input_tile_c_offset;
+#if INDIRECT_RECOVERY
         if (real_input_index == 1) {
             input_src_offset -= cur_input_channel;
         }
+#endif // INDIRECT_RECOVERY
+        // Values for a row of the input tile are contiguous in NVM if all
+        // channels are loaded, and then a row is loaded at once. Otherwise,
+        // values for each (h, w) are loaded directly to where they are used.
+        // Loading a strided row at once is not worth it: skipped channels
+        // (at least 16 per pixel in known models) cost more DMA cycles than
+        // the setup of a transfer (about 7 words in plat-linux.cpp).
+        uint16_t n_row_pixels = w_end - w_start + 1;
+        uint8_t contiguous_row = (cur_input_tile_c == cur_input_channel && n_row_pixels > 1);
+        uint16_t pixel_stride = conv_params->tile_h * conv_params->dest_offset;
         for(int32_t h = h_start; h <= h_end; ++h) {
-            // reserve space for padding 0
-            int16_t *dest_addr = matrix_mpy_results - conv_params->tile_w * cur_input_tile_c;
             uint32_t src_addr = input_src_offset;
-            for(int32_t w = w_start; w <= w_end; ++w) {
+            if (contiguous_row) {
+                // reserve space for padding 0
+                int16_t *row_addr = conv_params->matrix_mpy_results - conv_params->tile_w * cur_input_tile_c;
 #if ENABLE_COUNTERS
                 start_cpu_counter();
 #endif // ENABLE_COUNTERS
-                load_input_vector(src_addr, dest_addr, cur_input_tile_c, conv_params);
+                load_input_vector(src_addr, row_addr, n_row_pixels * cur_input_tile_c, conv_params);
 #if ENABLE_COUNTERS
                 stop_cpu_counter(&Counters::dma_read_input);
 #endif // ENABLE_COUNTERS
-                dest_addr += cur_input_tile_c;
-                src_addr += cur_input_channel;
-            }
-            // interleave input data
-            int16_t *temp_dest = dest;
-            dest_addr = matrix_mpy_results - conv_params->tile_w * cur_input_tile_c;
-            for(int32_t w = w_start; w <= w_end; ++w) {
-                for(int32_t i = 0; i < cur_input_tile_c; ++i) {
-                    *(dest + i) = *(dest_addr++);
+                // interleave input data
+                int16_t *dest_addr = dest;
+                for (uint16_t w = 0; w < n_row_pixels; w++) {
+                    for (uint16_t i = 0; i < cur_input_tile_c; i++) {
+                        dest_addr[i] = row_addr[i];
+                    }
+                    row_addr += cur_input_tile_c;
+                    dest_addr += pixel_stride;
+                }
+            } else {
+                int16_t *dest_addr = dest;
+                for (uint16_t w = 0; w < n_row_pixels; w++) {
+#if ENABLE_COUNTERS
+                    start_cpu_counter();
+#endif // ENABLE_COUNTERS
+                    load_input_vector(src_addr, dest_addr, cur_input_tile_c, conv_params);
+#if ENABLE_COUNTERS
+                    stop_cpu_counter(&Counters::dma_read_input);
+#endif // ENABLE_COUNTERS
+                    src_addr += cur_input_channel;
+                    dest_addr += pixel_stride;
                 }
-                dest += conv_params->tile_h * conv_params->dest_offset;
             }
-            dest = temp_dest;
             dest += conv_params->dest_offset;
             input_src_offset += cur_input_channel * conv_params->W;
         }
+        if (contiguous_row) {
+            // Rows are loaded to the space for filters, which should be loaded again
+            conv_params->cached_filter_idx = -1;
+        }
+#if INDIRECT_RECOVERY
         if (conv_params->real_conv_input->scale != conv_params->conv_input->scale) {
             int16_t scaleFract;
             uint8_t shift;
             float_to_scale_params(&scaleFract, &shift, conv_params->real_conv_input->scale / conv_params->conv_input->scale);
             my_scale_q15(lea_buffer, scaleFract, shift, lea_buffer, inputs_len);
         }
+#endif // INDIRECT_RECOVERY
         uint16_t bias_multipler_offset = conv_params->dest_offset - 1;
         while (bias_multipler_offset < inputs_len) {
             lea_buffer[bias_multipler_offset] = -0x8000; // _Q15(-1.0)
@@ -498,17 +572,26 @@ static void handle_conv_inner_loop(Model *model, ConvTaskParams *conv_params) {
     dump_matrix_debug(lea_buffer, inputs_len, ValueInfo(conv_params->real_conv_input, nullptr), false);
 
     int16_t max_input_h =
-        MIN_VAL(input_h_tile_begin + conv_params->flags->extra.conv.output_tile_h * conv_params->stride_h + conv_params->kX - 1,
+        MIN_VAL(input_h_tile_begin + conv_params->output_tile_h * conv_params->stride_h + conv_params->kX - 1,
                 conv_params->input_h_last + conv_params->kX);
     int16_t max_input_w =
-        MIN_VAL(input_w_tile_begin + conv_params->flags->extra.conv.output_tile_w * conv_params->stride_w + conv_params->kY - 1,
+        MIN_VAL(input_w_tile_begin + conv_params->output_tile_w * conv_params->stride_w + conv_params->kY - 1,
                 conv_params->input_w_last + conv_params->kY);
-    for(int32_t cur_input_w = conv_params->input_w; cur_input_w <= max_input_w; cur_input_w += conv_params->stride_w) {
-        for(int32_t cur_input_h = conv_params->input_h; cur_input_h <= max_input_h; cur_input_h += conv_params->stride_h) {
+#if STABLE_POWER
+    // tiles always start from the first output pixel, so there are no offsets to reset
+    MY_ASSERT(!tile_h_offset && !tile_w_offset);
+    conv_tile_gemm(conv_params, inputs_len, max_input_w, max_input_h);
+    // reset here for further processing
+    conv_params->filter_idx = conv_params->filter_tile_index * conv_params->flags->extra.conv.output_tile_c;
+#else // STABLE_POWER
+    int16_t cur_tile_w_offset = tile_w_offset;
+    for(int32_t cur_input_w = conv_params->input_w; cur_input_w <= max_input_w; cur_input_w += conv_params->stride_w, cur_tile_w_offset++) {
+        int16_t cur_tile_h_offset = tile_h_offset;
+        for(int32_t cur_input_h = conv_params->input_h; cur_input_h <= max_input_h; cur_input_h += conv_params->stride_h, cur_tile_h_offset++) {
             my_printf_debug("max_input_h: %d, max_input_w: %d" NEWLINE, max_input_h, max_input_w);
             my_printf_debug("cur_input_h: %d, cur_input_w: %d" NEWLINE, cur_input_h, cur_input_w);
             // filter_idx is set to initial_c in handle_conv
-            convTask(cur_input_w, cur_input_h, conv_params);
+            convTask(cur_input_w, cur_input_h, cur_tile_w_offset, cur_tile_h_offset, conv_params);
             // reset here for further processing
             conv_params->filter_idx = conv_params->filter_tile_index * conv_params->flags->extra.conv.output_tile_c;
         }
@@ -520,13 +603,16 @@ static void handle_conv_inner_loop(Model *model, ConvTaskParams *conv_params) {
     conv_params->input_w -= tile_w_offset * conv_params->stride_w;
     my_printf_debug("tile_w_offset: %d" NEWLINE, tile_w_offset);
     my_printf_debug("input_w: %d" NEWLINE, conv_params->input_w);
-    tile_w_offset = 0;
+    conv_params->tile_h_offset = conv_params->tile_w_offset = 0;
+#endif // STABLE_POWER
 }
 
-void alloc_conv(Model *model, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
+void alloc_conv(InferenceContext *ctx, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
     const ParameterInfo *conv_input = input[0], *conv_filter = input[1];
 
-    MY_ASSERT(conv_input->bitwidth == 16 && conv_filter->bitwidth == 16);
+    MY_ASSERT(conv_input->bitwidth == 16);
+    // Filters may be int8 or packed int4, which are widened to q15 in load_conv_filters
+    MY_ASSERT(conv_filter->bitwidth == 16 || (!SPARSE && (conv_filter->bitwidth == 8 || conv_filter->bitwidth == 4)));
 
     MY_ASSERT(conv_input->dims[1] == conv_filter->dims[1]);
 
@@ -534,9 +620,9 @@ void alloc_conv(Model *model, const ParameterInfo *input[], ParameterInfo *outpu
     const uint16_t CHANNEL = conv_input->dims[1], H = conv_input->dims[2], W = conv_input->dims[3];
     uint16_t OUTPUT_CHANNEL = conv_filter->dims[0];
 
-    ConvTaskParams *conv_params = &conv_params_obj;
+    ConvTaskParams *conv_params = &ctx->conv_params;
 
-    conv_params->model = model;
+    conv_params->ctx = ctx;
     conv_params->flags = &node->flags;
 
     conv_params->kH = conv_filter->dims[2];
@@ -552,33 +638,46 @@ void alloc_conv(Model *model, const ParameterInfo *input[], ParameterInfo *outpu
     conv_params->input_h_last = H + pads[PAD_H_END] - conv_params->kH;
     conv_params->input_w_last = W + pads[PAD_W_END] - conv_params->kW;
 
-    conv_params->OUTPUT_H = (conv_params->input_h_last - conv_params->input_h_first) / conv_params->stride_h + 1;
-    conv_params->OUTPUT_W = (conv_params->input_w_last - conv_params->input_w_first) / conv_params->stride_w + 1;
+    conv_params->OUTPUT_H = counted_div(conv_params->input_h_last - conv_params->input_h_first, conv_params->stride_h) + 1;
+    conv_params->OUTPUT_W = counted_div(conv_params->input_w_last - conv_params->input_w_first, conv_params->stride_w) + 1;
 
     {
-        conv_params->n_tiles_c = CHANNEL / conv_params->flags->extra.conv.input_tile_c;
+        conv_params->n_tiles_c = counted_div(CHANNEL, conv_params->flags->extra.conv.input_tile_c);
     }
     my_printf_debug("input_tile_c=%d, output_tile_c=%d" NEWLINE, conv_params->flags->extra.conv.input_tile_c, conv_params->flags->extra.conv.output_tile_c);
 
     /* XXX: extend flags; assume dilation=(1, 1) for now */
     output->bitwidth = 16;
-    output->slot = get_next_slot(model, conv_input);
+    output->slot = get_next_slot(ctx);
+
+#if INDIRECT_RECOVERY
+    // Fused epilogues do not handle state bits or footprints in values
+    MY_ASSERT(!(node->flags.generic & FUSED_RELU));
+#endif
+    // Outputs of Concat inputs are placed at their channels in the output of Concat (see transform.py)
+    uint16_t channel_stride = intermediate_values_placements[ctx->model_vm.layer_idx].channel_stride;
+    if (!channel_stride) {
+        channel_stride = OUTPUT_CHANNEL;
+    }
+    conv_params->OUTPUT_CHANNEL_STRIDE = channel_stride;
 
 #if STABLE_POWER
-    output->params_len = conv_params->OUTPUT_H * conv_params->OUTPUT_W * OUTPUT_CHANNEL * sizeof(int16_t);
+    output->params_len = conv_params->OUTPUT_H * conv_params->OUTPUT_W * channel_stride * sizeof(int16_t);
 #else // STABLE_POWER
     /* 3 buffers:
      * 0: the result of accum cmd
      * 1: the result of accum cmd (double buffering)
      * 2: the result of psum cmd
      */
+    // The first tiling has the largest tiles
+    const ConvTiling* tiling = &conv_params->flags->extra.conv.tilings[0];
     int16_t output_tile_len =
-        conv_params->flags->extra.conv.output_tile_h *
-        conv_params->flags->extra.conv.output_tile_w *
+        tiling->output_tile_h *
+        tiling->output_tile_w *
         conv_params->flags->extra.conv.output_tile_c;
     my_printf_debug("output_tile_len: %d" NEWLINE, output_tile_len);
-    my_printf_debug("output_len: %d" NEWLINE, conv_params->OUTPUT_H * conv_params->OUTPUT_W * OUTPUT_CHANNEL);
-    output->params_len = sizeof(int16_t) * (2 * conv_params->OUTPUT_H * conv_params->OUTPUT_W * OUTPUT_CHANNEL + output_tile_len);
+    my_printf_debug("output_len: %d" NEWLINE, conv_params->OUTPUT_H * conv_params->OUTPUT_W * channel_stride);
+    output->params_len = sizeof(int16_t) * (2 * conv_params->OUTPUT_H * conv_params->OUTPUT_W * channel_stride + output_tile_len);
 #endif // STABLE_POWER
     output->dims[0] = 1;
     output->dims[1] = OUTPUT_CHANNEL;
@@ -592,13 +691,14 @@ void alloc_conv(Model *model, const ParameterInfo *input[], ParameterInfo *outpu
 }
 
 #if SPARSE and STABLE_POWER
-static void append_zero_to_pruned_output_channel(Model *model, const Node *node, ParameterInfo *output, uint16_t filter_idx, int16_t tile_h_offset, int16_t tile_w_offset, int8_t buffer_id) {
+static void append_zero_to_pruned_output_channel(InferenceContext *ctx, const Node *node, ParameterInfo *output, uint16_t filter_idx, int16_t tile_h_offset, int16_t tile_w_offset, int8_t buffer_id) {
     my_printf_debug("==> Start appending zero ..." NEWLINE);
     init_cpu_buffer();
     uint16_t OUTPUT_H = output->dims[2], OUTPUT_W = output->dims[3];
-    for(uint16_t output_w = 0; output_w < OUTPUT_W; output_w += node->flags.extra.conv.output_tile_w) {
-        for(uint16_t output_h = 0; output_h < OUTPUT_H; output_h += node->flags.extra.conv.output_tile_h) {
-            preserve_output(model, node, output, filter_idx, output_w, output_h, 0, 0, 0);
+    const ConvTaskParams *conv_params = &ctx->conv_params;
+    for(uint16_t output_w = 0; output_w < OUTPUT_W; output_w += conv_params->output_tile_w) {
+        for(uint16_t output_h = 0; output_h < OUTPUT_H; output_h += conv_params->output_tile_h) {
+            preserve_output(ctx, node, output, filter_idx, output_w, output_h, 0, 0, 0);
         }
     }
 }
@@ -631,13 +731,13 @@ static void next_nonzero_value(const Node *node, ConvTaskParams *conv_params, in
     my_printf_debug("input_tile_c_offset: %d" NEWLINE, conv_params->input_tile_c_offset);
     while(!conv_params->n_cols && conv_params->row_index * conv_params->flags->extra.conv.output_tile_c < conv_params->OUTPUT_CHANNEL) {
         conv_params->cur_row_val = conv_params->next_row_val;
-        conv_params->next_row_val = get_row_val(conv_params->model, conv_params->conv_filter, conv_params->row_index + 1);
+        conv_params->next_row_val = get_row_val(conv_params->ctx, conv_params->conv_filter, conv_params->row_index + 1);
         conv_params->n_cols = conv_params->next_row_val - conv_params->cur_row_val;
 #if STABLE_POWER
         if(!conv_params->n_cols) {
             conv_params->filter_tile_index = conv_params->row_index;
             conv_params->filter_idx = conv_params->filter_tile_index * conv_params->flags->extra.conv.output_tile_c;
-            append_zero_to_pruned_output_channel(conv_params->model, node, conv_params->output, conv_params->filter_idx, 0, 0, 0);
+            append_zero_to_pruned_output_channel(conv_params->ctx, node, conv_params->output, conv_params->filter_idx, 0, 0, 0);
         }
 #endif // STABLE_POWER
         conv_params->row_index++;
@@ -646,8 +746,8 @@ static void next_nonzero_value(const Node *node, ConvTaskParams *conv_params, in
         conv_params->cur_n_cols = 0;
         conv_params->filter_tile_index = conv_params->row_index - 1;
         conv_params->filter_idx = conv_params->filter_tile_index * conv_params->flags->extra.conv.output_tile_c;
-        *col_val = get_col_val(conv_params->model, conv_params->conv_filter, conv_params->cur_row_val + conv_params->cur_n_cols);
-        conv_params->input_tile_c_index = *col_val / (conv_params->kH * conv_params->kW);
+        *col_val = get_col_val(conv_params->ctx, conv_params->conv_filter, conv_params->cur_row_val + conv_params->cur_n_cols);
+        conv_params->input_tile_c_index = counted_div(*col_val, conv_params->kH * conv_params->kW);
         conv_params->input_tile_c_offset = conv_params->input_tile_c_index * conv_params->flags->extra.conv.input_tile_c;
     }
     my_printf_debug("==== After ====" NEWLINE);
@@ -659,19 +759,19 @@ static void next_nonzero_value(const Node *node, ConvTaskParams *conv_params, in
 #endif // SPARSE
 
 #if !STABLE_POWER
-static void conv_merge(Model *model, ConvTaskParams *conv_params, ParameterInfo *output, int16_t output_w, int16_t output_h, int16_t tile_h_offset, int16_t tile_w_offset) {
-    int16_t OUTPUT_C = output->dims[1],
+static void conv_merge(InferenceContext *ctx, ConvTaskParams *conv_params, ParameterInfo *output, int16_t output_w, int16_t output_h, int16_t tile_h_offset, int16_t tile_w_offset) {
+    int16_t OUTPUT_C = conv_params->OUTPUT_CHANNEL_STRIDE,
             OUTPUT_H = output->dims[2],
             OUTPUT_W = output->dims[3],
             output_tile_c = conv_params->flags->extra.conv.output_tile_c,
-            output_tile_w = MIN_VAL(conv_params->flags->extra.conv.output_tile_w, OUTPUT_W - (output_w - tile_w_offset)),
-            output_tile_h = MIN_VAL(conv_params->flags->extra.conv.output_tile_h, OUTPUT_H - (output_h - tile_h_offset));
+            output_tile_w = MIN_VAL(conv_params->output_tile_w, OUTPUT_W - (output_w - tile_w_offset)),
+            output_tile_h = MIN_VAL(conv_params->output_tile_h, OUTPUT_H - (output_h - tile_h_offset));
     MY_ASSERT(output_w + output_tile_w - tile_w_offset <= OUTPUT_W);
     MY_ASSERT(output_h + output_tile_h - tile_h_offset <= OUTPUT_H);
     int16_t default_output_tile_len =
         conv_params->flags->extra.conv.output_tile_c *
-        conv_params->flags->extra.conv.output_tile_w *
-        conv_params->flags->extra.conv.output_tile_h;
+        conv_params->output_tile_w *
+        conv_params->output_tile_h;
     int16_t *partial_result = lea_buffer + LEA_BUFFER_SIZE - default_output_tile_len;
     uint16_t output_len = OUTPUT_C * OUTPUT_W * OUTPUT_H;
     int16_t psum_offset =
@@ -683,8 +783,17 @@ static void conv_merge(Model *model, ConvTaskParams *conv_params, ParameterInfo
 #if !STABLE_POWER
     int16_t input_offset =
         2 * output_len +
-        ((output_h % conv_params->flags->extra.conv.output_tile_h) * conv_params->flags->extra.conv.output_tile_w  + (output_w % conv_params->flags->extra.conv.output_tile_w)) * output_tile_c; // hwc
+        (tile_h_offset * conv_params->output_tile_w + tile_w_offset) * output_tile_c; // hwc
     uint16_t cur_input_offset = input_offset;
+#if SPARSE
+    uint8_t last_merge = (conv_params->cur_n_cols + 1 >= conv_params->n_cols);
+#else // SPARSE
+    uint8_t last_merge = ((conv_params->input_tile_c_index + 1) * conv_params->flags->extra.conv.input_tile_c >= conv_params->conv_input->dims[1] &&
+                          conv_params->kX == conv_params->kH - 1 && conv_params->kY == conv_params->kW - 1);
+#endif // SPARSE
+    // Values are final after the last merge, and then the fused ReLU is applied before they are written.
+    // With stable power, it is applied to the whole tile in handle_conv instead.
+    uint8_t apply_relu = (last_merge && (conv_params->flags->generic & FUSED_RELU));
 #endif // !STABLE_POWER
     int16_t vm_offset = 0;
     int16_t chunk_offset = 0;
@@ -702,12 +811,12 @@ static void conv_merge(Model *model, ConvTaskParams *conv_params, ParameterInfo
             cur_psum_offset += chunk_offset;
             cur_dst += chunk_offset;
 #if !STABLE_POWER
-            my_memcpy_from_param(model, be_add, output, cur_input_offset, real_chunk_len * sizeof(int16_t));
+            my_memcpy_from_param(ctx, be_add, output, cur_input_offset, real_chunk_len * sizeof(int16_t));
             my_printf_debug(NEWLINE "input offset %d, VM offset %d" NEWLINE, cur_input_offset, vm_offset);
             my_printf_debug("Loaded chunk" NEWLINE);
             dump_matrix_debug(be_add, real_chunk_len, ValueInfo(output));
 #endif // !STABLE_POWER
-            my_memcpy_from_param(model, to_add, output, cur_psum_offset, real_chunk_len * sizeof(int16_t));
+            my_memcpy_from_param(ctx, to_add, output, cur_psum_offset, real_chunk_len * sizeof(int16_t));
             my_printf_debug(NEWLINE "psum offset %d, VM offset %d" NEWLINE, cur_psum_offset, output_tile_h * output_tile_w * output_tile_c + vm_offset);
 #if !STABLE_POWER
 #if SPARSE
@@ -724,13 +833,18 @@ static void conv_merge(Model *model, ConvTaskParams *conv_params, ParameterInfo
             dump_matrix_debug(to_add, real_chunk_len, ValueInfo(output));
             // perform accum
             my_add_q15(be_add, to_add, be_add, real_chunk_len);
+#if !STABLE_POWER
+            if (apply_relu) {
+                my_relu_q15(be_add, be_add, real_chunk_len);
+            }
+#endif // !STABLE_POWER
             my_printf_debug("Adding Result" NEWLINE);
             dump_matrix_debug(be_add, real_chunk_len, ValueInfo(output));
 #if !STABLE_POWER
 #if ENABLE_COUNTERS
             start_cpu_counter();
 #endif // ENABLE_COUNTERS
-            my_memcpy_to_param(output, cur_dst, be_add, real_chunk_len * sizeof(int16_t), 0);
+            my_memcpy_to_param(ctx, output, cur_dst, be_add, real_chunk_len * sizeof(int16_t), 0);
 #if ENABLE_COUNTERS
             stop_cpu_counter(&Counters::dma_write_ofm);
 #endif // ENABLE_COUNTERS
@@ -741,7 +855,7 @@ static void conv_merge(Model *model, ConvTaskParams *conv_params, ParameterInfo
 #if ENABLE_COUNTERS
             start_cpu_counter();
 #endif // ENABLE_COUNTERS
-            hawaii_record_footprints(model, real_chunk_len);
+            hawaii_record_footprints(ctx, real_chunk_len);
 #if ENABLE_COUNTERS
             stop_cpu_counter(&Counters::dma_write_fp);
 #endif // ENABLE_COUNTERS
@@ -751,12 +865,12 @@ static void conv_merge(Model *model, ConvTaskParams *conv_params, ParameterInfo
             cur_psum_offset += OUTPUT_C * OUTPUT_W;
             cur_dst += OUTPUT_C * OUTPUT_W;
 #if !STABLE_POWER
-            cur_input_offset += conv_params->flags->extra.conv.output_tile_c * conv_params->flags->extra.conv.output_tile_w;
+            cur_input_offset += conv_params->flags->extra.conv.output_tile_c * conv_params->output_tile_w;
 #endif // !STABLE_POWER
             vm_offset += real_chunk_len;
         }
 #if !STABLE_POWER
-        input_offset -= tile_h_offset * conv_params->flags->extra.conv.output_tile_c * conv_params->flags->extra.conv.output_tile_w;
+        input_offset -= tile_h_offset * conv_params->flags->extra.conv.output_tile_c * conv_params->output_tile_w;
         cur_input_offset = input_offset + conv_params->flags->extra.conv.output_tile_c * (offset_w + 1);
 #endif // !STABLE_POWER
         psum_offset -= tile_h_offset * OUTPUT_W * OUTPUT_C;
@@ -765,11 +879,33 @@ static void conv_merge(Model *model, ConvTaskParams *conv_params, ParameterInfo
         cur_dst = dst + OUTPUT_C * (offset_w + 1);
         tile_h_offset = 0;
     }
+#if HAWAII
+    // Later jobs overwrite tile results and partial sums used in this merge, so that all jobs so far should be recorded first
+    hawaii_flush_footprints(ctx);
+#endif // HAWAII
 }
 #endif // !STABLE_POWER
 
 #ifdef OpConv
-void handle_conv(Model *model, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
+static const ConvTiling* select_conv_tiling(ConvTaskParams *conv_params, const Node *node) {
+    const ConvNodeFlags* flags = &node->flags.extra.conv;
+    uint8_t tiling_idx = 0;
+#if HAWAII
+    tiling_idx = read_hawaii_layer_tiling(conv_params->ctx, conv_params->ctx->model_vm.layer_idx, CONV_TILINGS_LEN);
+#endif
+    MY_ASSERT(tiling_idx < CONV_TILINGS_LEN);
+    conv_params->output_tile_w = flags->tilings[tiling_idx].output_tile_w;
+    conv_params->output_tile_h = flags->tilings[tiling_idx].output_tile_h;
+    my_printf_debug("output_tile_w=%d, output_tile_h=%d" NEWLINE, conv_params->output_tile_w, conv_params->output_tile_h);
+    // Tile counts from transform.py are rounded up, checked without divisions
+    MY_ASSERT(flags->tilings[tiling_idx].n_tiles_w * conv_params->output_tile_w >= conv_params->OUTPUT_W &&
+              (flags->tilings[tiling_idx].n_tiles_w - 1) * conv_params->output_tile_w < conv_params->OUTPUT_W);
+    MY_ASSERT(flags->tilings[tiling_idx].n_tiles_h * conv_params->output_tile_h >= conv_params->OUTPUT_H &&
+              (flags->tilings[tiling_idx].n_tiles_h - 1) * conv_params->output_tile_h < conv_params->OUTPUT_H);
+    return &flags->tilings[tiling_idx];
+}
+
+void handle_conv(InferenceContext *ctx, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
     const ParameterInfo *conv_input = input[0], *conv_filter = input[1], *conv_bias = (node->inputs_len == 3) ? input[2] : nullptr;
     my_printf_debug("Conv!" NEWLINE);
 
@@ -778,27 +914,33 @@ void handle_conv(Model *model, const ParameterInfo *input[], ParameterInfo *outp
                    CHANNEL = conv_filter->dims[1];
 
     int16_t input_channels = conv_input->dims[1];
-    ConvTaskParams *conv_params = &conv_params_obj;
+    ConvTaskParams *conv_params = &ctx->conv_params;
     const uint8_t* pads = conv_params->flags->extra.conv.pads;
     enum { PAD_H_BEGIN = 0, PAD_W_BEGIN = 1, PAD_H_END = 2, PAD_W_END = 3 };
 
+#if INTERMITTENT
+    // tile counts are used only for recovery from power failures
+    const ConvTiling* tiling = select_conv_tiling(conv_params, node);
+#else
+    select_conv_tiling(conv_params, node);
+#endif
     int16_t output_tile_len =
-        conv_params->flags->extra.conv.output_tile_h *
-        conv_params->flags->extra.conv.output_tile_w *
+        conv_params->output_tile_h *
+        conv_params->output_tile_w *
         conv_params->flags->extra.conv.output_tile_c;
 
     MY_ASSERT(output_tile_len < CPU_BUFFER_SIZE);
     // reserve memory for psum
-    matrix_mpy_results -= output_tile_len;
-    my_printf_debug("matrix_mpy_results offset: %ld" NEWLINE, matrix_mpy_results - lea_buffer);
+    conv_params->matrix_mpy_results -= output_tile_len;
+    my_printf_debug("matrix_mpy_results offset: %ld" NEWLINE, conv_params->matrix_mpy_results - lea_buffer);
 
     // input_tile_w/input_tile_h
     conv_params->tile_w =
         MIN_VAL(W + pads[PAD_W_BEGIN] + pads[PAD_W_END],
-                (node->flags.extra.conv.output_tile_w - 1) * conv_params->stride_w + conv_params->kW);
+                (conv_params->output_tile_w - 1) * conv_params->stride_w + conv_params->kW);
     conv_params->tile_h =
         MIN_VAL(H + pads[PAD_H_BEGIN] + pads[PAD_H_END],
-                (node->flags.extra.conv.output_tile_h - 1) * conv_params->stride_h + conv_params->kH);
+                (conv_params->output_tile_h - 1) * conv_params->stride_h + conv_params->kH);
 
     my_printf_debug("tile_w = %d" NEWLINE, conv_params->tile_w);
     my_printf_debug("tile_h = %d" NEWLINE, conv_params->tile_h);
@@ -807,6 +949,11 @@ void handle_conv(Model *model, const ParameterInfo *input[], ParameterInfo *outp
     conv_params->conv_input = conv_input;
     conv_params->conv_filter = conv_filter;
     conv_params->conv_bias = conv_bias;
+#if !SPARSE
+    // Biases are divided by scales of conv inputs in transform.py, which stores the scale it used as the scale of biases
+    MY_ASSERT_ALWAYS(!conv_bias || !(conv_bias->scale != conv_input->scale),
+                     "Biases of %s are pre-scaled with a wrong input scale" NEWLINE, node->name);
+#endif // SPARSE
     conv_params->output = output;
     conv_params->filter_buffer_addr = NULL;
     conv_params->cached_filter_idx = -1;
@@ -820,7 +967,7 @@ void handle_conv(Model *model, const ParameterInfo *input[], ParameterInfo *outp
 #if STABLE_POWER
     conv_params->psum_buffer_version = 0;
 #else // STABLE_POWER
-    conv_params->psum_buffer_version = (conv_params->kH * conv_params->kW * (input_channels / node->flags.extra.conv.input_tile_c)) & 0x1;
+    conv_params->psum_buffer_version = (conv_params->kH * conv_params->kW * conv_params->n_tiles_c) & 0x1;
 #endif // STABLE_POWER
 
     conv_params->CHANNEL = CHANNEL;
@@ -850,29 +997,32 @@ RECOVERY:
 
     conv_params->input_h = conv_params->input_h_first;
     conv_params->input_w = conv_params->input_w_first;
+    conv_params->tile_output_h = conv_params->tile_output_w = 0;
+    conv_params->tile_h_offset = conv_params->tile_w_offset = 0;
 #if INTERMITTENT
     /* Handle sub-layer footprint */
-    uint32_t first_unfinished_sub_layer_idx = read_hawaii_sub_layer_footprint(conv_params->model->layer_idx);
+    uint32_t first_unfinished_sub_layer_idx = read_hawaii_sub_layer_footprint(conv_params->ctx, conv_params->ctx->model_vm.layer_idx);
     my_printf_debug("first_unfinished_sub_layer_idx: %d" NEWLINE, first_unfinished_sub_layer_idx);
 
 
-    uint16_t n_output_tile_w = upper_gauss(conv_params->OUTPUT_W, conv_params->flags->extra.conv.output_tile_w);
-    uint16_t n_output_tile_h = upper_gauss(conv_params->OUTPUT_H, conv_params->flags->extra.conv.output_tile_h);
+    uint16_t n_output_tile_w = tiling->n_tiles_w;
+    uint16_t n_output_tile_h = tiling->n_tiles_h;
     uint16_t sub_layers_in_a_filter_tile = n_output_tile_w * n_output_tile_h;
     my_printf_debug("sub_layers_in_a_filter_tile: %d" NEWLINE, sub_layers_in_a_filter_tile);
     // clarify the score to avoid compile error (cross initialization)
     {
         MY_ASSERT(n_output_tile_w);
         MY_ASSERT(n_output_tile_h);
-        conv_params->filter_tile_index = first_unfinished_sub_layer_idx / sub_layers_in_a_filter_tile;
+        // Quotients below are indices of tiles or kernel positions, which are small enough for divmod_small
+        conv_params->filter_tile_index = divmod_small(&first_unfinished_sub_layer_idx, sub_layers_in_a_filter_tile);
 #if SPARSE
         conv_params->row_index = conv_params->filter_tile_index;
-        conv_params->next_row_val = get_row_val(model, conv_filter, conv_params->row_index);
+        conv_params->next_row_val = get_row_val(ctx, conv_filter, conv_params->row_index);
         // TODO: append 0 to the pruned channels
         next_nonzero_value(node, conv_params, &col_val);
         if(conv_params->n_cols) {
             // XXX: add a checker to verify the result
-            my_memcpy_from_param_col(model, COL_VALS, conv_filter, conv_params->cur_row_val, conv_params->n_cols * sizeof(int16_t));
+            my_memcpy_from_param_col(ctx, COL_VALS, conv_filter, conv_params->cur_row_val, conv_params->n_cols * sizeof(int16_t));
             for(int16_t idx = 0; idx < conv_params->n_cols; ++idx) {
                 my_printf_debug("%d ", COL_VALS[idx]);
             }
@@ -882,31 +1032,32 @@ RECOVERY:
             goto EXIT_LAYER;
         }
 #endif // SPARSE
-        first_unfinished_sub_layer_idx %= sub_layers_in_a_filter_tile;
 
-        uint16_t tile_w_offset = first_unfinished_sub_layer_idx / n_output_tile_h;
-        uint16_t tile_h_offset = first_unfinished_sub_layer_idx % n_output_tile_h;
-        uint16_t input_w_offset = tile_w_offset * conv_params->flags->extra.conv.output_tile_w * conv_params->stride_w;
-        uint16_t input_h_offset = tile_h_offset * conv_params->flags->extra.conv.output_tile_h * conv_params->stride_h;
+        uint16_t tile_w_index = divmod_small(&first_unfinished_sub_layer_idx, n_output_tile_h);
+        uint16_t tile_h_index = first_unfinished_sub_layer_idx;
+        conv_params->tile_output_w = tile_w_index * conv_params->output_tile_w;
+        conv_params->tile_output_h = tile_h_index * conv_params->output_tile_h;
+        uint16_t input_w_offset = conv_params->tile_output_w * conv_params->stride_w;
+        uint16_t input_h_offset = conv_params->tile_output_h * conv_params->stride_h;
         my_printf_debug("input_w_offset: %d" NEWLINE, input_w_offset);
         my_printf_debug("input_h_offset: %d" NEWLINE, input_h_offset);
         conv_params->input_w += input_w_offset;
         conv_params->input_h += input_h_offset;
 
         /* Handle intra-sub-layer footprint */
-        uint32_t first_unfinished_job_idx = run_recovery(model, output);
+        uint32_t first_unfinished_job_idx = run_recovery(ctx, output);
         my_printf_debug("first_unfinished_job_idx: %d\n", first_unfinished_job_idx);
         // XXX: the jobs should be even
-        fix_first_unfinished_value_offset(model, &first_unfinished_job_idx);
+        fix_first_unfinished_value_offset(ctx, &first_unfinished_job_idx);
         my_printf_debug("fixed first_unfinished_job_idx: %d\n", first_unfinished_job_idx);
         MY_ASSERT(~first_unfinished_job_idx & 0x1);
 
         // XXX: mixing output and input to calculate may be wrong
         // XXX: Handle CHANNEL % output_tile_c != 0
-        uint16_t cur_output_tile_h = MIN_VAL(conv_params->flags->extra.conv.output_tile_h,
-                conv_params->OUTPUT_H - tile_h_offset * conv_params->flags->extra.conv.output_tile_h);
-        uint16_t cur_output_tile_w = MIN_VAL(conv_params->flags->extra.conv.output_tile_w,
-                conv_params->OUTPUT_W - tile_w_offset * conv_params->flags->extra.conv.output_tile_w);
+        uint16_t cur_output_tile_h = MIN_VAL(conv_params->output_tile_h,
+                conv_params->OUTPUT_H - conv_params->tile_output_h);
+        uint16_t cur_output_tile_w = MIN_VAL(conv_params->output_tile_w,
+                conv_params->OUTPUT_W - conv_params->tile_output_w);
         uint16_t cur_output_tile_c = MIN_VAL(conv_params->flags->extra.conv.output_tile_c,
                 conv_params->OUTPUT_CHANNEL - conv_params->filter_tile_index * conv_params->flags->extra.conv.output_tile_c);
 
@@ -931,32 +1082,30 @@ RECOVERY:
         my_printf_debug("n_weight_tiles: %d" NEWLINE, n_weight_tiles);
         uint16_t intra_kernel_offset = 0;
 #if SPARSE
-        int16_t finished_weight_tiles = first_unfinished_job_idx / jobs_in_a_weight_tile;
+        int16_t finished_weight_tiles = divmod_small(&first_unfinished_job_idx, jobs_in_a_weight_tile);
         if(finished_weight_tiles == conv_params->n_cols) {
             // the filter tiles have finished, but power off before resetting footprint counter
 #if HAWAII
-            write_hawaii_sub_layer_footprint(model->layer_idx, 1);
+            write_hawaii_sub_layer_footprint(ctx, ctx->model_vm.layer_idx, 1);
 #endif // HAWAII
             goto RECOVERY;
         }
         my_printf_debug("finished_weight_tiles: %d" NEWLINE, finished_weight_tiles);
-        conv_params->input_tile_c_index = COL_VALS[finished_weight_tiles] / n_weight_tiles;
-        first_unfinished_job_idx -= finished_weight_tiles * jobs_in_a_weight_tile;
         conv_params->cur_n_cols = finished_weight_tiles;
-        intra_kernel_offset = COL_VALS[conv_params->cur_n_cols] % n_weight_tiles;
+        uint32_t weight_tile_idx = COL_VALS[conv_params->cur_n_cols];
+        conv_params->input_tile_c_index = divmod_small(&weight_tile_idx, n_weight_tiles);
+        intra_kernel_offset = weight_tile_idx;
         jobs_in_a_weight_tile = 2 * cur_output_tile_w * cur_output_tile_h * cur_output_tile_c; // psum, accum
 #else // SPARSE
         if(first_unfinished_job_idx == n_weight_tiles * jobs_in_a_weight_tile * conv_params->n_tiles_c) {
 #if HAWAII
-            write_hawaii_sub_layer_footprint(model->layer_idx, 1);
+            write_hawaii_sub_layer_footprint(ctx, ctx->model_vm.layer_idx, 1);
 #endif // HAWAII
             goto RECOVERY;
         }
-        conv_params->input_tile_c_index = first_unfinished_job_idx / (jobs_in_a_weight_tile * n_weight_tiles);
-        first_unfinished_job_idx %= (jobs_in_a_weight_tile * n_weight_tiles);
+        conv_params->input_tile_c_index = divmod_small(&first_unfinished_job_idx, jobs_in_a_weight_tile * n_weight_tiles);
         jobs_in_a_weight_tile = 2 * cur_output_tile_w * cur_output_tile_h * cur_output_tile_c; // psum, accum
-        intra_kernel_offset = first_unfinished_job_idx / jobs_in_a_weight_tile;
-        first_unfinished_job_idx %= jobs_in_a_weight_tile;
+        intra_kernel_offset = divmod_small(&first_unfinished_job_idx, jobs_in_a_weight_tile);
 #endif // SPARSE
 
         my_printf_debug("first_unfinished_job_idx: %d\n", first_unfinished_job_idx);
@@ -968,21 +1117,22 @@ RECOVERY:
         my_printf_debug("col val: %d" NEWLINE, COL_VALS[conv_params->cur_n_cols]);
         my_printf_debug("real intra_kernel_offset: %d" NEWLINE, intra_kernel_offset);
 #endif // SPARSE
-        conv_params->kY = intra_kernel_offset / conv_params->kH;
-        conv_params->kX = intra_kernel_offset % conv_params->kH;
+        uint32_t kernel_position = intra_kernel_offset;
+        conv_params->kY = divmod_small(&kernel_position, conv_params->kH);
+        conv_params->kX = kernel_position;
 
         uint16_t jobs_in_a_set_psum_cmd = cur_output_tile_w * cur_output_tile_h * cur_output_tile_c;
-        conv_params->cur_op = first_unfinished_job_idx / jobs_in_a_set_psum_cmd;
+        conv_params->cur_op = divmod_small(&first_unfinished_job_idx, jobs_in_a_set_psum_cmd);
 
         my_printf_debug("cur_op: %d"  NEWLINE, conv_params->cur_op);
         MY_ASSERT(!(conv_params->cur_op & ~1)); // should be 0 or 1
 
-        first_unfinished_job_idx %= jobs_in_a_set_psum_cmd;
-        uint16_t input_tile_w_offset = first_unfinished_job_idx / (cur_output_tile_h * cur_output_tile_c) * conv_params->stride_w;
-        first_unfinished_job_idx %= (cur_output_tile_h * cur_output_tile_c);
+        conv_params->tile_w_offset = divmod_small(&first_unfinished_job_idx, cur_output_tile_h * cur_output_tile_c);
+        uint16_t input_tile_w_offset = conv_params->tile_w_offset * conv_params->stride_w;
         my_printf_debug("remain: %d" NEWLINE, first_unfinished_job_idx);
 
-        uint16_t input_tile_h_offset = first_unfinished_job_idx / cur_output_tile_c * conv_params->stride_h;
+        conv_params->tile_h_offset = divmod_small(&first_unfinished_job_idx, cur_output_tile_c);
+        uint16_t input_tile_h_offset = conv_params->tile_h_offset * conv_params->stride_h;
         my_printf_debug("input_tile_w_offset: %d" NEWLINE, input_tile_w_offset);
         my_printf_debug("input_tile_h_offset: %d" NEWLINE, input_tile_h_offset);
         my_printf_debug("jobs_in_a_set_psum_cmd: %d" NEWLINE, jobs_in_a_set_psum_cmd);
@@ -994,10 +1144,10 @@ RECOVERY:
         if(conv_params->cur_op) {
             filter_offset_in_tile = 0;
 #if HAWAII
-            write_hawaii_layer_footprint(model->layer_idx, -(first_unfinished_job_idx % cur_output_tile_c)); // discard jobs
+            write_hawaii_layer_footprint(ctx, ctx->model_vm.layer_idx, -first_unfinished_job_idx); // discard jobs
 #endif // HAWAII
         } else {
-            filter_offset_in_tile = first_unfinished_job_idx % cur_output_tile_c;
+            filter_offset_in_tile = first_unfinished_job_idx;
         }
         my_printf_debug("filter_offset_in_tile: %d" NEWLINE, filter_offset_in_tile);
         conv_params->filter_idx =
@@ -1009,7 +1159,7 @@ RECOVERY:
             conv_params->input_tile_c_offset = 0;
             conv_params->input_tile_c_index = 0;
 #if HAWAII
-            write_hawaii_sub_layer_footprint(model->layer_idx, 1);
+            write_hawaii_sub_layer_footprint(ctx, ctx->model_vm.layer_idx, 1);
 #endif
         }
 
@@ -1046,13 +1196,13 @@ RECOVERY:
     next_nonzero_value(node, conv_params, &col_val);
     if(conv_params->n_cols) {
         // XXX: add a checker to verify the result
-        my_memcpy_from_param_col(model, COL_VALS, conv_filter, conv_params->cur_row_val, conv_params->n_cols * sizeof(int16_t));
+        my_memcpy_from_param_col(ctx, COL_VALS, conv_filter, conv_params->cur_row_val, conv_params->n_cols * sizeof(int16_t));
     }
 #if ENABLE_COUNTERS
     stop_cpu_counter(&Counters::indexing);
 #endif
-    conv_params->kY = (col_val % (conv_params->kW * conv_params->kH)) / conv_params->kH;
-    conv_params->kX = (col_val % (conv_params->kW * conv_params->kH)) % conv_params->kH;
+    conv_params->kY = counted_div(counted_mod(col_val, conv_params->kW * conv_params->kH), conv_params->kH);
+    conv_params->kX = counted_mod(counted_mod(col_val, conv_params->kW * conv_params->kH), conv_params->kH);
 #if STABLE_POWER
     conv_params->psum_buffer_version = 0;
 #else // STABLE_POWER
@@ -1098,8 +1248,10 @@ RECOVERY:
         conv_params->filter_offset = 1 * conv_params->dest_offset;
         while (true) {
             my_printf_debug("input_h: %d/input_w: %d" NEWLINE, conv_params->input_h, conv_params->input_w);
-            for (; conv_params->input_w <= conv_params->input_w_last; conv_params->input_w += conv_params->flags->extra.conv.output_tile_w * conv_params->stride_w) {
-                for (; conv_params->input_h <= conv_params->input_h_last; conv_params->input_h += conv_params->flags->extra.conv.output_tile_h * conv_params->stride_h) {
+            for (; conv_params->input_w <= conv_params->input_w_last;
+                   conv_params->input_w += conv_params->output_tile_w * conv_params->stride_w, conv_params->tile_output_w += conv_params->output_tile_w) {
+                for (; conv_params->input_h <= conv_params->input_h_last;
+                       conv_params->input_h += conv_params->output_tile_h * conv_params->stride_h, conv_params->tile_output_h += conv_params->output_tile_h) {
                     for(; conv_params->kY < conv_params->kW;) {
                         for(; conv_params->kX < conv_params->kH;) {
                             conv_params->input_w += conv_params->kY;
@@ -1107,40 +1259,33 @@ RECOVERY:
                             my_printf_debug("(%d, %d) (%d, %d)" NEWLINE, conv_params->input_h, conv_params->input_w, conv_params->kX, conv_params->kY);
                             my_printf_debug("current psum buffer version: %d" NEWLINE, conv_params->psum_buffer_version);
 #if !STABLE_POWER
-                            int16_t tile_h_offset =
-                                ((conv_params->input_h - conv_params->input_h_first - conv_params->kX) / conv_params->stride_h) %
-                                conv_params->flags->extra.conv.output_tile_h;
-                            int16_t tile_w_offset =
-                                ((conv_params->input_w - conv_params->input_w_first - conv_params->kY) / conv_params->stride_w) %
-                                conv_params->flags->extra.conv.output_tile_w;
+                            int16_t tile_h_offset = conv_params->tile_h_offset;
+                            int16_t tile_w_offset = conv_params->tile_w_offset;
                             my_printf_debug("tile_h_offset: %d, tile_w_offset: %d" NEWLINE, tile_h_offset, tile_w_offset);
-                            int16_t output_h = (conv_params->input_h - conv_params->input_h_first - conv_params->kX) /
-                                                conv_params->stride_h,
-                                    output_w = (conv_params->input_w - conv_params->input_w_first - conv_params->kY) /
-                                                conv_params->stride_w;
+                            int16_t output_h = conv_params->tile_output_h + tile_h_offset,
+                                    output_w = conv_params->tile_output_w + tile_w_offset;
 #endif // STABLE_POWER
                             if(conv_params->cur_op == 0) {
                                 // perform psum
-                                handle_conv_inner_loop(model, conv_params);
+                                handle_conv_inner_loop(ctx, conv_params);
 #if ENABLE_COUNTERS && DEMO
-                                report_progress();
+                                report_progress(ctx);
 #endif
 #if !STABLE_POWER
                                 conv_params->cur_op ^= 1;
-                                output_h = (conv_params->input_h - conv_params->input_h_first - conv_params->kX) /
-                                            conv_params->stride_h;
-                                output_w = (conv_params->input_w - conv_params->input_w_first - conv_params->kY) /
-                                            conv_params->stride_w;
+                                output_h = conv_params->tile_output_h;
+                                output_w = conv_params->tile_output_w;
                                 tile_h_offset = tile_w_offset = 0;
                             }
                             if(conv_params->cur_op == 1) {
                                 my_printf_debug("tile_h_offset: %d, tile_w_offset: %d" NEWLINE, tile_h_offset, tile_w_offset);
                                 my_printf_debug("output_h: %d, output_w: %d" NEWLINE, output_h, output_w);
                                 // perform accum
-                                conv_merge(model, conv_params, output, output_w, output_h, tile_h_offset, tile_w_offset);
+                                conv_merge(ctx, conv_params, output, output_w, output_h, tile_h_offset, tile_w_offset);
                                 conv_params->cur_op ^= 1;
                                 conv_params->input_h -= tile_h_offset * conv_params->stride_h;
                                 conv_params->input_w -= tile_w_offset * conv_params->stride_w;
+                                conv_params->tile_h_offset = conv_params->tile_w_offset = 0;
                             }
                             conv_params->psum_buffer_version ^= 0x1;
                             my_printf_debug("Reseted input_h: %d/input_w: %d" NEWLINE, conv_params->input_h, conv_params->input_w);
@@ -1156,15 +1301,15 @@ RECOVERY:
                             col_val = COL_VALS[conv_params->cur_n_cols];
                             my_printf_debug("col_val: %d" NEWLINE, col_val);
                             my_printf_debug("conv_params->input_tile_c_index: %d" NEWLINE, conv_params->input_tile_c_index);
-                            if(col_val / (conv_params->kH * conv_params->kW) != conv_params->input_tile_c_index) {
-                                conv_params->input_tile_c_index = col_val / (conv_params->kH * conv_params->kW);
+                            if(counted_div(col_val, conv_params->kH * conv_params->kW) != conv_params->input_tile_c_index) {
+                                conv_params->input_tile_c_index = counted_div(col_val, conv_params->kH * conv_params->kW);
                                 conv_params->cached_input_h = conv_params->input_h_first - 1;
                                 conv_params->cached_input_w = conv_params->input_w_first - 1;
                                 conv_params->input_tile_c_offset = conv_params->input_tile_c_index * conv_params->flags->extra.conv.input_tile_c;
                                 my_printf_debug("Swap tile_c !" NEWLINE "input_tile_c: %d" NEWLINE, conv_params->input_tile_c_offset);
                             }
-                            conv_params->kX = (col_val % (conv_params->kW * conv_params->kH)) % conv_params->kH;
-                            conv_params->kY = (col_val % (conv_params->kW * conv_params->kH)) / conv_params->kH;
+                            conv_params->kX = counted_mod(counted_mod(col_val, conv_params->kW * conv_params->kH), conv_params->kH);
+                            conv_params->kY = counted_div(counted_mod(col_val, conv_params->kW * conv_params->kH), conv_params->kH);
                             conv_params->cached_filter_idx = conv_params->cached_input_tile_c_offset = -1;
                             conv_params->cached_kX = conv_params->cached_kY = -1;
 #else // SPARSE
@@ -1199,9 +1344,11 @@ RECOVERY:
                     conv_params->kX = conv_params->kY = 0;
 #endif // SPARSE
 #if STABLE_POWER
-                    uint16_t output_h = (conv_params->input_h - conv_params->input_h_first) / conv_params->stride_h,
-                             output_w = (conv_params->input_w - conv_params->input_w_first) / conv_params->stride_w;
-                    preserve_output(model, node, output, conv_params->filter_idx, output_w, output_h, 0, 0, 0);
+                    uint16_t output_h = conv_params->tile_output_h, output_w = conv_params->tile_output_w;
+                    if (node->flags.generic & FUSED_RELU) {
+                        my_relu_q15(cpu_buffer, cpu_buffer, output_tile_len);
+                    }
+                    preserve_output(ctx, node, output, conv_params->filter_idx, output_w, output_h, 0, 0, 0);
                     init_cpu_buffer();
 #else // STABLE_POWER
                     /* If (conv_params->kH * conv_params->kW * (input_channels / conv_params->flags->extra.conv.input_tile_c))
@@ -1212,27 +1359,27 @@ RECOVERY:
 #if SPARSE
                     conv_params->psum_buffer_version = conv_params->n_cols & 0x1 ;
 #else // SPARSE
-                    conv_params->psum_buffer_version = (conv_params->kH * conv_params->kW * (input_channels / conv_params->flags->extra.conv.input_tile_c)) & 0x1 ;
+                    conv_params->psum_buffer_version = (conv_params->kH * conv_params->kW * conv_params->n_tiles_c) & 0x1 ;
 #endif // SPARSE
 #if HAWAII
                     // commit model for sub_layer
-                    write_hawaii_sub_layer_footprint(conv_params->model->layer_idx, 1);
+                    write_hawaii_sub_layer_footprint(conv_params->ctx, conv_params->ctx->model_vm.layer_idx, 1);
 #endif // HAWAII
 #endif // STABLE_POWER
 #if SPARSE
-                    int16_t next_input_h = conv_params->input_h + conv_params->flags->extra.conv.output_tile_h * conv_params->stride_h;
-                    int16_t next_input_w = conv_params->input_w + conv_params->flags->extra.conv.output_tile_w * conv_params->stride_w;
+                    int16_t next_input_h = conv_params->input_h + conv_params->output_tile_h * conv_params->stride_h;
+                    int16_t next_input_w = conv_params->input_w + conv_params->output_tile_w * conv_params->stride_w;
                     if(next_input_h > conv_params->input_h_last && next_input_w > conv_params->input_w_last) {
                         break;
                     }
                     conv_params->cur_n_cols = 0;
                     col_val = COL_VALS[conv_params->cur_n_cols];
                     my_printf_debug("col_val: %d" NEWLINE, col_val);
-                    conv_params->kY = (col_val % (conv_params->kW * conv_params->kH)) / conv_params->kH;
-                    conv_params->kX = (col_val % (conv_params->kW * conv_params->kH)) % conv_params->kH;
+                    conv_params->kY = counted_div(counted_mod(col_val, conv_params->kW * conv_params->kH), conv_params->kH);
+                    conv_params->kX = counted_mod(counted_mod(col_val, conv_params->kW * conv_params->kH), conv_params->kH);
                     conv_params->cached_filter_idx = conv_params->cached_input_tile_c_offset = -1;
                     conv_params->cached_kX = conv_params->cached_kY = -1;
-                    conv_params->input_tile_c_index = col_val / (conv_params->kW * conv_params->kH);
+                    conv_params->input_tile_c_index = counted_div(col_val, conv_params->kW * conv_params->kH);
 #else
                     conv_params->input_tile_c_index = 0;
 #endif // SPARSE
@@ -1241,6 +1388,7 @@ RECOVERY:
                     my_printf_debug("Swap tile_h !" NEWLINE);
                 }
                 conv_params->input_h = conv_params->input_h_first;
+                conv_params->tile_output_h = 0;
                 conv_params->cached_input_w = conv_params->input_w_first - 1;
                 my_printf_debug("Swap tile_w !" NEWLINE);
             }
@@ -1265,9 +1413,9 @@ RECOVERY:
         next_nonzero_value(node, conv_params, &col_val);
         if(conv_params->n_cols) {
             // XXX: add a checker to verify the result
-            my_memcpy_from_param_col(model, COL_VALS, conv_filter, conv_params->cur_row_val, conv_params->n_cols * sizeof(int16_t));
-            conv_params->kY = (col_val % (conv_params->kW * conv_params->kH)) / conv_params->kH;
-            conv_params->kX = (col_val % (conv_params->kW * conv_params->kH)) % conv_params->kH;
+            my_memcpy_from_param_col(ctx, COL_VALS, conv_filter, conv_params->cur_row_val, conv_params->n_cols * sizeof(int16_t));
+            conv_params->kY = counted_div(counted_mod(col_val, conv_params->kW * conv_params->kH), conv_params->kH);
+            conv_params->kX = counted_mod(counted_mod(col_val, conv_params->kW * conv_params->kH), conv_params->kH);
         } else {
             goto EXIT_LAYER;
         }
@@ -1276,9 +1424,9 @@ RECOVERY:
 #endif
 #if HAWAII
         // commit model for sub_layer
-        my_printf_debug("current sub_layer_idx: %d" NEWLINE, read_hawaii_sub_layer_footprint_vm(conv_params->model->layer_idx));
+        my_printf_debug("current sub_layer_idx: %d" NEWLINE, read_hawaii_sub_layer_footprint_vm(conv_params->ctx, conv_params->ctx->model_vm.layer_idx));
         my_printf_debug("new sub_layer_idx: %d" NEWLINE, conv_params->filter_tile_index * sub_layers_in_a_filter_tile);
-        write_hawaii_sub_layer_footprint(conv_params->model->layer_idx, conv_params->filter_tile_index * sub_layers_in_a_filter_tile - read_hawaii_sub_layer_footprint_vm(conv_params->model->layer_idx));
+        write_hawaii_sub_layer_footprint(conv_params->ctx, conv_params->ctx->model_vm.layer_idx, conv_params->filter_tile_index * sub_layers_in_a_filter_tile - read_hawaii_sub_layer_footprint_vm(conv_params->ctx, conv_params->ctx->model_vm.layer_idx));
 #endif // HAWAII
 #else // SPARSE
         conv_params->input_tile_c_index = conv_params->input_tile_c_offset = 0;
@@ -1290,6 +1438,7 @@ RECOVERY:
         conv_params->cached_kX = conv_params->cached_kY = -1;
         conv_params->input_h = conv_params->input_h_first;
         conv_params->input_w = conv_params->input_w_first;
+        conv_params->tile_output_h = conv_params->tile_output_w = 0;
         /* init version */
 #if STABLE_POWER
         conv_params->psum_buffer_version = 0;
@@ -1297,15 +1446,15 @@ RECOVERY:
 #if SPARSE
         conv_params->psum_buffer_version = conv_params->n_cols & 0x1;
 #else // SPARSE
-        conv_params->psum_buffer_version = (conv_params->kH * conv_params->kW * input_channels / node->flags.extra.conv.input_tile_c) & 0x1;
+        conv_params->psum_buffer_version = (conv_params->kH * conv_params->kW * conv_params->n_tiles_c) & 0x1;
 #endif // SPARSE
 #endif // STABLE_POWER
     }
 #if !STABLE_POWER or SPARSE
 EXIT_LAYER:
 #endif
-    matrix_mpy_results += output_tile_len;
-    flip_state_bit(model, output);
+    conv_params->matrix_mpy_results += output_tile_len;
+    flip_state_bit(ctx, output);
 
     my_printf_debug("handle_conv output" NEWLINE);
     //dump_params_nhwc_debug(model, output, node->output_name);
@@ -1343,17 +1492,17 @@ void ConvMergeOutputChunkHandler(uint32_t range_offset, uint16_t range_len, int8
 #endif
 
 #if SPARSE
-void set_index(Model *model, const ParameterInfo *conv_filter, uint16_t n_output_tile_c, uint16_t n_tiles_c, uint16_t *cols, uint16_t *rows) {
+void set_index(InferenceContext *ctx, const ParameterInfo *conv_filter, uint16_t n_output_tile_c, uint16_t n_tiles_c, uint16_t *cols, uint16_t *rows) {
 #if STABLE_POWER
     uint16_t n_rows = n_output_tile_c  + 1;
-    my_memcpy_from_param_row(model, rows, conv_filter, 0, (n_rows) * sizeof(int16_t));
+    my_memcpy_from_param_row(ctx, rows, conv_filter, 0, (n_rows) * sizeof(int16_t));
     uint16_t n_cols = rows[n_rows - 1]; // calculate from row values
-    my_memcpy_from_param_col(model, cols, conv_filter, 0, (n_cols) * sizeof(int16_t));
+    my_memcpy_from_param_col(ctx, cols, conv_filter, 0, (n_cols) * sizeof(int16_t));
 #else // STABLE_POWER
     uint16_t n_rows = n_tiles_c + 1;
-    my_memcpy_from_param_row(model, rows, conv_filter, 0, (n_rows) * sizeof(int16_t));
+    my_memcpy_from_param_row(ctx, rows, conv_filter, 0, (n_rows) * sizeof(int16_t));
     uint16_t n_cols = rows[n_rows - 1]; // calculate from row values
-    my_memcpy_from_param_col(model, cols, conv_filter, 0, (n_cols) * sizeof(int16_t));
+    my_memcpy_from_param_col(ctx, cols, conv_filter, 0, (n_cols) * sizeof(int16_t));
 #endif // STABLE_POWER
 }
 #endif // SPARSE
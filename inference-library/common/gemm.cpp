@@ -8,7 +8,7 @@
 #include "my_dsplib.h"
 #include "intermittent-cnn.h"
 
-void alloc_gemm(Model *model, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
+void alloc_gemm(InferenceContext *ctx, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
     const ParameterInfo *A = input[0], *B = input[1];
 
     MY_ASSERT(A->dims[0] == 1);
@@ -16,7 +16,7 @@ void alloc_gemm(Model *model, const ParameterInfo *input[], ParameterInfo *outpu
     output->dims[0] = A->dims[0];
     output->dims[1] = B->dims[1];
     output->bitwidth = 16;
-    output->slot = get_next_slot(model, A);
+    output->slot = get_next_slot(ctx);
     output->scale = A->scale * B->scale;
     my_printf_debug("A: %f" NEWLINE, A->scale.toFloat());
     my_printf_debug("B: %f" NEWLINE, B->scale.toFloat());
@@ -62,7 +62,7 @@ inline void clear_filter<BATCH_SIZE>(int16_t* filter) {
 }
 #endif
 
-void handle_gemm(Model *model, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
+void handle_gemm(InferenceContext *ctx, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
 #ifdef OpGemm
     const ParameterInfo *A = input[0], *B = input[1], *C = input[2];
     const NodeFlags* flags = &node->flags;
@@ -90,9 +90,9 @@ void handle_gemm(Model *model, const ParameterInfo *input[], ParameterInfo *outp
     uint16_t rows[MAX_ROW_LEN_FC] = {0};
     int16_t first_tile_indices[MAX_N_FILTER_GROUP] = {0};
     int16_t n_rows = n_tiles + 1;
-    my_memcpy_from_param_row(model, rows, B, 0, n_rows * sizeof(int16_t));
+    my_memcpy_from_param_row(ctx, rows, B, 0, n_rows * sizeof(int16_t));
     int16_t n_filter_group = output->dims[1] / OP_FILTERS;
-    my_memcpy_from_param_first_tile_index(model, first_tile_indices, B, 0, n_filter_group * sizeof(int16_t));
+    my_memcpy_from_param_first_tile_index(ctx, first_tile_indices, B, 0, n_filter_group * sizeof(int16_t));
 #if ENABLE_COUNTERS
     stop_cpu_counter(&Counters::indexing);
 #endif
@@ -109,14 +109,14 @@ void handle_gemm(Model *model, const ParameterInfo *input[], ParameterInfo *outp
 #endif
 
 #if INTERMITTENT
-    uint16_t first_unfinished_value_idx = run_recovery(model, output);
+    uint16_t first_unfinished_value_idx = run_recovery(ctx, output);
 #if SPARSE
-    uint32_t first_unfinished_value_offset = job_index_to_offset_sparse(model, B, output, first_unfinished_value_idx);
+    uint32_t first_unfinished_value_offset = job_index_to_offset_sparse(ctx, B, output, first_unfinished_value_idx);
 #else
     uint32_t first_unfinished_value_offset = job_index_to_offset(output, first_unfinished_value_idx);
 #endif
     first_unfinished_value_offset = batch_start(first_unfinished_value_offset);
-    fix_first_unfinished_value_offset(model, &first_unfinished_value_offset);
+    fix_first_unfinished_value_offset(ctx, &first_unfinished_value_offset);
 
     my_printf_debug("Fixed footprint offset: %d" NEWLINE, first_unfinished_value_offset);
     tile = first_unfinished_value_offset / output_len;
@@ -132,7 +132,7 @@ void handle_gemm(Model *model, const ParameterInfo *input[], ParameterInfo *outp
 #if ENABLE_COUNTERS
     start_cpu_counter();
 #endif
-    my_memcpy_from_param_col(model, cols, B, rows[row_index - 1], n_cols * sizeof(int16_t));
+    my_memcpy_from_param_col(ctx, cols, B, rows[row_index - 1], n_cols * sizeof(int16_t));
 #if ENABLE_COUNTERS
     stop_cpu_counter(&Counters::indexing);
 #endif
@@ -161,7 +161,7 @@ void handle_gemm(Model *model, const ParameterInfo *input[], ParameterInfo *outp
         n_cols = next_row_val - cur_row_val;
         row_index++;
     }
-    my_memcpy_from_param_col(model, cols, B, rows[row_index - 1], n_cols * sizeof(int16_t));
+    my_memcpy_from_param_col(ctx, cols, B, rows[row_index - 1], n_cols * sizeof(int16_t));
 #if ENABLE_COUNTERS
     stop_cpu_counter(&Counters::indexing);
 #endif
@@ -202,7 +202,7 @@ void handle_gemm(Model *model, const ParameterInfo *input[], ParameterInfo *outp
 #if ENABLE_COUNTERS
             start_cpu_counter();
 #endif
-            my_memcpy_from_param(model, buffer_a, A, i, tile_channels * sizeof(uint16_t));
+            my_memcpy_from_param(ctx, buffer_a, A, i, tile_channels * sizeof(uint16_t));
 #if ENABLE_COUNTERS
             stop_cpu_counter(&Counters::dma_read_input);
 #endif
@@ -211,7 +211,7 @@ void handle_gemm(Model *model, const ParameterInfo *input[], ParameterInfo *outp
         buffer_a[tile_channels + 1] = 0;
 
         my_printf_debug("Tile for A" NEWLINE);
-        dump_matrix_debug(buffer_a, 1, extended_tile_channels, ValueInfo(A, model));
+        dump_matrix_debug(buffer_a, 1, extended_tile_channels, ValueInfo(A, ctx));
 #if STABLE_POWER
         int16_t output_offset = j_with_footprints;
         MY_ASSERT(output_len < CPU_BUFFER_SIZE);
@@ -239,7 +239,7 @@ void handle_gemm(Model *model, const ParameterInfo *input[], ParameterInfo *outp
             uint16_t block_size = OP_FILTERS * flags->extra.gemm.tile_channel;
             uint16_t filter_tile_src_offset = col_index * block_size;
             my_memcpy_from_param(
-                    model,
+                    ctx,
                     filter_ptr,
                     B,
                     filter_tile_src_offset,
@@ -251,7 +251,7 @@ void handle_gemm(Model *model, const ParameterInfo *input[], ParameterInfo *outp
                 start_cpu_counter();
 #endif
                 // Load the # of filters in a weight tile per DMA
-                my_memcpy_from_param(model, filter_ptr,
+                my_memcpy_from_param(ctx, filter_ptr,
                           B, (i + row) * B->dims[1] + j,
                           tile_width * sizeof(uint16_t));
 #if ENABLE_COUNTERS
@@ -271,7 +271,7 @@ void handle_gemm(Model *model, const ParameterInfo *input[], ParameterInfo *outp
 #if ENABLE_COUNTERS
                 start_cpu_counter();
 #endif
-                    filter_ptr[idx] = -static_cast<int32_t>(get_q15_param(model, C, idx + j)) / A->scale.toFloat();
+                    filter_ptr[idx] = -static_cast<int32_t>(get_q15_param(ctx, C, idx + j)) / A->scale.toFloat();
 #if ENABLE_COUNTERS
                 stop_cpu_counter(&Counters::dma_read_filter);
 #endif
@@ -280,32 +280,32 @@ void handle_gemm(Model *model, const ParameterInfo *input[], ParameterInfo *outp
             my_printf_debug("j: %d" NEWLINE, j);
             my_printf_debug("j_with_footprints: %d" NEWLINE, j_with_footprints);
             my_printf_debug("Tile for B" NEWLINE);
-            dump_matrix_debug(buffer_b, extended_tile_channels, full_tile_width, ValueInfo(B, model));
+            dump_matrix_debug(buffer_b, extended_tile_channels, full_tile_width, ValueInfo(B, ctx));
 
 #if STABLE_POWER
             MY_ASSERT(B->dims[0] / tile_channels * OP_FILTERS < CPU_BUFFER_SIZE);
             my_matrix_mpy_q15_to_vm(1, extended_tile_channels, extended_tile_channels, full_tile_width, buffer_a, buffer_b, buffer_temp,
-                              output, output_offset, values_to_preserve, 0, 0);
+                              ctx, output, output_offset, values_to_preserve, 0, 0);
 #else // STABLE_POWER
             my_matrix_mpy_q15(1, extended_tile_channels, extended_tile_channels, full_tile_width, buffer_a, buffer_b, buffer_temp,
-                              output, output_offset, values_to_preserve, 0, 0);
+                              ctx, output, output_offset, values_to_preserve, 0, 0);
 #endif // STABLE_POWER
 
             my_printf_debug("matrix_mpy_results" NEWLINE);
-            dump_matrix_debug(buffer_temp, full_tile_width, ValueInfo(output, model));
+            dump_matrix_debug(buffer_temp, full_tile_width, ValueInfo(output, ctx));
             my_printf_debug(NEWLINE);
 
 #if STABLE_POWER
             // compare_vm_vm(buffer_temp, model, output, output_offset, values_to_preserve);
 #else // STABLE_POWER
-            compare_vm_nvm(buffer_temp, model, output, output_offset, values_to_preserve);
+            compare_vm_nvm(buffer_temp, ctx, output, output_offset, values_to_preserve);
 #endif // STABLE_POWER
             my_printf_debug("output_offset=%d" NEWLINE, output_offset);
 #if HAWAII
 #if ENABLE_COUNTERS
             start_cpu_counter();
 #endif
-            hawaii_record_footprints(model, values_to_preserve);
+            hawaii_record_footprints(ctx, values_to_preserve);
 #if ENABLE_COUNTERS
             stop_cpu_counter(&Counters::dma_write_fp);
 #endif
@@ -329,7 +329,7 @@ void handle_gemm(Model *model, const ParameterInfo *input[], ParameterInfo *outp
 #endif // SPARSE
         }
 #if ENABLE_COUNTERS && DEMO
-        report_progress();
+        report_progress(ctx);
 #endif
 #if SPARSE
 #if ENABLE_COUNTERS
@@ -344,7 +344,7 @@ void handle_gemm(Model *model, const ParameterInfo *input[], ParameterInfo *outp
             row_index++;
         }
         if(n_cols) {
-            my_memcpy_from_param_col(model, cols, B, rows[row_index - 1], n_cols * sizeof(int16_t));
+            my_memcpy_from_param_col(ctx, cols, B, rows[row_index - 1], n_cols * sizeof(int16_t));
             //for(int idx = 0; idx < n_cols; ++idx) {
             //    my_printf("%d ", cols[idx]);
             //}
@@ -369,7 +369,7 @@ void handle_gemm(Model *model, const ParameterInfo *input[], ParameterInfo *outp
 #if ENABLE_COUNTERS
     start_cpu_counter();
 #endif
-    preserve_output(model, node, output, 0, 0, 0, 0, 0, 0);
+    preserve_output(ctx, node, output, 0, 0, 0, 0, 0, 0);
 #if ENABLE_COUNTERS
     stop_cpu_counter(&Counters::dma_write_ofm);
 #endif
@@ -378,20 +378,20 @@ void handle_gemm(Model *model, const ParameterInfo *input[], ParameterInfo *outp
 #if INTERMITTENT
 FINISH_LAYER:
 #endif
-    flip_state_bit(model, output);
+    flip_state_bit(ctx, output);
 
     my_printf_debug("handle_gemm output" NEWLINE);
-    dump_params_debug(model, output, node->output_name);
+    dump_params_debug(ctx, output, node->output_name);
 #endif // OpGemm
 }
 
-void alloc_gemmmerge(Model *model, const ParameterInfo *input[], ParameterInfo *output, const Node*) {
-    output->slot = get_next_slot(model, input[0]);
+void alloc_gemmmerge(InferenceContext *ctx, const ParameterInfo *input[], ParameterInfo *output, const Node*) {
+    output->slot = get_next_slot(ctx);
     int16_t output_len = output->dims[0] * output->dims[1];
     output->params_len = output_len * sizeof(int16_t);
 }
 
-void handle_gemmmerge(Model *model, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
+void handle_gemmmerge(InferenceContext *ctx, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
 #ifdef OpGemm
     const ParameterInfo *X = input[0];
 #if SPARSE
@@ -416,7 +416,7 @@ void handle_gemmmerge(Model *model, const ParameterInfo *input[], ParameterInfo
     uint16_t filter_offset = 0;
 #endif // SPARSE
 #if INTERMITTENT
-    merge_offset = batch_start(job_index_to_offset(output, run_recovery(model, output)));
+    merge_offset = batch_start(job_index_to_offset(output, run_recovery(ctx, output)));
 #if SPARSE
     unfinished_tile_index = merge_offset / OP_FILTERS;
     filter_offset = merge_offset % OP_FILTERS;
@@ -434,7 +434,7 @@ void handle_gemmmerge(Model *model, const ParameterInfo *input[], ParameterInfo
     uint16_t cols[MAX_N_COL_FC] = {0};
     uint16_t rows[MAX_ROW_LEN_FC] = {0};
     int16_t n_rows = n_tiles + 1;
-    my_memcpy_from_param_row(model, rows, params, 0, (n_rows) * sizeof(int16_t));
+    my_memcpy_from_param_row(ctx, rows, params, 0, (n_rows) * sizeof(int16_t));
     /* entry: the pruned states in each tile_c (n_tiles_c)
      *  1: pruned filters in the tile_c
      *  0: unpruned filters int the tile_c
@@ -444,7 +444,7 @@ void handle_gemmmerge(Model *model, const ParameterInfo *input[], ParameterInfo
         int16_t n_cols_ = rows[idx] - rows[idx - 1];
         if(n_cols_) {
             // set unpruned filter to 1
-            my_memcpy_from_param_col(model, cols, params, rows[idx - 1], (n_cols_) * sizeof(int16_t));
+            my_memcpy_from_param_col(ctx, cols, params, rows[idx - 1], (n_cols_) * sizeof(int16_t));
             for(int16_t offset = 0; offset < n_cols_; ++offset) {
                 int16_t filters_in_tile = cols[offset];
 #if !STABLE_POWER
@@ -471,7 +471,7 @@ void handle_gemmmerge(Model *model, const ParameterInfo *input[], ParameterInfo
         my_fill_q15(0, buffer_gemm, cur_tile_size);
 
         for (uint16_t tile = 0; tile < n_tiles; tile++) {
-            my_memcpy_from_param(model, buffer_temp, input[0], tile * output_len + merge_offset, cur_tile_size * sizeof(int16_t));
+            my_memcpy_from_param(ctx, buffer_temp, input[0], tile * output_len + merge_offset, cur_tile_size * sizeof(int16_t));
 #if SPARSE
             uint16_t tmp_filter_offset = filter_offset;
             uint16_t offset = 0;
@@ -492,21 +492,21 @@ void handle_gemmmerge(Model *model, const ParameterInfo *input[], ParameterInfo
 #endif
             my_add_q15(buffer_gemm, buffer_temp, buffer_gemm, cur_tile_size);
             my_printf_debug("accumulated buffer_gemm" NEWLINE);
-            dump_matrix_debug(buffer_gemm, cur_tile_size, ValueInfo(output, model));
+            dump_matrix_debug(buffer_gemm, cur_tile_size, ValueInfo(output, ctx));
         }
 
         my_printf_debug("buffer_gemm after adjusting states; merge_offset=%d" NEWLINE, merge_offset);
-        dump_matrix_debug(buffer_gemm, cur_tile_size, ValueInfo(output, model));
+        dump_matrix_debug(buffer_gemm, cur_tile_size, ValueInfo(output, ctx));
 
-        my_memcpy_to_param(output, merge_offset, buffer_gemm, cur_tile_size * sizeof(int16_t), 0);
+        my_memcpy_to_param(ctx, output, merge_offset, buffer_gemm, cur_tile_size * sizeof(int16_t), 0);
 #if HAWAII
-        hawaii_record_footprints(model, cur_tile_size);
+        hawaii_record_footprints(ctx, cur_tile_size);
 #endif
     }
 
-    flip_state_bit(model, output);
+    flip_state_bit(ctx, output);
 
     my_printf_debug("handle_gemmerge output" NEWLINE);
-    dump_params_debug(model, output, node->output_name);
+    dump_params_debug(ctx, output, node->output_name);
 #endif // OpGemm
 }
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cstdint>
+#include "cnn_common.h"
+#include "data.h"
+
+struct InferenceContext;
+
+#define CONV_TASK_FLAG_PROCESSED_FILTERS_BASE 2
+typedef struct ConvTaskParams {
+    InferenceContext *ctx;
+    const ParameterInfo *conv_input;
+    const ParameterInfo *real_conv_input; // for separate channel tiling
+    const ParameterInfo *conv_filter;
+    const ParameterInfo *conv_bias;
+    ParameterInfo *output;
+    const NodeFlags* flags;
+
+    /* aux vars remaining constant for a conv layer */
+    uint16_t H;
+    uint16_t W;
+    // OUTPUT_H and OUTPUT_W to handle stride != 1
+    uint16_t OUTPUT_H;
+    uint16_t OUTPUT_W;
+    uint16_t kH;
+    uint16_t kW;
+    uint16_t CHANNEL; // Cannot use C as a variable name here as C is a macro on MSP430 :(
+    uint16_t OUTPUT_CHANNEL;
+    // Distance between output pixels in NHWC, larger than OUTPUT_CHANNEL for outputs placed in that of Concat
+    uint16_t OUTPUT_CHANNEL_STRIDE;
+    uint16_t N_FILTERS;
+    uint16_t stride_h;
+    uint16_t stride_w;
+    // from the tiling selected for this run of the layer
+    uint16_t output_tile_w;
+    uint16_t output_tile_h;
+    uint16_t input_tile_c_offset;
+    uint16_t input_tile_c_index;
+    int16_t tile_h;
+    int16_t tile_w;
+    uint8_t cur_input_tile_c;
+    uint16_t cur_filter_tile_c;
+    uint16_t n_tiles_c;
+    int16_t dest_offset;
+    int16_t filter_offset;
+    // For 1x1 conv
+    int16_t kX;
+    int16_t kY;
+#if SPARSE
+    int16_t row_index; // it can also be used to indicate #channel which are computed now (row_index * input_tile_c)
+    int16_t cur_row_val;
+    int16_t next_row_val;
+    int16_t n_cols; // row[row_index] - row[row_index - 1]
+    int16_t cur_n_cols; // [0, n_cols)
+#endif
+    uint8_t truncated;
+    uint16_t filter_idx;
+    uint16_t filter_tile_index;
+    // (h, w) for left-top corner of each input window
+    int16_t input_h;
+    int16_t input_w;
+    // Output (h, w) of the first pixel in the tile at input_h/input_w, and
+    // output pixels in the tile to skip as they are done before power failures.
+    // They are updated with input_h/input_w, as MSP430 has no hardware divider.
+    uint16_t tile_output_h;
+    uint16_t tile_output_w;
+    int16_t tile_h_offset;
+    int16_t tile_w_offset;
+    int16_t input_h_first, input_h_last;
+    int16_t input_w_first, input_w_last;
+    int16_t *filter_buffer_addr;
+    int16_t cached_filter_idx;
+    int16_t cached_input_h;
+    int16_t cached_input_w;
+    uint16_t cached_input_tile_c_offset;
+    int16_t cached_kX;
+    int16_t cached_kY;
+    // handle_conv moves this pointer and restores it only when the layer finishes
+    int16_t *matrix_mpy_results;
+
+    uint8_t psum_buffer_version;
+    int8_t cur_op;
+} ConvTaskParams;
+
+struct MaxPoolParams {
+    uint16_t output_h;
+    uint16_t output_w;
+    uint16_t start_channel;
+    uint8_t n_channels;
+    uint8_t need_nhwc2nchw;
+    uint16_t new_H;
+    uint16_t new_W;
+    const MaxPoolFlags* flags;
+    const ParameterInfo *data;
+    const ParameterInfo *output;
+    InferenceContext *ctx;
+};
+
+/* VM copies of both shadow copies of a versioned record in NVM, loaded at the
+ * first access after boot and then kept in sync by commit_versioned_data, so
+ * that commits need not read NVM to find the older copy. */
+template<typename T>
+struct VersionedDataCache {
+    T copies[2];
+    uint8_t newer_copy_id;
+    uint8_t loaded;
+};
+
+/* All states of an inference stream kept in VM, i.e., everything lost on a
+ * power failure. A device has exactly one of them, while the host may simulate
+ * several devices in one process, each with its own context and NVM image.
+ * lea_buffer and cpu_buffer are not here as they need to be placed in specific
+ * memory sections on MSP430 (see op_utils.cpp). */
+struct InferenceContext {
+    Model model_vm;
+    VersionedDataCache<Model> model_cache;
+    ParameterInfo intermediate_parameters_info_vm[MODEL_NODES_LEN];
+#if HAWAII
+    Node::Footprint footprints_vm[MODEL_NODES_LEN];
+#if HAWAII_JOURNAL
+    // The newest journal entry and its index, found at the first access after boot
+    JournalEntry journal_newest;
+    uint8_t journal_head;
+    uint8_t journal_loaded;
+#else
+    VersionedDataCache<Node::Footprint> footprint_caches[MODEL_NODES_LEN];
+#endif
+    int16_t non_recorded_jobs;
+    // A VM copy of FootprintIntervals in NVM, loaded at the first recovery after boot
+    FootprintIntervals footprint_intervals;
+    uint8_t footprint_intervals_loaded;
+#endif
+#if INDIRECT_RECOVERY
+    uint8_t after_recovery;
+#endif
+    uint16_t sample_idx;
+    uint8_t dma_counter_enabled;
+#if ENABLE_COUNTERS && !ENABLE_PER_LAYER_COUNTERS
+    // The percentage of jobs last reported by report_progress()
+    uint8_t last_progress;
+#endif
+
+    ConvTaskParams conv_params;
+    MaxPoolParams maxpool_params;
+
+#ifdef POSIX_BUILD
+    uint8_t *nvm;
+#endif
+};
+
+#ifdef POSIX_BUILD
+/* Each thread simulates at most one device at a time. Contexts are passed
+ * explicitly elsewhere, and this is only for callbacks from DSPLib/CMSIS-DSP
+ * and DSP wrappers, which have no way to take a context. */
+extern thread_local InferenceContext* cur_context;
+
+static inline InferenceContext* get_context(void) {
+    return cur_context;
+}
+
+static inline void set_context(InferenceContext* ctx) {
+    cur_context = ctx;
+}
+#else
+// The only instance on a device, so that accesses are resolved at link time
+extern InferenceContext inference_context;
+
+static inline InferenceContext* get_context(void) {
+    return &inference_context;
+}
+
+static inline void set_context(InferenceContext*) {}
+#endif
+
+// Initialize a context as if the device just booted
+void init_context(InferenceContext* ctx);
@@ -10,10 +10,9 @@
 #include "my_dsplib.h"
 #include "op_utils.h"
 #include "platform.h"
+#include "inference_context.h"
 
-uint16_t sample_idx;
-
-static void handle_node(Model *model, uint16_t node_idx) {
+static void handle_node(InferenceContext *ctx, uint16_t node_idx) {
     const Node *cur_node = get_node(node_idx);
 #if MY_DEBUG >= MY_DEBUG_LAYERS
     my_printf("Current node: %d, ", node_idx);
@@ -26,7 +25,7 @@ static void handle_node(Model *model, uint16_t node_idx) {
     for (uint16_t j = 0; j < cur_node->inputs_len; j++) {
         input_id[j] = cur_node->inputs[j];
         my_printf_debug("input_id[%d] = %d" NEWLINE, j, input_id[j]);
-        input[j] = get_parameter_info(input_id[j]);
+        input[j] = get_parameter_info(ctx, input_id[j]);
         // dump_params(model, input[j], cur_node->name);
     }
 #if SPARSE
@@ -35,7 +34,7 @@ static void handle_node(Model *model, uint16_t node_idx) {
     if(cur_node->op_type == OpGemmMerge) {
         // cur node is ConvMerge or GemmMerge
         input_id[1] = get_node(node_idx - 1)->inputs[1];
-        input[1] = get_parameter_info(input_id[1]);
+        input[1] = get_parameter_info(ctx, input_id[1]);
     }
 #endif // OpGemmMerge
 #endif
@@ -43,33 +42,40 @@ static void handle_node(Model *model, uint16_t node_idx) {
 
     /* Allocate an ParameterInfo for output. Details are filled by
      * individual operation handlers */
-    ParameterInfo *output = get_intermediate_parameter_info(node_idx);
+    ParameterInfo *output = get_intermediate_parameter_info(ctx, node_idx);
     my_memcpy(output, input[0], sizeof(ParameterInfo) - sizeof(uint16_t)); // don't overwrite parameter_info_idx
-    output->params_offset = 0;
-    allocators[cur_node->op_type](model, input, output, cur_node);
+    allocators[cur_node->op_type](ctx, input, output, cur_node);
     my_printf_debug("Needed mem = %u" NEWLINE, output->params_len);
     MY_ASSERT(output->params_len < INTERMEDIATE_VALUES_SIZE);
-    if (output->slot == SLOT_INTERMEDIATE_VALUES) {
+    if (output->slot < NUM_SLOTS) {
+        // Outputs of in-place operations share placements with inputs (see transform.py)
+        const IntermediateValuesPlacement* placement = &intermediate_values_placements[node_idx];
+        // Checked in release builds too, as overflows silently corrupt other live intermediate values
+        MY_ASSERT_ALWAYS(output->params_len <= placement->len,
+                         "Output of node %d needs %" PRIu32 " bytes, more than %" PRIu32 " bytes planned by transform.py" NEWLINE,
+                         node_idx, output->params_len, placement->len);
+        MY_ASSERT_ALWAYS(placement->offset + placement->len <= INTERMEDIATE_VALUES_ARENA_SIZE);
+        output->params_offset = placement->offset;
         my_printf_debug("New params_offset = %d" NEWLINE, output->params_offset);
     }
 
 #if STATEFUL
-    my_printf_debug("Old output state bit=%d" NEWLINE, get_state_bit(model, output->slot));
+    my_printf_debug("Old output state bit=%d" NEWLINE, get_state_bit(ctx, output->slot));
 #endif
-    handlers[cur_node->op_type](model, input, output, cur_node);
+    handlers[cur_node->op_type](ctx, input, output, cur_node);
     // For some operations (e.g., ConvMerge), scale is determined in the handlers
     my_printf_debug("Ouput scale = %f" NEWLINE, output->scale.toFloat());
 #if STATEFUL
-    my_printf_debug("New output state bit=%d" NEWLINE, get_state_bit(model, output->slot));
+    my_printf_debug("New output state bit=%d" NEWLINE, get_state_bit(ctx, output->slot));
 #endif
 
     MY_ASSERT(output->bitwidth);
 
-    commit_intermediate_parameter_info(node_idx);
+    commit_intermediate_parameter_info(ctx, node_idx);
 
     if (node_idx == MODEL_NODES_LEN - 1) {
-        model->running = 0;
-        model->run_counter++;
+        ctx->model_vm.running = 0;
+        ctx->model_vm.run_counter++;
 #if ENABLE_COUNTERS
         if (!total_jobs) {
             total_jobs = counters()->job_preservation / 2;
@@ -82,26 +88,26 @@ static void handle_node(Model *model, uint16_t node_idx) {
 const float first_sample_outputs[] = FIRST_SAMPLE_OUTPUTS;
 #endif
 
-static void run_model(int8_t *ansptr, const ParameterInfo **output_node_ptr) {
+static void run_model(InferenceContext* ctx, int8_t *ansptr, const ParameterInfo **output_node_ptr) {
     my_printf_debug("N_INPUT = %d" NEWLINE, N_INPUT);
 
-    Model *model = get_model();
+    Model *model = get_model(ctx);
     if (!model->running) {
         // reset model
         model->layer_idx = 0;
         for (uint8_t idx = 0; idx < NUM_SLOTS; idx++) {
-            SlotInfo *cur_slot_info = get_slot_info(model, idx);
+            SlotInfo *cur_slot_info = get_slot_info(ctx, idx);
             cur_slot_info->user = -1;
         }
 #if HAWAII
         for (uint16_t node_idx = 0; node_idx < MODEL_NODES_LEN; node_idx++) {
-            reset_hawaii_layer_footprint(node_idx);
+            reset_hawaii_layer_footprint(ctx, node_idx);
         }
 #endif
         model->running = 1;
-        commit_model();
+        commit_model(ctx);
 #if ENABLE_COUNTERS
-        memset(counters_data, 0, sizeof(Counters) * COUNTERS_LEN);
+        reset_counters(ctx);
 #endif
     }
 
@@ -109,24 +115,27 @@ static void run_model(int8_t *ansptr, const ParameterInfo **output_node_ptr) {
     counters()->power_counters++;
 #endif
 
-    dump_model_debug(model);
+    dump_model_debug(ctx);
 
     for (uint16_t node_idx = model->layer_idx; node_idx < MODEL_NODES_LEN; node_idx++) {
-        handle_node(model, node_idx);
+        handle_node(ctx, node_idx);
+#if HAWAII
+        finish_hawaii_footprint_interval(ctx, node_idx);
+#endif
         model->layer_idx++;
 
-        commit_model();
+        commit_model(ctx);
 
 #if 0
-        notify_layer_finished();
+        notify_layer_finished(ctx);
 #endif
 
-        dump_model_debug(model);
+        dump_model_debug(ctx);
     }
 
     // the parameter info for the last node should also be refreshed when MY_DEBUG == 0
     // Otherwise, the model is not correctly re-initialized in some cases
-    const ParameterInfo *output_node = get_parameter_info(MODEL_NODES_LEN + N_INPUT - 1);
+    const ParameterInfo *output_node = get_parameter_info(ctx, MODEL_NODES_LEN + N_INPUT - 1);
     if (output_node_ptr) {
         *output_node_ptr = output_node;
     }
@@ -137,9 +146,9 @@ static void run_model(int8_t *ansptr, const ParameterInfo **output_node_ptr) {
     uint8_t buffer_len = MIN_VAL(output_node->dims[1], ans_len);
     if(!output_node->dims[1])
         buffer_len = MIN_VAL(output_node->dims[0], ans_len);
-    my_memcpy_from_param(model, lea_buffer, output_node, 0, buffer_len * sizeof(int16_t));
+    my_memcpy_from_param(ctx, lea_buffer, output_node, 0, buffer_len * sizeof(int16_t));
 
-    if (sample_idx == 0) {
+    if (ctx->sample_idx == 0) {
         for (uint8_t buffer_idx = 0, ofm_idx = 0; buffer_idx < buffer_len; buffer_idx++) {
             // int16_t got_q15 = lea_buffer[buffer_idx];
             {
@@ -180,10 +189,9 @@ static uint32_t print_counters() {
 #endif
 
 #if (MY_DEBUG >= MY_DEBUG_NORMAL) || (ENABLE_COUNTERS && !DEMO)
-static void print_results(const ParameterInfo *output_node) {
-    Model *model = get_model();
+static void print_results(InferenceContext *ctx, const ParameterInfo *output_node) {
 
-    dump_params(model, output_node);
+    dump_params(ctx, output_node);
 
     my_printf("op types:            ");
     for (uint16_t i = 0; i < MODEL_NODES_LEN; i++) {
@@ -208,50 +216,47 @@ static void print_results(const ParameterInfo *output_node) {
     my_printf(NEWLINE "Job preservation:    "); print_counters<&Counters::job_preservation>();
     my_printf(NEWLINE "FP preservation:     "); print_counters<&Counters::footprint_preservation>();
     my_printf(NEWLINE "MACs:                "); print_counters<&Counters::macs>();
+    my_printf(NEWLINE "Divisions:           "); print_counters<&Counters::divisions>();
     // recovery overheads
     my_printf(NEWLINE "Progress seeking:    "); total_overhead += print_counters<&Counters::progress_seeking>();
 
     my_printf(NEWLINE "Total DMA bytes: %d", total_dma_bytes);
     my_printf(NEWLINE "Total overhead: %" PRIu32, total_overhead);
-    my_printf(NEWLINE "run_counter: %d" NEWLINE, model->run_counter);
+    my_printf(NEWLINE "run_counter: %d" NEWLINE, get_model(ctx)->run_counter);
 #endif
 
     my_printf("NVM writes: %ld" NEWLINE, get_nvm_writes());
 }
 #endif
 
-uint8_t run_cnn_tests(uint16_t n_samples) {
+void run_cnn_test_samples(InferenceContext* ctx, uint16_t end_sample, TestProgress* progress, const ParameterInfo** output_node) {
     int8_t predicted = -1;
-    const ParameterInfo *output_node;
-#if (MY_DEBUG >= MY_DEBUG_NORMAL) || ENABLE_COUNTERS
-    int8_t label = -1;
-    uint32_t correct = 0, total = 0;
-    if (!n_samples) {
-        n_samples = PLAT_LABELS_DATA_LEN;
-    }
+    set_context(ctx);
     const uint8_t *labels = labels_data;
-#endif
-    for (uint16_t i = 0; i < n_samples; i++) {
-        sample_idx = i;
-        run_model(&predicted, &output_node);
-#if (MY_DEBUG >= MY_DEBUG_NORMAL) || ENABLE_COUNTERS
-        label = labels[i];
-        total++;
+    for (uint16_t i = progress->next_sample; i < end_sample; i++) {
+        ctx->sample_idx = i;
+        run_model(ctx, &predicted, output_node);
+        progress->next_sample = i + 1;
+        // Counted in all builds, as results with and without power failures are compared on Linux
+        int8_t label = labels[i];
+        progress->total++;
         if (label == predicted) {
-            correct++;
+            progress->correct++;
         }
+#if (MY_DEBUG >= MY_DEBUG_NORMAL) || ENABLE_COUNTERS
         if (i % 100 == 99) {
-            my_printf("Sample %d finished" NEWLINE, sample_idx);
+            my_printf("Sample %d finished" NEWLINE, ctx->sample_idx);
             // stdout is not flushed at \n if it is not a terminal
             my_flush();
         }
         my_printf_debug("idx=%d label=%d predicted=%d correct=%d" NEWLINE, i, label, predicted, label == predicted);
 #endif
     }
+}
+
+uint8_t report_test_results(const TestProgress* progress) {
 #if (MY_DEBUG >= MY_DEBUG_NORMAL) || (ENABLE_COUNTERS && !DEMO)
-    if (n_samples == 1) {
-        print_results(output_node);
-    }
+    uint32_t correct = progress->correct, total = progress->total;
     my_printf("correct=%" PRId32 " ", correct);
     my_printf("total=%" PRId32 " ", total);
     my_printf("rate=%f" NEWLINE, 1.0*correct/total);
@@ -264,14 +269,35 @@ uint8_t run_cnn_tests(uint16_t n_samples) {
     return 0;
 }
 
+uint8_t run_cnn_tests(InferenceContext* ctx, uint16_t n_samples, TestProgress* progress) {
+    // may stay nullptr if all samples are finished before a simulated power failure
+    const ParameterInfo *output_node = nullptr;
+    TestProgress local_progress = { 0, 0, 0 };
+    if (!progress) {
+        progress = &local_progress;
+    }
+#if (MY_DEBUG >= MY_DEBUG_NORMAL) || ENABLE_COUNTERS
+    if (!n_samples) {
+        n_samples = PLAT_LABELS_DATA_LEN;
+    }
+#endif
+    run_cnn_test_samples(ctx, n_samples, progress, &output_node);
+#if (MY_DEBUG >= MY_DEBUG_NORMAL) || (ENABLE_COUNTERS && !DEMO)
+    if (n_samples == 1 && output_node) {
+        print_results(ctx, output_node);
+    }
+#endif
+    return report_test_results(progress);
+}
+
 
 #if INDIRECT_RECOVERY
-static void check_feature_map_states(Model *model, const ParameterInfo* output, uint32_t first_unfinished_job_index, uint32_t len, const char* func) {
+static void check_feature_map_states(InferenceContext *ctx, const ParameterInfo* output, uint32_t first_unfinished_job_index, uint32_t len, const char* func) {
 #if MY_DEBUG >= MY_DEBUG_NORMAL
     my_printf_debug("Running check_feature_map_states..." NEWLINE);
 #if 0
     for (uint32_t idx = 0; idx < len; idx++) {
-        my_printf_debug("% 6d ", get_q15_param(model, output, idx));
+        my_printf_debug("% 6d ", get_q15_param(ctx, output, idx));
         if (idx % 16 == 15) {
             my_printf_debug(NEWLINE);
         }
@@ -282,8 +308,8 @@ static void check_feature_map_states(Model *model, const ParameterInfo* output,
         if (offset >= len) {
             break;
         }
-        int16_t val = get_q15_param(model, output, offset);
-        int8_t cur_state_bit = param_state_bit(model, output, offset);
+        int16_t val = get_q15_param(ctx, output, offset);
+        int8_t cur_state_bit = param_state_bit(ctx, output, offset);
         if (idx < first_unfinished_job_index) {
             cur_state_bit = -cur_state_bit;
         }
@@ -295,24 +321,24 @@ static void check_feature_map_states(Model *model, const ParameterInfo* output,
 #endif
 
 #if STATEFUL
-static uint8_t value_finished(Model* model, const ParameterInfo* output, uint32_t job_index) {
+static uint8_t value_finished(InferenceContext *ctx, const ParameterInfo* output, uint32_t job_index) {
     uint32_t offset = job_index_to_offset(output, job_index);
-    int16_t val = get_q15_param(model, output, offset);
-    uint8_t ret = (get_value_state_bit(val) != param_state_bit(model, output, offset));
+    int16_t val = get_q15_param(ctx, output, offset);
+    uint8_t ret = (get_value_state_bit(val) != param_state_bit(ctx, output, offset));
     my_printf_debug("Value %d at job index %d (offset %" PRIu32 ") indicates %s" NEWLINE, val, job_index, offset, ret ? "finished" : "unfinished");
     return ret;
 }
 
 #endif
 
-void flip_state_bit(Model *model, const ParameterInfo *output) {
+void flip_state_bit(InferenceContext *ctx, const ParameterInfo *output) {
 #if INDIRECT_RECOVERY
     start_cpu_counter();
 
 #if JAPARI
     MY_ASSERT(has_footprints(output));
 #endif
-    SlotInfo *cur_slot_info = get_slot_info(model, output->slot);
+    SlotInfo *cur_slot_info = get_slot_info(ctx, output->slot);
     // XXX: better way than copying the array?
 #if JAPARI
     // abandon output features smaller than a batch
@@ -347,12 +373,12 @@ void flip_state_bit(Model *model, const ParameterInfo *output) {
         cur_slot_info->turning_points[cur_slot_info->n_turning_points - 1] = new_turning_point;
     }
 
-    dump_turning_points_debug(model, output);
+    dump_turning_points_debug(ctx, output);
 
     cur_slot_info->state_bit = -cur_slot_info->state_bit;
 
     // Use first_unfinished_job_index = 0 here as all values finished and the initial state bit is flipped above
-    check_feature_map_states(model, output, 0, output->params_len / sizeof(int16_t), __func__);
+    check_feature_map_states(ctx, output, 0, output->params_len / sizeof(int16_t), __func__);
 
     stop_cpu_counter(&Counters::table_updates);
 #endif // INDIRECT_RECOVERY
@@ -360,19 +386,19 @@ void flip_state_bit(Model *model, const ParameterInfo *output) {
 
 #if INDIRECT_RECOVERY
 
-int8_t get_state_bit(Model *model, uint8_t slot_id) {
+int8_t get_state_bit(InferenceContext *ctx, uint8_t slot_id) {
     switch (slot_id) {
         case SLOT_PARAMETERS:
         case SLOT_TEST_SET:
             return 0;
         default:
-            return get_slot_info(model, slot_id)->state_bit;
+            return get_slot_info(ctx, slot_id)->state_bit;
     }
 }
 
-int8_t param_state_bit(Model *model, const ParameterInfo *param, uint16_t offset) {
-    int8_t ret = get_state_bit(model, param->slot);
-    SlotInfo *cur_slot_info = get_slot_info(model, param->slot);
+int8_t param_state_bit(InferenceContext *ctx, const ParameterInfo *param, uint16_t offset) {
+    int8_t ret = get_state_bit(ctx, param->slot);
+    SlotInfo *cur_slot_info = get_slot_info(ctx, param->slot);
     if (!cur_slot_info) {
         return 0;
     }
@@ -389,17 +415,18 @@ int8_t param_state_bit(Model *model, const ParameterInfo *param, uint16_t offset
 #endif
 
 #if HAWAII
-uint32_t run_recovery(Model* model, ParameterInfo*) {
-    uint32_t footprint = read_hawaii_layer_footprint(model->layer_idx);
+uint32_t run_recovery(InferenceContext *ctx, ParameterInfo*) {
+    uint32_t footprint = read_hawaii_layer_footprint(ctx, ctx->model_vm.layer_idx);
+    adapt_hawaii_footprint_interval(ctx, ctx->model_vm.layer_idx);
     return footprint / BATCH_SIZE;
 }
 #endif
 
 #if JAPARI
-static uint8_t value_finished(Model* model, const ParameterInfo* output, uint32_t job_index) {
+static uint8_t value_finished(InferenceContext *ctx, const ParameterInfo* output, uint32_t job_index) {
     uint32_t offset = job_index_to_offset(output, job_index);
-    int16_t val = get_q15_param(model, output, offset);
-    int16_t expected_footprint = -param_state_bit(model, output, offset);
+    int16_t val = get_q15_param(ctx, output, offset);
+    int16_t expected_footprint = -param_state_bit(ctx, output, offset);
     check_footprint(val);
     uint8_t ret = (val == expected_footprint);
     my_printf_debug("Footprint %d (expected %d) at job index %d (offset %" PRIu32 ") indicates %s" NEWLINE, val, expected_footprint, job_index, offset, ret ? "finished" : "unfinished");
@@ -408,11 +435,11 @@ static uint8_t value_finished(Model* model, const ParameterInfo* output, uint32_
 #endif
 
 #if SPARSE
-uint16_t find_row_index(Model *model, const ParameterInfo *filter_params, const ParameterInfo *output, const Node *node, uint16_t col_index, int16_t *cur_row_val) {
+uint16_t find_row_index(InferenceContext *ctx, const ParameterInfo *filter_params, const ParameterInfo *output, const Node *node, uint16_t col_index, int16_t *cur_row_val) {
     uint16_t n_tiles = 0;
 #ifdef OpConv
     if(node->op_type == OpConv) {
-        n_tiles = filter_params->dims[1] * filter_params->dims[2] * filter_params->dims[3] / node->flags.extra.conv.input_tile_c;
+        n_tiles = counted_div(filter_params->dims[1] * filter_params->dims[2] * filter_params->dims[3], node->flags.extra.conv.input_tile_c);
     }
 #endif
 #ifdef OpGemm
@@ -427,7 +454,7 @@ uint16_t find_row_index(Model *model, const ParameterInfo *filter_params, const
     my_printf_debug("col index: %d" NEWLINE, col_index);
     while(l < r) {
         uint16_t m = l + ((r - l) >> 1);
-        tmp_row_val = get_row_val(model, filter_params, m);
+        tmp_row_val = get_row_val(ctx, filter_params, m);
         my_printf_debug("tmp_row_val: %d" NEWLINE, tmp_row_val);
         if(tmp_row_val > col_index) {
             r = m;
@@ -442,16 +469,16 @@ uint16_t find_row_index(Model *model, const ParameterInfo *filter_params, const
 }
 
 // XXX: support FC x hawaii only
-uint32_t job_index_to_offset_sparse(Model *model, const ParameterInfo *params_filter, const ParameterInfo* output, uint16_t job_index) {
+uint32_t job_index_to_offset_sparse(InferenceContext *ctx, const ParameterInfo *params_filter, const ParameterInfo* output, uint16_t job_index) {
     // Handle FC recovery via binary search
     const Node* node = get_node(output);
     uint16_t output_len = output->dims[0] * output->dims[1]; // 256
     uint16_t output_jobs = output_len / BATCH_SIZE; // 256
     uint16_t jobs_in_an_op = OP_FILTERS / BATCH_SIZE; // 2
     uint16_t cur_col_index = job_index / jobs_in_an_op; // 165
-    uint16_t col_val = get_col_val(model, params_filter, cur_col_index); // [0 "2"] // 107
+    uint16_t col_val = get_col_val(ctx, params_filter, cur_col_index); // [0 "2"] // 107
     int16_t cur_row_val = 0; // 143
-    uint16_t row_index = find_row_index(model, params_filter, output, node, cur_col_index, &cur_row_val); // 15
+    uint16_t row_index = find_row_index(ctx, params_filter, output, node, cur_col_index, &cur_row_val); // 15
     uint16_t filter_tile_c = col_val; // 107
     uint16_t fixed_jobs_index_in_tile_c = row_index * output_jobs + filter_tile_c * (OP_FILTERS / BATCH_SIZE) + (job_index % jobs_in_an_op);
     my_printf_debug("fixed_jobs_index_in_tile_c: %d\n", fixed_jobs_index_in_tile_c);
@@ -525,20 +552,22 @@ uint32_t job_index_to_offset(const ParameterInfo* output, uint16_t job_index) {
 #endif
     /* END constants */
 
-    uint8_t input_tile_c_index = job_index / input_tile_jobs;
-    job_index = job_index % input_tile_jobs;
-    uint16_t channel_offset = job_index / jobs_in_a_filter_tile * output_tile_c;
-    job_index %= jobs_in_a_filter_tile;
+    // There are few input or filter tiles, while ops in a filter tile are many
+    uint32_t remaining_jobs = job_index;
+    uint8_t input_tile_c_index = divmod_small(&remaining_jobs, input_tile_jobs);
+    uint16_t channel_offset = divmod_small(&remaining_jobs, jobs_in_a_filter_tile) * output_tile_c;
+    job_index = remaining_jobs;
     uint32_t offset = input_tile_c_index * input_tile_len +
                       channel_offset;
 
     if (jobs_in_an_op) {
         // an op contains at least a batch
-        offset += OUTPUT_CHANNEL * (job_index / jobs_in_an_op);
+        uint16_t op_index = counted_div(job_index, jobs_in_an_op);
+        offset += OUTPUT_CHANNEL * op_index;
 #if !JAPARI
-        offset += (job_index % jobs_in_an_op + 1) * BATCH_SIZE - 1;
+        offset += (job_index - op_index * jobs_in_an_op + 1) * BATCH_SIZE - 1;
 #else
-        offset += (job_index % jobs_in_an_op + 1) * (BATCH_SIZE + 1) - 1;
+        offset += (job_index - op_index * jobs_in_an_op + 1) * (BATCH_SIZE + 1) - 1;
 #endif
     } else {
         // TODO
@@ -558,9 +587,8 @@ uint32_t batch_start(uint32_t batch_end_offset) {
 
 #if INDIRECT_RECOVERY
 
-static uint8_t after_recovery = 1;
-
-uint32_t run_recovery(Model *model, ParameterInfo *output) {
+uint32_t run_recovery(InferenceContext *ctx, ParameterInfo *output) {
+    uint8_t& after_recovery = ctx->after_recovery;
     if (!after_recovery) {
         return 0;
     }
@@ -577,14 +605,14 @@ uint32_t run_recovery(Model *model, ParameterInfo *output) {
     uint32_t cur_end_job_index = end_job_index;
     uint32_t first_unfinished_job_index = 0;
 
-    my_printf_debug("new_output_state_bit for first value = %d" NEWLINE, -param_state_bit(model, output, 0));
-    dump_turning_points_debug(model, output);
+    my_printf_debug("new_output_state_bit for first value = %d" NEWLINE, -param_state_bit(ctx, output, 0));
+    dump_turning_points_debug(ctx, output);
 
     while (1) {
         if (cur_end_job_index - cur_begin_job_index <= 1) {
-            if (!value_finished(model, output, cur_begin_job_index)) {
+            if (!value_finished(ctx, output, cur_begin_job_index)) {
                 first_unfinished_job_index = 0;
-            } else if (!value_finished(model, output, cur_end_job_index)) {
+            } else if (!value_finished(ctx, output, cur_end_job_index)) {
                 first_unfinished_job_index = cur_end_job_index;
             } else if (cur_end_job_index == end_job_index) {
                 // all values finished - power failure just before the state
@@ -596,7 +624,7 @@ uint32_t run_recovery(Model *model, ParameterInfo *output) {
             break;
         }
         uint32_t middle_job_index = cur_begin_job_index + (cur_end_job_index - cur_begin_job_index) / 2;
-        if (value_finished(model, output, middle_job_index)) {
+        if (value_finished(ctx, output, middle_job_index)) {
             cur_begin_job_index = middle_job_index;
         } else {
             cur_end_job_index = middle_job_index;
@@ -615,7 +643,7 @@ uint32_t run_recovery(Model *model, ParameterInfo *output) {
         after_recovery = 0;
     }
 
-    check_feature_map_states(model, output, first_unfinished_job_index, output->params_len / 2, __func__);
+    check_feature_map_states(ctx, output, first_unfinished_job_index, output->params_len / 2, __func__);
 
     stop_cpu_counter(&Counters::progress_seeking);
 
@@ -5,20 +5,30 @@
 #include "data.h"
 #include "my_debug.h"
 
-extern uint16_t sample_idx;
-
 struct ParameterInfo;
-struct Model;
-uint8_t run_cnn_tests(uint16_t n_samples);
+struct InferenceContext;
+
+// Test progress outside of the device, which survives simulated power failures
+struct TestProgress {
+    uint16_t next_sample;
+    uint32_t correct;
+    uint32_t total;
+};
+
+uint8_t run_cnn_tests(InferenceContext* ctx, uint16_t n_samples, TestProgress* progress = nullptr);
+// Run samples from progress->next_sample to end_sample - 1, updating progress without printing results
+void run_cnn_test_samples(InferenceContext* ctx, uint16_t end_sample, TestProgress* progress, const ParameterInfo** output_node = nullptr);
+// Print the accuracy, and return non-zero if it drops too much
+uint8_t report_test_results(const TestProgress* progress);
 
 uint32_t job_index_to_offset(const ParameterInfo* output, uint16_t job_index);
 uint32_t batch_start(uint32_t batch_end_offset);
 #if SPARSE
-uint16_t find_row_index(Model *model, const ParameterInfo *filter_params, const ParameterInfo *output, const Node *node, uint16_t col_index, int16_t *cur_row_val);
-uint32_t job_index_to_offset_sparse(Model *model, const ParameterInfo *params_filter, const ParameterInfo* output, uint16_t job_index);
+uint16_t find_row_index(InferenceContext *ctx, const ParameterInfo *filter_params, const ParameterInfo *output, const Node *node, uint16_t col_index, int16_t *cur_row_val);
+uint32_t job_index_to_offset_sparse(InferenceContext *ctx, const ParameterInfo *params_filter, const ParameterInfo* output, uint16_t job_index);
 #endif
 
-int8_t get_state_bit(Model *model, uint8_t slot_id);
+int8_t get_state_bit(InferenceContext *ctx, uint8_t slot_id);
 
 #if HAWAII || STATEFUL
 static inline bool offset_has_state(uint16_t offset) {
@@ -60,7 +70,7 @@ static inline int8_t get_value_state_bit(int16_t val) {
     return (val >= 0) ? 1 : -1;
 }
 #endif
-int8_t param_state_bit(Model *model, const ParameterInfo *param, uint16_t offset);
+int8_t param_state_bit(InferenceContext *ctx, const ParameterInfo *param, uint16_t offset);
 
-uint32_t run_recovery(Model *model, ParameterInfo *output);
-void flip_state_bit(Model *model, const ParameterInfo *output);
+uint32_t run_recovery(InferenceContext *ctx, ParameterInfo *output);
+void flip_state_bit(InferenceContext *ctx, const ParameterInfo *output);
@@ -24,7 +24,7 @@ std::unique_ptr<ModelOutput> model_output_data;
 
 #define PRINT_NEWLINE_IF_DATA_NOT_SAVED if (!layer_out) { my_printf(NEWLINE); }
 
-ValueInfo::ValueInfo(const ParameterInfo *cur_param, Model *model) {
+ValueInfo::ValueInfo(const ParameterInfo *cur_param, InferenceContext *ctx) {
     this->scale = cur_param->scale.toFloat();
 }
 
@@ -43,9 +43,9 @@ static void print_q15(LayerOutput* layer_out, int16_t val, const ValueInfo& val_
     }
 }
 
-void dump_value(Model *model, const ParameterInfo *cur_param, LayerOutput* layer_out, size_t offset, bool has_state) {
+void dump_value(InferenceContext *ctx, const ParameterInfo *cur_param, LayerOutput* layer_out, size_t offset, bool has_state) {
     if (cur_param->bitwidth == 16) {
-        print_q15(layer_out, get_q15_param(model, cur_param, offset), ValueInfo(cur_param, model), has_state);
+        print_q15(layer_out, get_q15_param(ctx, cur_param, offset), ValueInfo(cur_param, ctx), has_state);
     } else if (cur_param->bitwidth == 64) {
         my_printf("%" PRId64 " ", get_int64_param(cur_param, offset));
     } else {
@@ -64,13 +64,13 @@ void dump_matrix(const int16_t *mat, size_t len, const ValueInfo& val_info, bool
     my_printf(NEWLINE);
 }
 
-static void dump_params_common(Model* model, const ParameterInfo* cur_param, const char* layer_name, LayerOutput** p_layer_out) {
+static void dump_params_common(InferenceContext *ctx, const ParameterInfo* cur_param, const char* layer_name, LayerOutput** p_layer_out) {
     my_printf("Slot: %d" NEWLINE, cur_param->slot);
     my_printf("Scale: %f" NEWLINE, cur_param->scale.toFloat());
     my_printf("Params len: %" PRId32 NEWLINE, cur_param->params_len);
 #if INDIRECT_RECOVERY
     if (cur_param->slot < NUM_SLOTS) {
-        my_printf("State: %d" NEWLINE, get_slot_info(model, cur_param->slot)->state_bit);
+        my_printf("State: %d" NEWLINE, get_slot_info(ctx, cur_param->slot)->state_bit);
     }
 #endif
     my_printf("Dims: ");
@@ -132,12 +132,12 @@ static void extract_dimensions(const ParameterInfo* cur_param, uint16_t* NUM, ui
     }
 }
 
-void dump_params_nhwc(Model *model, const ParameterInfo *cur_param, const char* layer_name) {
-    dma_counter_enabled = 0;
+void dump_params_nhwc(InferenceContext *ctx, const ParameterInfo *cur_param, const char* layer_name) {
+    ctx->dma_counter_enabled = 0;
     uint16_t NUM, H, W, CHANNEL;
     extract_dimensions(cur_param, &NUM, &H, &W, &CHANNEL);
     LayerOutput* layer_out = nullptr;
-    dump_params_common(model, cur_param, layer_name, &layer_out);
+    dump_params_common(ctx, cur_param, layer_name, &layer_out);
     int16_t output_tile_c = cur_param->dims[1];
     for (uint16_t n = 0; n < NUM; n++) {
         my_printf("Matrix %d" NEWLINE, n);
@@ -151,7 +151,7 @@ void dump_params_nhwc(Model *model, const ParameterInfo *cur_param, const char*
                     for (uint16_t w = 0; w < W; w++) {
                         // internal format is NHWC
                         size_t offset2 = n * H * W * CHANNEL + H * W * tile_c_base + h * W * cur_tile_c + w * cur_tile_c + c;
-                        dump_value(model, cur_param, layer_out, offset2, offset_has_state(offset2));
+                        dump_value(ctx, cur_param, layer_out, offset2, offset_has_state(offset2));
                     }
                     PRINT_NEWLINE_IF_DATA_NOT_SAVED
                 }
@@ -160,14 +160,14 @@ void dump_params_nhwc(Model *model, const ParameterInfo *cur_param, const char*
         }
         PRINT_NEWLINE_IF_DATA_NOT_SAVED
     }
-    dma_counter_enabled = 1;
+    ctx->dma_counter_enabled = 1;
 }
 
-void dump_model(Model *model) {
+void dump_model(InferenceContext *ctx) {
     uint16_t i, j;
     for (i = 0; i < MODEL_NODES_LEN; i++) {
         const Node *cur_node = get_node(i);
-        if (model->layer_idx > i) {
+        if (ctx->model_vm.layer_idx > i) {
             my_printf("scheduled     ");
         } else {
             my_printf("not scheduled ");
@@ -184,12 +184,12 @@ void dump_model(Model *model) {
 }
 
 // dump in NCHW format
-void dump_params(Model *model, const ParameterInfo *cur_param, const char* layer_name) {
-    dma_counter_enabled = 0;
+void dump_params(InferenceContext *ctx, const ParameterInfo *cur_param, const char* layer_name) {
+    ctx->dma_counter_enabled = 0;
     uint16_t NUM, H, W, CHANNEL;
     extract_dimensions(cur_param, &NUM, &H, &W, &CHANNEL);
     LayerOutput* layer_out = nullptr;
-    dump_params_common(model, cur_param, layer_name, &layer_out);
+    dump_params_common(ctx, cur_param, layer_name, &layer_out);
     for (uint16_t i = 0; i < NUM; i++) {
         my_printf("Matrix %d" NEWLINE, i);
         for (uint16_t j = 0; j < CHANNEL; j++) {
@@ -200,7 +200,7 @@ void dump_params(Model *model, const ParameterInfo *cur_param, const char* layer
                 for (uint16_t l = 0; l < W; l++) {
                     // internal format is NCHW
                     size_t offset = i * H * W * CHANNEL + j * H * W + k * W + l;
-                    dump_value(model, cur_param, layer_out, offset, offset_has_state(offset));
+                    dump_value(ctx, cur_param, layer_out, offset, offset_has_state(offset));
                 }
                 PRINT_NEWLINE_IF_DATA_NOT_SAVED
             }
@@ -208,12 +208,12 @@ void dump_params(Model *model, const ParameterInfo *cur_param, const char* layer
         }
         PRINT_NEWLINE_IF_DATA_NOT_SAVED
     }
-    dma_counter_enabled = 1;
+    ctx->dma_counter_enabled = 1;
 }
 
-void dump_turning_points(Model *model, const ParameterInfo *output) {
+void dump_turning_points(InferenceContext *ctx, const ParameterInfo *output) {
 #if INDIRECT_RECOVERY
-    SlotInfo *cur_slot_info = get_slot_info(model, output->slot);
+    SlotInfo *cur_slot_info = get_slot_info(ctx, output->slot);
     if (!cur_slot_info) {
         my_printf("%d is not a normal slot" NEWLINE, output->slot);
         return;
@@ -255,9 +255,9 @@ void dump_matrix(const int16_t *mat, size_t rows, size_t cols, const ValueInfo&
 }
 
 static const uint16_t BUFFER_TEMP_SIZE = 256;
-static int16_t buffer_temp[BUFFER_TEMP_SIZE];
+static PER_DEVICE int16_t buffer_temp[BUFFER_TEMP_SIZE];
 #if STABLE_POWER
-void compare_vm_vm_impl(int16_t* vm_data, Model* model, const ParameterInfo* output, uint16_t output_offset, uint16_t blockSize) {
+void compare_vm_vm_impl(int16_t* vm_data, InferenceContext *ctx, const ParameterInfo* output, uint16_t output_offset, uint16_t blockSize) {
     check_buffer_address(vm_data, blockSize);
     MY_ASSERT(blockSize <= BUFFER_TEMP_SIZE);
     // FIXME: The original cpu_buffer data have been accumulated with vm_data. Therefore, the assert will not pass!
@@ -273,12 +273,12 @@ void compare_vm_vm_impl(int16_t* vm_data, Model* model, const ParameterInfo* out
 }
 #endif
 
-void compare_vm_nvm_impl(int16_t* vm_data, Model* model, const ParameterInfo* output, uint16_t output_offset, uint16_t blockSize) {
+void compare_vm_nvm_impl(int16_t* vm_data, InferenceContext *ctx, const ParameterInfo* output, uint16_t output_offset, uint16_t blockSize) {
     check_buffer_address(vm_data, blockSize);
     MY_ASSERT(blockSize <= BUFFER_TEMP_SIZE);
 
     memset(buffer_temp, 0, blockSize * sizeof(int16_t));
-    my_memcpy_from_param(model, buffer_temp, output, output_offset, blockSize * sizeof(int16_t));
+    my_memcpy_from_param(ctx, buffer_temp, output, output_offset, blockSize * sizeof(int16_t));
     for (uint16_t idx = 0; idx < blockSize; idx++) {
         MY_ASSERT_ALWAYS(vm_data[idx] == buffer_temp[idx]);
     }
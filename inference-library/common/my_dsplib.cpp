@@ -12,6 +12,9 @@
 #include "my_debug.h"
 #include "op_utils.h"
 #include "cnn_common.h"
+#ifdef USE_HOST_SIMD
+#include "my_dsplib_simd.h"
+#endif
 
 #if !USE_ARM_CMSIS
 #define my_checkStatus(status) MY_ASSERT(status == MSP_SUCCESS, "Error from TI-DSPLib: %d" NEWLINE, status)
@@ -24,6 +27,7 @@ void check_buffer_address(const int16_t* addr, uint32_t blockSize) {
 }
 
 void my_div_q15(const int16_t *pSrcA, const int16_t *pSrcB, int16_t *pDst, uint32_t blockSize) {
+    consume_cpu_energy(CpuOp::DIV, blockSize);
     // XXX: use LEA?
     for (uint16_t idx = 0; idx < blockSize; idx++) {
         if(pSrcB[idx] == 0) {
@@ -39,6 +43,7 @@ void my_div_q15(const int16_t *pSrcA, const int16_t *pSrcB, int16_t *pDst, uint3
 }
 
 void my_mpy_q15(const int16_t *pSrcA, const int16_t *pSrcB, int16_t *pDst, uint32_t blockSize) {
+    consume_lea_energy(1, blockSize);
     check_buffer_address(pSrcA, blockSize);
     check_buffer_address(pSrcB, blockSize);
     check_buffer_address(pDst, blockSize);
@@ -59,6 +64,7 @@ void my_mpy_q15(const int16_t *pSrcA, const int16_t *pSrcB, int16_t *pDst, uint3
 }
 
 void my_sub_q15(const int16_t *pSrcA, const int16_t *pSrcB, int16_t *pDst, uint32_t blockSize) {
+    consume_lea_energy(1, blockSize);
     check_buffer_address(pSrcA, blockSize);
     check_buffer_address(pSrcB, blockSize);
     check_buffer_address(pDst, blockSize);
@@ -79,6 +85,7 @@ void my_sub_q15(const int16_t *pSrcA, const int16_t *pSrcB, int16_t *pDst, uint3
 }
 
 void my_vsqrt_q15(int16_t* pIn, int16_t* pOut, uint32_t blockSize) {
+    consume_cpu_energy(CpuOp::DIV, blockSize);
 #if !USE_ARM_CMSIS
     const float Q15_DIVISOR = 32768.0f;
     for (uint32_t idx = 0; idx < blockSize; idx++) {
@@ -96,6 +103,7 @@ void my_vsqrt_q15(int16_t* pIn, int16_t* pOut, uint32_t blockSize) {
 }
 
 void my_add_q15(const int16_t *pSrcA, const int16_t *pSrcB, int16_t *pDst, uint32_t blockSize) {
+    consume_cpu_energy(CpuOp::ADD, blockSize);
 #if !USE_ARM_CMSIS
     // XXX Not using LEA as pSrcA and pSrcB may not be 4-byte aligned (e.g., cifar10 with JAPARI/B=2)
     while (blockSize--) {
@@ -107,6 +115,7 @@ void my_add_q15(const int16_t *pSrcA, const int16_t *pSrcB, int16_t *pDst, uint3
 }
 
 void my_fill_q15(int16_t value, int16_t *pDst, uint32_t blockSize) {
+    consume_lea_energy(1, blockSize);
     check_buffer_address(pDst, blockSize);
 #if !USE_ARM_CMSIS
     uint32_t blockSizeForLEA = blockSize / 2 * 2;
@@ -126,6 +135,7 @@ void my_fill_q15(int16_t value, int16_t *pDst, uint32_t blockSize) {
 }
 
 void my_offset_q15(const int16_t *pSrc, int16_t offset, int16_t *pDst, uint32_t blockSize) {
+    consume_lea_energy(1, blockSize);
 #if !USE_ARM_CMSIS
     // XXX: the alignment adjustment code in this function only supports pSrc == pDst
     MY_ASSERT(pSrc == pDst);
@@ -157,6 +167,7 @@ void my_offset_q15(const int16_t *pSrc, int16_t offset, int16_t *pDst, uint32_t
 }
 
 void my_max_q15(const int16_t *pSrc, uint32_t blockSize, int16_t *pResult, uint16_t *pIndex) {
+    consume_lea_energy(1, blockSize);
     uint8_t unaligned = 0;
     if ((pSrc - lea_buffer) % 2) {
         unaligned = 1;
@@ -195,6 +206,7 @@ void my_max_q15(const int16_t *pSrc, uint32_t blockSize, int16_t *pResult, uint1
 }
 
 void my_min_q15(const int16_t *pSrc, uint32_t blockSize, int16_t *pResult, uint16_t *pIndex) {
+    consume_lea_energy(1, blockSize);
     uint8_t unaligned = 0;
     if ((pSrc - lea_buffer) % 2) {
         unaligned = 1;
@@ -233,10 +245,17 @@ void my_min_q15(const int16_t *pSrc, uint32_t blockSize, int16_t *pResult, uint1
 }
 
 #if USE_ARM_CMSIS
-static int16_t pState[ARM_PSTATE_LEN];
+// State bits for STATEFUL are enforced in the patched CMSIS, and not (yet) in the SIMD version
+#if defined(USE_HOST_SIMD) && !STATEFUL
+#define USE_SIMD_MATRIX_MPY 1
+#else
+#define USE_SIMD_MATRIX_MPY 0
+static PER_DEVICE int16_t pState[ARM_PSTATE_LEN];
+#endif
 #endif
 
-void my_matrix_mpy_q15(uint16_t A_rows, uint16_t A_cols, uint16_t B_rows, uint16_t B_cols, int16_t *pSrcA, int16_t *pSrcB, int16_t *pDst, ParameterInfo *param, uint16_t offset_in_word, size_t values_to_preserve, uint16_t mask, int16_t n_keep_state_bits) {
+void my_matrix_mpy_q15(uint16_t A_rows, uint16_t A_cols, uint16_t B_rows, uint16_t B_cols, int16_t *pSrcA, int16_t *pSrcB, int16_t *pDst, InferenceContext *ctx, ParameterInfo *param, uint16_t offset_in_word, size_t values_to_preserve, uint16_t mask, int16_t n_keep_state_bits) {
+    consume_lea_energy(A_rows * B_cols, A_cols);
     // XXX: LEA doc requires all matrix dimensions to be even, while LEA
     // appears to still give correct results when srcARows is odd
     // srcBCols should really be even, though
@@ -255,7 +274,7 @@ void my_matrix_mpy_q15(uint16_t A_rows, uint16_t A_cols, uint16_t B_rows, uint16
 #if ENABLE_COUNTERS
     start_cpu_counter();
 #endif
-    msp_status status = msp_matrix_mpy_q15(&matrix_mpy_params, pSrcA, pSrcB, pDst, my_memcpy_to_param, param, offset_in_word, values_to_preserve, mask, n_keep_state_bits);
+    msp_status status = msp_matrix_mpy_q15(&matrix_mpy_params, pSrcA, pSrcB, pDst, my_memcpy_to_param_callback, param, offset_in_word, values_to_preserve, mask, n_keep_state_bits);
 #if ENABLE_COUNTERS
     stop_cpu_counter(&Counters::dma_write_ofm);
 #endif
@@ -266,13 +285,17 @@ void my_matrix_mpy_q15(uint16_t A_rows, uint16_t A_cols, uint16_t B_rows, uint16
     arm_mat_init_q15(&B, B_rows, B_cols, pSrcB);
     arm_mat_init_q15(&C, A_rows, B_cols, pDst);
 #ifdef __MSP432__
-    arm_status status = arm_mat_mult_fast_q15(&A, &B, &C, pState, my_memcpy_to_param, param, offset_in_word, values_to_preserve, mask, n_keep_state_bits);
+    arm_status status = arm_mat_mult_fast_q15(&A, &B, &C, pState, my_memcpy_to_param_callback, param, offset_in_word, values_to_preserve, mask, n_keep_state_bits);
     MY_ASSERT(status == ARM_MATH_SUCCESS);
 #else
-    arm_status status = arm_mat_mult_fast_q15(&A, &B, &C, pState, my_memcpy_to_param, NULL, 0, 0, mask, n_keep_state_bits);
+#if USE_SIMD_MATRIX_MPY
+    simd_mat_mult_fast_q15(A_rows, A_cols, B_cols, pSrcA, pSrcB, pDst);
+#else
+    arm_status status = arm_mat_mult_fast_q15(&A, &B, &C, pState, my_memcpy_to_param_callback, NULL, 0, 0, mask, n_keep_state_bits);
     MY_ASSERT(status == ARM_MATH_SUCCESS);
+#endif
     if (param) {
-        my_memcpy_to_param(param, offset_in_word, pDst, values_to_preserve * sizeof(int16_t), 0);
+        my_memcpy_to_param(ctx, param, offset_in_word, pDst, values_to_preserve * sizeof(int16_t), 0);
     }
 #endif
 #endif
@@ -281,7 +304,8 @@ void my_matrix_mpy_q15(uint16_t A_rows, uint16_t A_cols, uint16_t B_rows, uint16
 #endif
 }
 #if STABLE_POWER
-void my_matrix_mpy_q15_to_vm(uint16_t A_rows, uint16_t A_cols, uint16_t B_rows, uint16_t B_cols, int16_t *pSrcA, int16_t *pSrcB, int16_t *pDst, ParameterInfo *param, uint16_t offset_in_word, size_t values_to_preserve, uint16_t mask, int16_t n_keep_state_bits) {
+void my_matrix_mpy_q15_to_vm(uint16_t A_rows, uint16_t A_cols, uint16_t B_rows, uint16_t B_cols, int16_t *pSrcA, int16_t *pSrcB, int16_t *pDst, InferenceContext *ctx, ParameterInfo *param, uint16_t offset_in_word, size_t values_to_preserve, uint16_t mask, int16_t n_keep_state_bits) {
+    consume_lea_energy(A_rows * B_cols, A_cols);
     // XXX: LEA doc requires all matrix dimensions to be even, while LEA
     // appears to still give correct results when srcARows is odd
     // srcBCols should really be even, though
@@ -306,20 +330,45 @@ void my_matrix_mpy_q15_to_vm(uint16_t A_rows, uint16_t A_cols, uint16_t B_rows,
     arm_mat_init_q15(&B, B_rows, B_cols, pSrcB);
     arm_mat_init_q15(&C, A_rows, B_cols, pDst);
 #ifdef __MSP432__
-    arm_status status = arm_mat_mult_fast_q15(&A, &B, &C, pState, my_memcpy_to_param, param, offset_in_word, values_to_preserve, mask, n_keep_state_bits);
+    arm_status status = arm_mat_mult_fast_q15(&A, &B, &C, pState, my_accumulate_to_vm, param, offset_in_word, values_to_preserve, mask, n_keep_state_bits);
     MY_ASSERT(status == ARM_MATH_SUCCESS);
 #else
-    arm_status status = arm_mat_mult_fast_q15(&A, &B, &C, pState, my_memcpy_to_param, NULL, 0, 0, mask, n_keep_state_bits);
+#if USE_SIMD_MATRIX_MPY
+    simd_mat_mult_fast_q15(A_rows, A_cols, B_cols, pSrcA, pSrcB, pDst);
+#else
+    arm_status status = arm_mat_mult_fast_q15(&A, &B, &C, pState, my_memcpy_to_param_callback, NULL, 0, 0, mask, n_keep_state_bits);
     MY_ASSERT(status == ARM_MATH_SUCCESS);
+#endif
     if (param) {
-        my_memcpy_to_param(param, offset_in_word, pDst, values_to_preserve * sizeof(int16_t), 0);
+        my_accumulate_to_vm(param, offset_in_word, pDst, values_to_preserve * sizeof(int16_t), 0);
     }
 #endif
 #endif
 }
 #endif // STABLE_POWER
 
+void my_relu_q15(const int16_t *pSrc, int16_t *pDst, uint32_t blockSize) {
+    consume_cpu_energy(CpuOp::MAX, blockSize);
+    // Neither TI-DSPLib nor CMSIS-DSP has element-wise max against a constant
+    for (uint32_t idx = 0; idx < blockSize; idx++) {
+        pDst[idx] = MAX_VAL(pSrc[idx], 0);
+    }
+}
+
+void my_vmax_q15(const int16_t *pSrcA, const int16_t *pSrcB, int16_t *pDst, uint32_t blockSize) {
+    consume_cpu_energy(CpuOp::MAX, blockSize);
+    // Element-wise max of two vectors, which is not in TI-DSPLib or CMSIS-DSP either
+#ifdef USE_HOST_SIMD
+    simd_vmax_q15(pSrcA, pSrcB, pDst, blockSize);
+#else
+    for (uint32_t idx = 0; idx < blockSize; idx++) {
+        pDst[idx] = MAX_VAL(pSrcA[idx], pSrcB[idx]);
+    }
+#endif
+}
+
 void my_scale_q15(const int16_t *pSrc, int16_t scaleFract, uint8_t shift, int16_t *pDst, uint32_t blockSize) {
+    consume_lea_energy(1, blockSize);
 #if !USE_ARM_CMSIS
     uint32_t blockSizeForLEA = blockSize / 2 * 2;
     if (blockSizeForLEA) {
@@ -339,6 +388,7 @@ void my_scale_q15(const int16_t *pSrc, int16_t scaleFract, uint8_t shift, int16_
 }
 
 void my_interleave_q15(const int16_t *pSrc, uint16_t channel, uint16_t numChannels, int16_t *pDst, uint32_t blockSize) {
+    consume_cpu_energy(CpuOp::ADD, blockSize);
     MY_ASSERT(channel < numChannels);
     // XXX: not using LEA here as pSrc and/or pDst is often unaligned
     // CMSIS does not have interleave (yet)
@@ -350,6 +400,7 @@ void my_interleave_q15(const int16_t *pSrc, uint16_t channel, uint16_t numChanne
 }
 
 void my_deinterleave_q15(const int16_t *pSrc, uint16_t channel, uint16_t numChannels, int16_t *pDst, uint32_t blockSize) {
+    consume_cpu_energy(CpuOp::ADD, blockSize);
     // XXX: not using LEA here as I didn't allocate LEA memory for inputs with footprints
     for (uint32_t idx = 0; idx < blockSize; idx++) {
         *pDst = *(pSrc + channel);
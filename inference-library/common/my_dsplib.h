@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <cstdlib>
 struct ParameterInfo;
+struct InferenceContext;
 
 void my_div_q15(const int16_t *pSrcA, const int16_t *pSrcB, int16_t *pDst, uint32_t blockSize);
 void my_mpy_q15(const int16_t *pSrcA, const int16_t *pSrcB, int16_t *pDst, uint32_t blockSize);
@@ -11,14 +12,16 @@ void my_add_q15(const int16_t *pSrcA, const int16_t *pSrcB, int16_t *pDst, uint3
 void my_fill_q15(int16_t value, int16_t *pDst, uint32_t blockSize);
 void my_offset_q15(const int16_t *pSrc, int16_t offset, int16_t *pDst, uint32_t blockSize);
 void my_matrix_mpy_q15(uint16_t A_rows, uint16_t A_cols, uint16_t B_rows, uint16_t B_cols, int16_t *pSrcA, int16_t *pSrcB, int16_t *pDst,
-                       ParameterInfo *param, uint16_t offset_in_word, size_t values_to_preserve,
+                       InferenceContext *ctx, ParameterInfo *param, uint16_t offset_in_word, size_t values_to_preserve,
                        uint16_t mask, int16_t n_keep_state_bits);
 void my_matrix_mpy_q15_to_vm(uint16_t A_rows, uint16_t A_cols, uint16_t B_rows, uint16_t B_cols, int16_t *pSrcA, int16_t *pSrcB, int16_t *pDst,
-                       ParameterInfo *param, uint16_t offset_in_word, size_t values_to_preserve,
+                       InferenceContext *ctx, ParameterInfo *param, uint16_t offset_in_word, size_t values_to_preserve,
                        uint16_t mask, int16_t n_keep_state_bits);
 void my_max_q15(const int16_t *pSrc, uint32_t blockSize, int16_t *pResult, uint16_t *pIndex);
 void my_min_q15(const int16_t *pSrc, uint32_t blockSize, int16_t *pResult, uint16_t *pIndex);
 void my_vsqrt_q15(int16_t* pIn, int16_t* pOut, uint32_t blockSize);
+void my_relu_q15(const int16_t *pSrc, int16_t *pDst, uint32_t blockSize);
+void my_vmax_q15(const int16_t *pSrcA, const int16_t *pSrcB, int16_t *pDst, uint32_t blockSize);
 void my_scale_q15(const int16_t *pSrc, int16_t scaleFract, uint8_t shift, int16_t *pDst, uint32_t blockSize);
 void my_interleave_q15(const int16_t *pSrc, uint16_t channel, uint16_t numChannels, int16_t *pDst, uint32_t blockSize);
 void my_deinterleave_q15(const int16_t *pSrc, uint16_t channel, uint16_t numChannels, int16_t *pDst, uint32_t blockSize);
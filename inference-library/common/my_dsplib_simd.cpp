@@ -0,0 +1,190 @@
+#include <cstdint>
+#include "my_dsplib_simd.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#else
+#error "USE_HOST_SIMD requires AVX2 or AArch64 NEON"
+#endif
+
+static inline int16_t saturate_q15(int32_t val) {
+    return (val > INT16_MAX) ? INT16_MAX : ((val < INT16_MIN) ? INT16_MIN : val);
+}
+
+// CMSIS accumulates with __SMLAD, which wraps around on overflow. Emulate that with
+// unsigned arithmetic, as signed overflow is undefined in C++.
+static inline int32_t mac_q15(int32_t acc, int16_t a, int16_t b) {
+    return static_cast<int32_t>(static_cast<uint32_t>(acc) + static_cast<uint32_t>(a * b));
+}
+
+static inline int32_t add_q31_wrapped(int32_t a, int32_t b) {
+    return static_cast<int32_t>(static_cast<uint32_t>(a) + static_cast<uint32_t>(b));
+}
+
+// Accumulate a[k] * b[k * b_stride] for k in [k_begin, k_end) to acc, and convert the result to q15
+static inline int16_t finish_dot_q15(int32_t acc, const int16_t *a, const int16_t *b, uint16_t b_stride, uint16_t k_begin, uint16_t k_end) {
+    for (uint16_t k = k_begin; k < k_end; k++) {
+        acc = mac_q15(acc, a[k], b[k * b_stride]);
+    }
+    return saturate_q15(acc >> 15);
+}
+
+#if defined(__AVX2__)
+
+static inline __m256i broadcast_q15_pair(int16_t a0, int16_t a1) {
+    return _mm256_set1_epi32(static_cast<int32_t>(static_cast<uint16_t>(a0) | (static_cast<uint32_t>(static_cast<uint16_t>(a1)) << 16)));
+}
+
+// One row of results with B_cols >= 8. Each 32-bit lane accumulates two rows of B via madd.
+static void mat_mult_row_wide(const int16_t *a, uint16_t A_cols, uint16_t B_cols, const int16_t *b, int16_t *dst) {
+    uint16_t col = 0;
+    for (; col + 16 <= B_cols; col += 16) {
+        __m256i acc_lo = _mm256_setzero_si256(), acc_hi = _mm256_setzero_si256();
+        uint16_t k = 0;
+        for (; k + 2 <= A_cols; k += 2) {
+            __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + k * B_cols + col));
+            __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + (k + 1) * B_cols + col));
+            __m256i a_pair = broadcast_q15_pair(a[k], a[k + 1]);
+            acc_lo = _mm256_add_epi32(acc_lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(b0, b1), a_pair));
+            acc_hi = _mm256_add_epi32(acc_hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(b0, b1), a_pair));
+        }
+        if (k < A_cols) {
+            __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + k * B_cols + col));
+            __m256i b1 = _mm256_setzero_si256();
+            __m256i a_pair = broadcast_q15_pair(a[k], 0);
+            acc_lo = _mm256_add_epi32(acc_lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(b0, b1), a_pair));
+            acc_hi = _mm256_add_epi32(acc_hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(b0, b1), a_pair));
+        }
+        // unpacklo/unpackhi split columns 0-3/8-11 and 4-7/12-15, and packs puts them back in order
+        __m256i result = _mm256_packs_epi32(_mm256_srai_epi32(acc_lo, 15), _mm256_srai_epi32(acc_hi, 15));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + col), result);
+    }
+    for (; col + 8 <= B_cols; col += 8) {
+        __m128i acc_lo = _mm_setzero_si128(), acc_hi = _mm_setzero_si128();
+        for (uint16_t k = 0; k < A_cols; k += 2) {
+            __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + k * B_cols + col));
+            __m128i b1 = (k + 1 < A_cols) ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + (k + 1) * B_cols + col)) : _mm_setzero_si128();
+            __m128i a_pair = _mm256_castsi256_si128(broadcast_q15_pair(a[k], (k + 1 < A_cols) ? a[k + 1] : 0));
+            acc_lo = _mm_add_epi32(acc_lo, _mm_madd_epi16(_mm_unpacklo_epi16(b0, b1), a_pair));
+            acc_hi = _mm_add_epi32(acc_hi, _mm_madd_epi16(_mm_unpackhi_epi16(b0, b1), a_pair));
+        }
+        __m128i result = _mm_packs_epi32(_mm_srai_epi32(acc_lo, 15), _mm_srai_epi32(acc_hi, 15));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + col), result);
+    }
+    for (; col < B_cols; col++) {
+        dst[col] = finish_dot_q15(0, a, b + col, B_cols, 0, A_cols);
+    }
+}
+
+// One row of results with B_cols = 1, 2 or 4, which is common for tiles in intermittent inference.
+// Rows of B are contiguous, so 16 values of B are loaded at once and reordered, so that each 32-bit
+// lane of madd accumulates two rows of the same column.
+static void mat_mult_row_narrow(const int16_t *a, uint16_t A_cols, uint16_t B_cols, const int16_t *b, int16_t *dst) {
+    // indices of 16-bit words in each 128-bit lane
+    const __m256i shuffle_2_cols = _mm256_setr_epi8(0, 1, 4, 5, 2, 3, 6, 7, 8, 9, 12, 13, 10, 11, 14, 15,
+                                                    0, 1, 4, 5, 2, 3, 6, 7, 8, 9, 12, 13, 10, 11, 14, 15);
+    const __m256i shuffle_4_cols = _mm256_setr_epi8(0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15,
+                                                    0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15);
+    // pairs of A values for each 32-bit lane
+    const __m256i a_pairs_2_cols = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    const __m256i a_pairs_4_cols = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+
+    const uint16_t rows_per_iteration = 16 / B_cols;
+    __m256i acc = _mm256_setzero_si256();
+    uint16_t k = 0;
+    for (; k + rows_per_iteration <= A_cols; k += rows_per_iteration) {
+        __m256i b_vals = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + k * B_cols));
+        __m256i a_vals;
+        if (B_cols == 1) {
+            a_vals = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + k));
+        } else if (B_cols == 2) {
+            b_vals = _mm256_shuffle_epi8(b_vals, shuffle_2_cols);
+            a_vals = _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + k)));
+            a_vals = _mm256_permutevar8x32_epi32(a_vals, a_pairs_2_cols);
+        } else {
+            b_vals = _mm256_shuffle_epi8(b_vals, shuffle_4_cols);
+            a_vals = _mm256_castsi128_si256(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + k)));
+            a_vals = _mm256_permutevar8x32_epi32(a_vals, a_pairs_4_cols);
+        }
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(b_vals, a_vals));
+    }
+
+    // Lane l holds partial sums for column l % B_cols
+    int32_t partial_sums[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(partial_sums), acc);
+    for (uint16_t col = 0; col < B_cols; col++) {
+        int32_t sum = 0;
+        for (uint8_t lane = col; lane < 8; lane += B_cols) {
+            sum = add_q31_wrapped(sum, partial_sums[lane]);
+        }
+        dst[col] = finish_dot_q15(sum, a, b + col, B_cols, k, A_cols);
+    }
+}
+
+void simd_mat_mult_fast_q15(uint16_t A_rows, uint16_t A_cols, uint16_t B_cols, const int16_t *pSrcA, const int16_t *pSrcB, int16_t *pDst) {
+    for (uint16_t row = 0; row < A_rows; row++) {
+        const int16_t *a = pSrcA + row * A_cols;
+        int16_t *dst = pDst + row * B_cols;
+        if (B_cols == 1 || B_cols == 2 || B_cols == 4) {
+            mat_mult_row_narrow(a, A_cols, B_cols, pSrcB, dst);
+        } else {
+            mat_mult_row_wide(a, A_cols, B_cols, pSrcB, dst);
+        }
+    }
+}
+
+void simd_vmax_q15(const int16_t *pSrcA, const int16_t *pSrcB, int16_t *pDst, uint32_t blockSize) {
+    uint32_t idx = 0;
+    for (; idx + 16 <= blockSize; idx += 16) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pSrcA + idx));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pSrcB + idx));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pDst + idx), _mm256_max_epi16(a, b));
+    }
+    for (; idx < blockSize; idx++) {
+        pDst[idx] = (pSrcA[idx] > pSrcB[idx]) ? pSrcA[idx] : pSrcB[idx];
+    }
+}
+
+#else // AArch64 NEON
+
+// One row of results. NEON multiplies a vector by a scalar, so 8 or 4 columns are computed at once.
+void simd_mat_mult_fast_q15(uint16_t A_rows, uint16_t A_cols, uint16_t B_cols, const int16_t *pSrcA, const int16_t *pSrcB, int16_t *pDst) {
+    for (uint16_t row = 0; row < A_rows; row++) {
+        const int16_t *a = pSrcA + row * A_cols;
+        int16_t *dst = pDst + row * B_cols;
+        uint16_t col = 0;
+        for (; col + 8 <= B_cols; col += 8) {
+            int32x4_t acc_lo = vdupq_n_s32(0), acc_hi = vdupq_n_s32(0);
+            for (uint16_t k = 0; k < A_cols; k++) {
+                int16x8_t b_vals = vld1q_s16(pSrcB + k * B_cols + col);
+                acc_lo = vmlal_n_s16(acc_lo, vget_low_s16(b_vals), a[k]);
+                acc_hi = vmlal_high_n_s16(acc_hi, b_vals, a[k]);
+            }
+            vst1q_s16(dst + col, vcombine_s16(vqshrn_n_s32(acc_lo, 15), vqshrn_n_s32(acc_hi, 15)));
+        }
+        for (; col + 4 <= B_cols; col += 4) {
+            int32x4_t acc = vdupq_n_s32(0);
+            for (uint16_t k = 0; k < A_cols; k++) {
+                acc = vmlal_n_s16(acc, vld1_s16(pSrcB + k * B_cols + col), a[k]);
+            }
+            vst1_s16(dst + col, vqshrn_n_s32(acc, 15));
+        }
+        for (; col < B_cols; col++) {
+            dst[col] = finish_dot_q15(0, a, pSrcB + col, B_cols, 0, A_cols);
+        }
+    }
+}
+
+void simd_vmax_q15(const int16_t *pSrcA, const int16_t *pSrcB, int16_t *pDst, uint32_t blockSize) {
+    uint32_t idx = 0;
+    for (; idx + 8 <= blockSize; idx += 8) {
+        vst1q_s16(pDst + idx, vmaxq_s16(vld1q_s16(pSrcA + idx), vld1q_s16(pSrcB + idx)));
+    }
+    for (; idx < blockSize; idx++) {
+        pDst[idx] = (pSrcA[idx] > pSrcB[idx]) ? pSrcA[idx] : pSrcB[idx];
+    }
+}
+
+#endif
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+
+// AVX2/NEON versions of q15 kernels that dominate simulation time on the host: matrix
+// multiplication for Conv/Gemm and element-wise max for MaxPool. Results are bit-exact with
+// CMSIS: products are accumulated in 32 bits, and outputs are saturated to q15.
+void simd_mat_mult_fast_q15(uint16_t A_rows, uint16_t A_cols, uint16_t B_cols, const int16_t *pSrcA, const int16_t *pSrcB, int16_t *pDst);
+void simd_vmax_q15(const int16_t *pSrcA, const int16_t *pSrcB, int16_t *pDst, uint32_t blockSize);
@@ -10,18 +10,17 @@
 
 #define RESHAPE_AUTO_DIM static_cast<uint16_t>(-1)
 
-void alloc_relu(Model *model, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
-    const ParameterInfo *data = input[0];
-    output->slot = get_next_slot(model, data);
+void alloc_relu(InferenceContext *ctx, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
+    // The slot of the input if the output overwrites it (see can_overwrite_input in transform.py)
+    output->slot = get_next_slot(ctx);
 }
 
-void handle_relu(Model *model, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
+void handle_relu(InferenceContext *ctx, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
     my_printf_debug("ReLu!" NEWLINE);
 
     const ParameterInfo *X = input[0];
     uint16_t N = X->dims[0], CHANNEL = X->dims[1], H = X->dims[2], W = X->dims[3];
 
-    /* XXX: use LEA? */
     uint16_t bitwidth = X->bitwidth;
     MY_ASSERT(bitwidth == 16);
     int16_t data_len = X->params_len / (bitwidth / 8);
@@ -32,73 +31,63 @@ void handle_relu(Model *model, const ParameterInfo *input[], ParameterInfo *outp
         data_len = N * CHANNEL * H * W;
 #endif // STABLE_POWER
     my_printf_debug("data_len: %d" NEWLINE, data_len);
+
+    /* Values are processed block by block, with a footprint for each block.
+     * Blocks are no larger than conv output tiles (see determine_conv_tile_c
+     * in transform.py), so that progress is possible whenever it is possible
+     * for Conv. For transposing, a block consists of whole pixels. In place,
+     * re-executing a block gives the same values, as ReLU is idempotent. */
+    uint8_t need_nhwc2nchw = (node->flags.generic == NHWC2NCHW && H != 0);
+    MY_ASSERT(!need_nhwc2nchw || output->slot != X->slot);
+    uint16_t block_len = CPU_BUFFER_SIZE / BATCH_SIZE * BATCH_SIZE;
+    if (need_nhwc2nchw) {
+        block_len = MAX_VAL(1, CPU_BUFFER_SIZE / CHANNEL) * CHANNEL;
+        MY_ASSERT(block_len % BATCH_SIZE == 0);
+    }
+    MY_ASSERT(2 * block_len <= LEA_BUFFER_SIZE);
+    int16_t *buffer_input = lea_buffer,
+            *buffer_output = buffer_input + block_len;
+
     uint16_t data_offset = 0;
-    uint16_t output_offset = 0;
 #if INTERMITTENT
-    uint32_t first_unfinished_value_offset = batch_start(job_index_to_offset(output, run_recovery(model, output)));
+    uint32_t first_unfinished_value_offset = batch_start(job_index_to_offset(output, run_recovery(ctx, output)));
     my_printf_debug("first_unfinished_value_offset: %d" NEWLINE, first_unfinished_value_offset);
     data_offset += first_unfinished_value_offset;
-    if(H != 0) {
-        if(node->flags.generic == NHWC2NCHW) {
-            output_offset += (data_offset / CHANNEL) + (data_offset % CHANNEL) * H * W;
-        } else {
-            output_offset += first_unfinished_value_offset;
-        }
-    } else {
-        output_offset += first_unfinished_value_offset;
-    }
 #endif
 
-    if(node->flags.generic == NHWC2NCHW) {
-        // NHWC -> NCHW
-        uint16_t i = data_offset;
-        uint16_t cur_batch_offset = i % BATCH_SIZE;
-        for (; i < data_len; i++) {
-            int16_t output_val;
-            {
-                int16_t input_val = get_q15_param(model, X, data_offset);
-                output_val = MAX_VAL(input_val, 0);
+    while (data_offset < data_len) {
+        // Blocks are aligned to block_len, except the first one after recovery
+        uint16_t cur_block_len = MIN_VAL(block_len - data_offset % block_len, data_len - data_offset);
+        my_printf_debug("input_offset=%d len=%d" NEWLINE, data_offset, cur_block_len);
+        my_memcpy_from_param(ctx, buffer_input, X, data_offset, cur_block_len * sizeof(int16_t));
+        my_relu_q15(buffer_input, buffer_input, cur_block_len);
+        if (need_nhwc2nchw) {
+            // NHWC -> NCHW
+            MY_ASSERT(data_offset % CHANNEL == 0);
+            uint16_t n_pixels = cur_block_len / CHANNEL;
+            for (uint16_t channel = 0; channel < CHANNEL; channel++) {
+                my_deinterleave_q15(buffer_input, channel, CHANNEL, buffer_output + channel * n_pixels, n_pixels);
             }
-            my_printf_debug("input_offset=%d output_offset=%d output_val=%d" NEWLINE, data_offset, output_offset, output_val);
-            put_q15_param(output, output_offset, output_val);
-#if HAWAII
-            if (cur_batch_offset == BATCH_SIZE - 1) {
-                write_hawaii_layer_footprint(model->layer_idx, BATCH_SIZE);
-                cur_batch_offset -= BATCH_SIZE;
+            uint16_t pixel_offset = data_offset / CHANNEL;
+            if (n_pixels == H * W) {
+                my_memcpy_to_param(ctx, output, 0, buffer_output, cur_block_len * sizeof(int16_t), 0);
+            } else {
+                for (uint16_t channel = 0; channel < CHANNEL; channel++) {
+                    my_memcpy_to_param(ctx, output, channel * H * W + pixel_offset, buffer_output + channel * n_pixels, n_pixels * sizeof(int16_t), 0);
+                }
             }
-#endif
-            data_offset++;
-            if(H != 0) // conv
-                output_offset = (data_offset / CHANNEL) + (data_offset % CHANNEL) * H * W;
-            else // fc
-                output_offset++;
-            cur_batch_offset++;
+        } else {
+            my_memcpy_to_param(ctx, output, data_offset, buffer_input, cur_block_len * sizeof(int16_t), 0);
         }
-    } else {
-        // NHWC -> NHWC
-        uint16_t i = data_offset;
-        uint16_t cur_batch_offset = i % BATCH_SIZE;
-        for (; i < data_len; i++) {
-            int16_t output_val;
-            {
-                int16_t input_val = get_q15_param(model, X, data_offset);
-                output_val = MAX_VAL(input_val, 0);
-            }
-            my_printf_debug("input_offset=%d output_offset=%d output_val=%d" NEWLINE, data_offset, output_offset, output_val);
-            put_q15_param(output, output_offset, output_val);
 #if HAWAII
-            if (cur_batch_offset == BATCH_SIZE - 1) {
-                write_hawaii_layer_footprint(model->layer_idx, BATCH_SIZE);
-                cur_batch_offset -= BATCH_SIZE;
-            }
-#endif
-            data_offset++;
-            output_offset++;
-            cur_batch_offset++;
+        if (cur_block_len >= BATCH_SIZE) {
+            write_hawaii_layer_footprint(ctx, ctx->model_vm.layer_idx, cur_block_len / BATCH_SIZE * BATCH_SIZE);
         }
+#endif
+        data_offset += cur_block_len;
     }
 
-    flip_state_bit(model, output);
+    flip_state_bit(ctx, output);
 
     // my_printf_debug("handle_relu output" NEWLINE);
     // if(node->flags.generic == NHWC2NCHW) {
@@ -108,7 +97,7 @@ void handle_relu(Model *model, const ParameterInfo *input[], ParameterInfo *outp
     // }
 }
 
-void handle_reshape(Model *model, const ParameterInfo *input[], ParameterInfo *output, const Node*) {
+void handle_reshape(InferenceContext *ctx, const ParameterInfo *input[], ParameterInfo *output, const Node*) {
     my_printf_debug("Reshape!" NEWLINE);
 
     const ParameterInfo *data = input[0], *shape = input[1];
@@ -154,7 +143,7 @@ void handle_reshape(Model *model, const ParameterInfo *input[], ParameterInfo *o
     // MY_ASSERT(new_len * sizeof(int16_t) == output->params_len);
 }
 
-void handle_squeeze(Model *model, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
+void handle_squeeze(InferenceContext *ctx, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
     my_printf_debug("Squeeze!" NEWLINE);
 
     uint8_t axes = node->flags.extra.squeeze.axes;
@@ -183,7 +172,7 @@ void handle_squeeze(Model *model, const ParameterInfo *input[], ParameterInfo *o
     }
 }
 
-void handle_unsqueeze(Model* model, const ParameterInfo* input[], ParameterInfo* output, const Node* node) {
+void handle_unsqueeze(InferenceContext *ctx, const ParameterInfo* input[], ParameterInfo* output, const Node* node) {
     my_printf_debug("Unsqueeze!" NEWLINE);
     uint8_t axes = node->flags.extra.squeeze.axes;
     uint8_t input_dim_offset = 0, output_dim_offset = 0;
@@ -199,12 +188,25 @@ void handle_unsqueeze(Model* model, const ParameterInfo* input[], ParameterInfo*
     }
 }
 
-void alloc_concat(Model *, const ParameterInfo *[], ParameterInfo*, const Node*) {
+void alloc_concat(InferenceContext *, const ParameterInfo *input[], ParameterInfo* output, const Node* node) {
+#if !INDIRECT_RECOVERY
+    // Inputs are placed one after another in each pixel, with the same scale (see transform.py)
+    uint16_t channel_offset = 0;
+    for (uint8_t i = 0; i < node->inputs_len; i++) {
+        const ParameterInfo *X = input[i];
+        MY_ASSERT(X->slot == output->slot && X->params_offset == output->params_offset + channel_offset * sizeof(int16_t));
+        MY_ASSERT(X->dims[2] == output->dims[2] && X->dims[3] == output->dims[3]);
+        MY_ASSERT(!(X->scale != output->scale));
+        channel_offset += X->dims[1];
+    }
+    output->dims[1] = channel_offset;
+#endif // !INDIRECT_RECOVERY
 }
 
-void handle_concat(Model *model, const ParameterInfo *input[], ParameterInfo *output, const Node*) {
+void handle_concat(InferenceContext *ctx, const ParameterInfo *input[], ParameterInfo *output, const Node*) {
     my_printf_debug("Concat!" NEWLINE);
 
+#if INDIRECT_RECOVERY
     const ParameterInfo *A = input[0], *B = input[1];
     // XXX: assume concatenating 2 tensors at the CHANNEL dimension and they
     // have the same number of channels.
@@ -220,16 +222,20 @@ void handle_concat(Model *model, const ParameterInfo *input[], ParameterInfo *ou
     output->extra_info[1] = B->parameter_info_idx;
     output->slot = A->slot;
 
-    dump_params_nhwc_debug(model, A);
-    dump_params_nhwc_debug(model, B);
+    dump_params_nhwc_debug(ctx, A);
+    dump_params_nhwc_debug(ctx, B);
+#else // INDIRECT_RECOVERY
+    // Nothing to copy, as producers of inputs write values to the output
+    dump_params_nhwc_debug(ctx, output);
+#endif // INDIRECT_RECOVERY
 }
 
-void handle_softmax(Model*, const ParameterInfo*[], ParameterInfo*, const Node*) {
+void handle_softmax(InferenceContext *, const ParameterInfo*[], ParameterInfo*, const Node*) {
     // Do nothing - softmax does not change the relative order of values.
     // Just let run_model determine the max value
 }
 
-void handle_transpose(Model*, const ParameterInfo *input[], ParameterInfo *output, const Node*) {
+void handle_transpose(InferenceContext *, const ParameterInfo *input[], ParameterInfo *output, const Node*) {
     my_printf_debug("Transpose!" NEWLINE);
 
     const ParameterInfo *X = input[0];
@@ -240,18 +246,20 @@ void handle_transpose(Model*, const ParameterInfo *input[], ParameterInfo *outpu
     output->dims[3] = X->dims[2];
 }
 
-void alloc_add(Model *model, const ParameterInfo *input[], ParameterInfo *output, const Node *node) {
-    output->slot = get_next_slot(model, input[0]);
+void alloc_add(InferenceContext *ctx, const ParameterInfo *input[], ParameterInfo *output, const Node *node) {
+    output->slot = get_next_slot(ctx);
 }
 
-void handle_add(Model *model, const ParameterInfo *input[], ParameterInfo *output, const Node *node) {
+void handle_add(InferenceContext *ctx, const ParameterInfo *input[], ParameterInfo *output, const Node *node) {
     my_printf_debug("Add!" NEWLINE);
 
     const ParameterInfo *X = input[0], *Y = input[1];
+    // Partially updated values cannot be recovered in place
+    MY_ASSERT(STABLE_POWER || output->slot != X->slot);
     uint16_t buffer_size = X->dims[1];
     int16_t *buffer_a = lea_buffer,
             *buffer_b = buffer_a + buffer_size;
-    my_memcpy_from_param(model, buffer_b, Y, 0, buffer_size * sizeof(int16_t));
+    my_memcpy_from_param(ctx, buffer_b, Y, 0, buffer_size * sizeof(int16_t));
 
     int16_t scaleFract;
     uint8_t shift;
@@ -259,22 +267,23 @@ void handle_add(Model *model, const ParameterInfo *input[], ParameterInfo *outpu
     my_scale_q15(buffer_b, scaleFract, shift, buffer_b, buffer_size);
 
     for (uint16_t idx = 0; idx < X->dims[2]; idx++) {
-        my_memcpy_from_param(model, buffer_a, X, idx*buffer_size, buffer_size * sizeof(int16_t));
+        my_memcpy_from_param(ctx, buffer_a, X, idx*buffer_size, buffer_size * sizeof(int16_t));
         my_add_q15(buffer_a, buffer_b, buffer_a, buffer_size);
-        my_memcpy_to_param(output, idx*buffer_size, buffer_a, buffer_size * sizeof(int16_t), 0);
+        my_memcpy_to_param(ctx, output, idx*buffer_size, buffer_a, buffer_size * sizeof(int16_t), 0);
     }
-    dump_params_nhwc_debug(model, output, node->output_name);
+    dump_params_nhwc_debug(ctx, output, node->output_name);
 }
 
-void alloc_batchnormalization(Model* model, const ParameterInfo* input[], ParameterInfo* output, const Node*) {
-    const ParameterInfo* X = input[0];
-    output->slot = get_next_slot(model, X);
+void alloc_batchnormalization(InferenceContext *ctx, const ParameterInfo* input[], ParameterInfo* output, const Node*) {
+    output->slot = get_next_slot(ctx);
 }
 
-void handle_batchnormalization(Model* model, const ParameterInfo* input[], ParameterInfo* output, const Node*) {
+void handle_batchnormalization(InferenceContext *ctx, const ParameterInfo* input[], ParameterInfo* output, const Node*) {
     my_printf_debug("BatchNormalization!" NEWLINE);
 
     const ParameterInfo *X = input[0], *scale = input[1], *B = input[2], *mean = input[3], *var = input[4];
+    // Partially updated values cannot be recovered in place
+    MY_ASSERT(STABLE_POWER || output->slot != X->slot);
     const uint16_t CHANNEL = X->dims[1], H = X->dims[2], W= X->dims[3];
     my_printf_debug("H: %d, W: %d, CHANNEL: %d" NEWLINE, H, W, CHANNEL);
     uint16_t area = 1;
@@ -289,7 +298,7 @@ void handle_batchnormalization(Model* model, const ParameterInfo* input[], Param
     uint32_t offset = 0;
     uint16_t idx = 0;
 #if INTERMITTENT
-    uint32_t first_unfinished_value_offset = batch_start(job_index_to_offset(output, run_recovery(model, output)));
+    uint32_t first_unfinished_value_offset = batch_start(job_index_to_offset(output, run_recovery(ctx, output)));
     // re-execute from the begin of CHANNEL
     offset = first_unfinished_value_offset & ~0x1;
     MY_ASSERT(!(offset & 0x1));
@@ -299,14 +308,14 @@ void handle_batchnormalization(Model* model, const ParameterInfo* input[], Param
     }
 #if HAWAII
     // reset footprint cnt
-    write_hawaii_layer_footprint(model->layer_idx, offset - first_unfinished_value_offset);
+    write_hawaii_layer_footprint(ctx, ctx->model_vm.layer_idx, offset - first_unfinished_value_offset);
 #endif // HAWAII
 #endif
 
-    my_memcpy_from_param(model, buffer_scale, scale, 0, CHANNEL * sizeof(int16_t));
-    my_memcpy_from_param(model, buffer_b, B, 0, CHANNEL * sizeof(int16_t));
-    my_memcpy_from_param(model, buffer_mean, mean, 0, CHANNEL * sizeof(int16_t));
-    my_memcpy_from_param(model, buffer_var, var, 0, CHANNEL * sizeof(int16_t));
+    my_memcpy_from_param(ctx, buffer_scale, scale, 0, CHANNEL * sizeof(int16_t));
+    my_memcpy_from_param(ctx, buffer_b, B, 0, CHANNEL * sizeof(int16_t));
+    my_memcpy_from_param(ctx, buffer_mean, mean, 0, CHANNEL * sizeof(int16_t));
+    my_memcpy_from_param(ctx, buffer_var, var, 0, CHANNEL * sizeof(int16_t));
 
     int16_t scaleFract;
     uint8_t shift;
@@ -326,13 +335,13 @@ void handle_batchnormalization(Model* model, const ParameterInfo* input[], Param
     my_printf_debug("output: %f" NEWLINE, output->scale.toFloat());
     // assume conventional epsilon
     my_printf_debug("var" NEWLINE);
-    dump_matrix_debug(buffer_var, CHANNEL, ValueInfo(output, model));
+    dump_matrix_debug(buffer_var, CHANNEL, ValueInfo(output, ctx));
     my_offset_q15(buffer_var, static_cast<int16_t>(0.00001 * 0x8000 / var->scale.toFloat()), buffer_var, CHANNEL);
     my_printf_debug("var + epsilon" NEWLINE);
-    dump_matrix_debug(buffer_var, CHANNEL, ValueInfo(output, model));
+    dump_matrix_debug(buffer_var, CHANNEL, ValueInfo(output, ctx));
     my_vsqrt_q15(buffer_var, buffer_var, CHANNEL);
     my_printf_debug("sqrt(var + epsilon)" NEWLINE);
-    dump_matrix_debug(buffer_var, CHANNEL, ValueInfo(output, model));
+    dump_matrix_debug(buffer_var, CHANNEL, ValueInfo(output, ctx));
 
     uint16_t channel_offset, cur_channel;
     channel_offset = offset % CHANNEL;
@@ -343,28 +352,28 @@ void handle_batchnormalization(Model* model, const ParameterInfo* input[], Param
     buffer_var += channel_offset;
     buffer_b += channel_offset;
     for (; idx < area; idx++) {
-        my_memcpy_from_param(model, buffer_x, X, offset, cur_channel * sizeof(int16_t));
+        my_memcpy_from_param(ctx, buffer_x, X, offset, cur_channel * sizeof(int16_t));
 
         my_sub_q15(buffer_x, buffer_mean, buffer_x, cur_channel);
         my_printf_debug("x - mean" NEWLINE);
-        dump_matrix_debug(buffer_x, cur_channel, ValueInfo(output, model));
+        dump_matrix_debug(buffer_x, cur_channel, ValueInfo(output, ctx));
 
         my_mpy_q15(buffer_x, buffer_scale, buffer_x, cur_channel);
         my_printf_debug("(x - mean)*scale" NEWLINE);
-        dump_matrix_debug(buffer_x, cur_channel, ValueInfo(output, model));
+        dump_matrix_debug(buffer_x, cur_channel, ValueInfo(output, ctx));
 
         my_div_q15(buffer_x, buffer_var, buffer_x, cur_channel);
         my_printf_debug("(x - mean)*scale/sqrt(var+epsilon)" NEWLINE);
-        dump_matrix_debug(buffer_x, cur_channel, ValueInfo(output, model));
+        dump_matrix_debug(buffer_x, cur_channel, ValueInfo(output, ctx));
 
         my_add_q15(buffer_x, buffer_b, buffer_x, cur_channel);
         my_printf_debug("(x - mean)/sqrt(var+epsilon)*scale+B" NEWLINE);
-        dump_matrix_debug(buffer_x, cur_channel, ValueInfo(output, model));
+        dump_matrix_debug(buffer_x, cur_channel, ValueInfo(output, ctx));
 
-        my_memcpy_to_param(output, offset, buffer_x, cur_channel * sizeof(int16_t), 0);
+        my_memcpy_to_param(ctx, output, offset, buffer_x, cur_channel * sizeof(int16_t), 0);
         offset += cur_channel;
 #if HAWAII
-        hawaii_record_footprints(model, cur_channel);
+        hawaii_record_footprints(ctx, cur_channel);
 #endif
         cur_channel += channel_offset;
         buffer_x -= channel_offset;
@@ -10,22 +10,45 @@
 #ifdef __MSP430__
 #pragma DATA_SECTION(".leaRAM")
 #endif
-int16_t lea_buffer[LEA_BUFFER_SIZE];
-int16_t cpu_buffer[CPU_BUFFER_SIZE];
+PER_DEVICE int16_t lea_buffer[LEA_BUFFER_SIZE];
+PER_DEVICE int16_t cpu_buffer[CPU_BUFFER_SIZE];
+
+#if JAPARI
+PER_DEVICE int16_t input_buffer_with_footprints[INPUT_BUFFER_WITH_FOOTPRINTS_LEN];
+#endif
+
+void reset_op_utils_vm(void) {
+    memset(lea_buffer, 0, sizeof(lea_buffer));
+    memset(cpu_buffer, 0, sizeof(cpu_buffer));
+#if JAPARI
+    memset(input_buffer_with_footprints, 0, sizeof(input_buffer_with_footprints));
+#endif
+}
 
 #if HAWAII
-static int16_t non_recorded_jobs = 0;
-void hawaii_record_footprints(Model* model, uint16_t vector_len) {
+/* Jobs are recorded together once there are enough of them for the interval
+ * of the layer (see adapt_hawaii_footprint_interval). Recorded jobs should be
+ * written to NVM already, and jobs after a footprint may run again after power
+ * failures. Such jobs should not depend on values written by later jobs. */
+void hawaii_record_footprints(InferenceContext *ctx, uint16_t vector_len) {
+    int16_t& non_recorded_jobs = ctx->non_recorded_jobs;
     non_recorded_jobs += vector_len;
-    for (; non_recorded_jobs >= BATCH_SIZE; non_recorded_jobs -= BATCH_SIZE) {
-        write_hawaii_layer_footprint(model->layer_idx, BATCH_SIZE);
+    if (non_recorded_jobs >= hawaii_footprint_interval(ctx, ctx->model_vm.layer_idx)) {
+        hawaii_flush_footprints(ctx);
+    }
+}
+
+void hawaii_flush_footprints(InferenceContext *ctx) {
+    int16_t& non_recorded_jobs = ctx->non_recorded_jobs;
+    int16_t n_jobs = non_recorded_jobs / BATCH_SIZE * BATCH_SIZE;
+    if (n_jobs) {
+        write_hawaii_layer_footprint(ctx, ctx->model_vm.layer_idx, n_jobs);
+        non_recorded_jobs -= n_jobs;
     }
 }
 #endif
 
 #if JAPARI
-int16_t input_buffer_with_footprints[INPUT_BUFFER_WITH_FOOTPRINTS_LEN];
-
 int16_t extend_for_footprints(int16_t val, uint8_t force_aligned) {
     if (force_aligned) {
         val = upper_gauss(val, BATCH_SIZE) * BATCH_SIZE;
@@ -39,7 +62,17 @@ uint8_t has_footprints(const ParameterInfo *cur_param) {
 #endif
 
 int16_t upper_gauss(int16_t a, int16_t b) {
-    return (a + b - 1) / b;
+    return counted_div(a + b - 1, b);
+}
+
+uint16_t divmod_small(uint32_t *n, uint16_t d) {
+    MY_ASSERT(d);
+    uint16_t quotient = 0;
+    while (*n >= d) {
+        *n -= d;
+        quotient++;
+    }
+    return quotient;
 }
 
 #if INDIRECT_RECOVERY
@@ -70,7 +103,7 @@ void float_to_scale_params(int16_t *scaleFract, uint8_t *shift, float scale) {
     *scaleFract = scale * 32768;
 }
 
-void iterate_chunks(Model *model, const ParameterInfo *param, uint16_t start_offset, uint16_t len, const ChunkHandler& chunk_handler, void* params) {
+void iterate_chunks(InferenceContext *ctx, const ParameterInfo *param, uint16_t start_offset, uint16_t len, const ChunkHandler& chunk_handler, void* params) {
     uint16_t params_len;
     if (!len) {
         params_len = param->params_len / sizeof(int16_t);
@@ -83,12 +116,12 @@ void iterate_chunks(Model *model, const ParameterInfo *param, uint16_t start_off
     uint16_t cur_chunk_len;
 #if INDIRECT_RECOVERY
     start_cpu_counter();
-    dump_turning_points_debug(model, param);
+    dump_turning_points_debug(ctx, param);
 
-    state_bit = get_state_bit(model, param->slot);
+    state_bit = get_state_bit(ctx, param->slot);
     uint8_t turning_point_idx = 0;
     uint16_t next_turning_point = INVALID_TURNING_POINT;
-    SlotInfo *cur_slot_info = get_slot_info(model, param->slot);
+    SlotInfo *cur_slot_info = get_slot_info(ctx, param->slot);
     uint16_t n_turning_points = cur_slot_info ? cur_slot_info->n_turning_points : 0;
     uint8_t turning_point_found = 0;
     while (turning_point_idx < n_turning_points) {
@@ -136,13 +169,13 @@ void iterate_chunks(Model *model, const ParameterInfo *param, uint16_t start_off
 }
 
 #if INDIRECT_RECOVERY
-void find_initial_state_bit(int16_t* p_offset, uint8_t* p_turning_point_idx, uint16_t* p_next_turning_point, SlotInfo** p_slot_info, uint32_t initial_value_idx, Model* model, const ParameterInfo* param) {
+void find_initial_state_bit(int16_t* p_offset, uint8_t* p_turning_point_idx, uint16_t* p_next_turning_point, SlotInfo** p_slot_info, uint32_t initial_value_idx, InferenceContext *ctx, const ParameterInfo* param) {
     start_cpu_counter();
     my_printf_debug("Initialize next_turning_point from output offset %d" NEWLINE, initial_value_idx);
-    *p_offset = get_state_bit(model, param->slot)*0x4000;
+    *p_offset = get_state_bit(ctx, param->slot)*0x4000;
     *p_turning_point_idx = 0;
     *p_next_turning_point = INVALID_TURNING_POINT;
-    *p_slot_info = get_slot_info(model, param->slot);
+    *p_slot_info = get_slot_info(ctx, param->slot);
     uint8_t next_turning_point_found = 0;
     if (!(*p_slot_info)) {
         return;
@@ -189,7 +222,7 @@ exit:
 }
 #endif
 
-void fix_first_unfinished_value_offset(const Model* model, uint32_t* p_first_unfinished_value_offset) {
+void fix_first_unfinished_value_offset(InferenceContext *ctx, uint32_t* p_first_unfinished_value_offset) {
 #if !JAPARI
     if (BATCH_SIZE >= 2) {
         return;
@@ -198,7 +231,7 @@ void fix_first_unfinished_value_offset(const Model* model, uint32_t* p_first_unf
     if (*p_first_unfinished_value_offset % 2) {
         (*p_first_unfinished_value_offset)--;
 #if HAWAII
-        write_hawaii_layer_footprint(model->layer_idx, -1); // discard last job
+        write_hawaii_layer_footprint(ctx, ctx->model_vm.layer_idx, -1); // discard last job
 #endif
     }
 #endif
@@ -262,16 +295,17 @@ void my_accumulate_to_vm(ParameterInfo *param, uint16_t offset_in_word, const vo
 }
 #endif // STABLE_POWER
 
-void preserve_output(Model *model, const Node *node, ParameterInfo *output, uint16_t filter_idx, int16_t output_w, int16_t output_h, int16_t tile_h_offset, int16_t tile_w_offset, int8_t buffer_id) {
+void preserve_output(InferenceContext *ctx, const Node *node, ParameterInfo *output, uint16_t filter_idx, int16_t output_w, int16_t output_h, int16_t tile_h_offset, int16_t tile_w_offset, int8_t buffer_id) {
     my_printf_debug("Preserve cached psum to NVM" NEWLINE);
 #ifdef OpConv
     if(node->op_type == OpConv) {
         // is conv op
-        uint16_t CHANNEL = output->dims[1],
+        const ConvTaskParams *conv_params = &ctx->conv_params;
+        uint16_t CHANNEL = conv_params->OUTPUT_CHANNEL_STRIDE,
                  OUTPUT_H = output->dims[2],
                  OUTPUT_W = output->dims[3];
-        uint16_t output_tile_w = MIN_VAL(node->flags.extra.conv.output_tile_w, OUTPUT_W - (output_w - tile_w_offset));
-        uint16_t output_tile_h = MIN_VAL(node->flags.extra.conv.output_tile_h, OUTPUT_H - (output_h - tile_h_offset));
+        uint16_t output_tile_w = MIN_VAL(conv_params->output_tile_w, OUTPUT_W - (output_w - tile_w_offset));
+        uint16_t output_tile_h = MIN_VAL(conv_params->output_tile_h, OUTPUT_H - (output_h - tile_h_offset));
         uint16_t output_tile_c = node->flags.extra.conv.output_tile_c;
         uint16_t output_len = CHANNEL * OUTPUT_W * OUTPUT_H;
         MY_ASSERT(output_w + output_tile_w - tile_w_offset <= OUTPUT_W);
@@ -295,7 +329,7 @@ void preserve_output(Model *model, const Node *node, ParameterInfo *output, uint
 #if ENABLE_COUNTERS
                 start_cpu_counter();
 #endif
-                my_memcpy_to_param(output, dst, src, real_chunk_len * sizeof(int16_t), 0);
+                my_memcpy_to_param(ctx, output, dst, src, real_chunk_len * sizeof(int16_t), 0);
 #if ENABLE_COUNTERS
                 stop_cpu_counter(&Counters::dma_write_ofm);
 #endif
@@ -307,7 +341,7 @@ void preserve_output(Model *model, const Node *node, ParameterInfo *output, uint
 #if ENABLE_COUNTERS
                 start_cpu_counter();
 #endif
-                hawaii_record_footprints(model, real_chunk_len);
+                hawaii_record_footprints(ctx, real_chunk_len);
 #if ENABLE_COUNTERS
                 stop_cpu_counter(&Counters::dma_write_fp);
 #endif
@@ -329,7 +363,7 @@ void preserve_output(Model *model, const Node *node, ParameterInfo *output, uint
 #if ENABLE_COUNTERS
         start_cpu_counter();
 #endif
-        my_memcpy_to_param(output, total_offset, cpu_buffer, output_len * sizeof(int16_t), 0);
+        my_memcpy_to_param(ctx, output, total_offset, cpu_buffer, output_len * sizeof(int16_t), 0);
 #if ENABLE_COUNTERS
         stop_cpu_counter(&Counters::dma_write_ofm);
 #endif
@@ -337,7 +371,7 @@ void preserve_output(Model *model, const Node *node, ParameterInfo *output, uint
 #if ENABLE_COUNTERS
         start_cpu_counter();
 #endif
-        my_memcpy_to_param(output, total_offset, lea_buffer, output_len * sizeof(int16_t), 0);
+        my_memcpy_to_param(ctx, output, total_offset, lea_buffer, output_len * sizeof(int16_t), 0);
 #if ENABLE_COUNTERS
         stop_cpu_counter(&Counters::dma_write_ofm);
 #endif
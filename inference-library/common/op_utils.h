@@ -4,8 +4,9 @@
 #include <cstring>
 #include "data.h"
 #include "platform.h"
+#include "inference_context.h"
 
-struct Model;
+struct InferenceContext;
 struct ParameterInfo;
 struct SlotInfo;
 struct ValueInfo;
@@ -13,27 +14,33 @@ struct Scale;
 
 typedef void (*ChunkHandler)(uint32_t output_offset, uint16_t output_chunk_len, int8_t old_output_state_bit, void* params);
 
-extern int16_t lea_buffer[LEA_BUFFER_SIZE];
-extern int16_t cpu_buffer[CPU_BUFFER_SIZE];
+extern PER_DEVICE int16_t lea_buffer[LEA_BUFFER_SIZE];
+extern PER_DEVICE int16_t cpu_buffer[CPU_BUFFER_SIZE];
 #if STABLE_POWER
 void init_cpu_buffer();
 void my_accumulate_to_vm(ParameterInfo *param, uint16_t offset_in_word, const void *src, size_t n, uint16_t timer_delay);
 #endif
-void preserve_output(Model *model, const Node *node, ParameterInfo *output, uint16_t filter_idx, int16_t output_w, int16_t output_h, int16_t tile_h_offset, int16_t tile_w_offset, int8_t buffer_id);
+// Forget scratch buffers, as if power failed (see reset_vm())
+void reset_op_utils_vm(void);
+void preserve_output(InferenceContext *ctx, const Node *node, ParameterInfo *output, uint16_t filter_idx, int16_t output_w, int16_t output_h, int16_t tile_h_offset, int16_t tile_w_offset, int8_t buffer_id);
 int16_t upper_gauss(int16_t a, int16_t b);
+// Returns *n / d and leaves *n % d in *n. Repeated subtraction is cheaper than
+// software division on MSP430 (no hardware divider) when quotients are small.
+uint16_t divmod_small(uint32_t *n, uint16_t d);
 void float_to_scale_params(int16_t *scaleFract, uint8_t *shift, const Scale& scale);
 void float_to_scale_params(int16_t *scaleFract, uint8_t *shift, float scale);
-void iterate_chunks(Model *model, const ParameterInfo *param, uint16_t start_offset, uint16_t len, const ChunkHandler& callback, void* params);
+void iterate_chunks(InferenceContext *ctx, const ParameterInfo *param, uint16_t start_offset, uint16_t len, const ChunkHandler& callback, void* params);
 void determine_tile_c(ParameterInfo *param, const ParameterInfo* input, const ParameterInfo *filter = nullptr);
 
 #if HAWAII
-void hawaii_record_footprints(Model* model, uint16_t vector_len);
+void hawaii_record_footprints(InferenceContext *ctx, uint16_t vector_len);
+void hawaii_flush_footprints(InferenceContext *ctx);
 #endif
 
 #if JAPARI
 #define INPUT_BUFFER_WITH_FOOTPRINTS_LEN 256
 
-extern int16_t input_buffer_with_footprints[INPUT_BUFFER_WITH_FOOTPRINTS_LEN];
+extern PER_DEVICE int16_t input_buffer_with_footprints[INPUT_BUFFER_WITH_FOOTPRINTS_LEN];
 int16_t extend_for_footprints(int16_t val, uint8_t force_aligned = 0);
 uint8_t has_footprints(const ParameterInfo* cur_param);
 #endif
@@ -46,11 +53,11 @@ struct OutputChunkHandlerParams {
     uint16_t buffer_offset;
 };
 void OutputChunkHandler(uint32_t offset, uint16_t real_chunk_len, int8_t state_bit, void* _params);
-void find_initial_state_bit(int16_t* p_offset, uint8_t* p_turning_point_idx, uint16_t* p_next_turning_point, SlotInfo** p_slot_info, uint32_t initial_value_idx, Model* model, const ParameterInfo* param);
+void find_initial_state_bit(int16_t* p_offset, uint8_t* p_turning_point_idx, uint16_t* p_next_turning_point, SlotInfo** p_slot_info, uint32_t initial_value_idx, InferenceContext *ctx, const ParameterInfo* param);
 void check_next_turning_point(int16_t& offset, uint8_t& turning_point_idx, uint16_t& next_turning_point, SlotInfo* slot_info, uint16_t value_idx);
 #endif
 
-void fix_first_unfinished_value_offset(const Model* model, uint32_t* p_first_unfinished_value_offset);
+void fix_first_unfinished_value_offset(InferenceContext *ctx, uint32_t* p_first_unfinished_value_offset);
 void make_buffer_aligned(int16_t** p_buffer);
 float q15_to_float(int16_t val, const ValueInfo& val_info, uint8_t* p_use_prefix = nullptr, bool has_state = true);
 void my_offset_q15_batched(const int16_t *pSrc, int16_t offset, int16_t *pDst, uint32_t blockSize, bool enforce_states = false);
@@ -5,7 +5,12 @@
 #include "my_debug.h"
 #include "platform.h"
 #include "platform-private.h"
+#include "inference_context.h"
 #include "data.h"
+#include <chrono>
+#include <cmath>
+#include <csetjmp>
+#include <cinttypes>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
@@ -18,21 +23,93 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/ptrace.h>
+#include <algorithm>
 #include <fstream>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 #ifdef USE_PROTOBUF
 #include "model_output.pb.h"
 #endif
 
-/* data on NVM, made persistent via mmap() with a file */
-uint8_t *nvm;
+thread_local InferenceContext* cur_context;
+// The device simulated by the main thread. Its data on NVM is from nvm_backend, by default persistent via mmap() with a file
+static InferenceContext main_context;
 static uint32_t shutdown_counter = UINT32_MAX;
-static uint64_t nvm_writes = 0;
+// per simulated device, see run_cnn_tests_in_parallel()
+static thread_local uint64_t nvm_writes = 0;
+// Part of nvm_writes to intermediate values. The rest are for progress states (footprints, model and so on)
+static thread_local uint64_t nvm_value_writes = 0;
 static std::ofstream out_file;
 
-uint32_t total_jobs = 0;
+/* For simulating power failures without restarting the process */
+static uint8_t in_process_power_cycles = 0;
+static jmp_buf boot_point;
+// powered off after this number of bytes are written to NVM in each power cycle
+static uint32_t power_cycle_period;
+static uint32_t power_failures = 0;
+// similar to --power-cycles-limit in run-intermittently.py
+#define POWER_CYCLES_LIMIT 100000
+
+/* For power failures based on energy budgets. Models and parameters are from pruning/pruning_utils/CostModel */
+#define CPU_CLOCK_MSP430 16000000
+// Costs of DMA and LEA are linear to the number of words. Energy in J and latency in CPU cycles.
+static const double E_DMA_READ_M = 2.7e-08, E_DMA_READ_B = 2.0e-07;
+static const double E_DMA_WRITE_M = 2.6815e-08, E_DMA_WRITE_B = 1.9336e-07;
+static const double E_LEA_VECMAC_M = 5.27308646249e-10, E_LEA_VECMAC_B = 2.04412689725e-07;
+static const double L_DMA_READ_M = 64.0, L_DMA_READ_B = 424.0;
+static const double L_DMA_WRITE_M = 64.00082974729904, L_DMA_WRITE_B = 422.22773129921234;
+static const double L_LEA_VECMAC_M = 1.5, L_LEA_VECMAC_B = 616.0;
+// Indexed with CpuOp
+static const double E_CPU_OPS[] = { 3.935538461538471e-09, 1.9253346153846146e-08, 4.373834615384616e-08, 4.228153846153846e-09 };
+static const double L_CPU_OPS[] = { 12, 44, 160, 14 };
+// reboot costs (obtained via oscilloscope)
+static const double E_REBOOT = 0.00007788;
+static const double L_REBOOT = 0.07 * CPU_CLOCK_MSP430;
+
+struct Capacitor {
+    double capacitance;
+    // equivalent resistance of the energy harvesting unit
+    double resistance;
+    // supply voltage charging the capacitor
+    double v_supply;
+    // the system starts when the capacitor voltage reaches v_on, and shuts down at v_off
+    double v_on;
+    double v_off;
+};
+// defaults of cal_cap_recharge_time_custom() in capacitor.py
+static Capacitor capacitor = { 0.0001, 1000, 3, 2.8, 2.4 };
+static uint8_t energy_budget_enabled = 0;
+// Costs are always recorded, while the capacitor is drained only when this is set
+static uint8_t energy_budget_armed = 0;
+// energy left above v_off
+static double capacitor_energy;
+
+struct SimulatedCosts {
+    double energy;
+    // in seconds
+    double active_time;
+    double recharge_time;
+};
+static thread_local SimulatedCosts simulated_costs;
+
+// Harvested power in W, one sample per POWER_TRACE_INTERVAL seconds. Replayed cyclically.
+#define POWER_TRACE_INTERVAL 0.001
+static std::vector<double> power_trace;
+
+// Simulated time and power failures when each sample finishes, indexed by sample_idx
+struct InferenceRecord {
+    double finish_time;
+    uint32_t power_failures;
+};
+static std::vector<InferenceRecord> inference_records;
+
+[[ noreturn ]] static void exit_with_status(uint8_t exit_code);
+
+PER_DEVICE uint32_t total_jobs = 0;
 #if ENABLE_COUNTERS
-Counters *counters_data;
+PER_DEVICE Counters *counters_data;
 #endif
 
 #ifdef USE_PROTOBUF
@@ -62,15 +139,526 @@ static void* map_file(const char* path, size_t len, bool read_only) {
     return ptr;
 }
 
+/* Backends of the NVM of the main device, selected with -n. Devices from -j
+ * always store data in plain memory, while their transfers still go through
+ * the selected backend. */
+struct NvmBackend {
+    const char* name;
+    uint8_t* (*open)(bool read_only);
+    // Parses settings after the name in -n. Can be NULL for backends without settings.
+    int (*parse_settings)(const char* settings);
+    // DMA transfers between VM and NVM of ctx
+    void (*read)(InferenceContext *ctx, void *vm_buffer, uint32_t nvm_offset, size_t n);
+    void (*write)(InferenceContext *ctx, const void *vm_buffer, uint32_t nvm_offset, size_t n);
+    // Adds statistics of the device on the calling thread to the reported ones. Can be NULL.
+    void (*collect_stats)(void);
+    void (*report)(void);
+};
+
+// The external FRAM on the bus, with the same commands as Tools/ext_fram/extfram.c
+struct SpiFram {
+    uint32_t clock; // in Hz
+    // Widths of opcodes, addresses and data, as in 1-1-1/2-2-2/4-4-4 modes of qspiFRAM
+    uint8_t lines;
+    // Between the address and data of a READ command (Memory_Latency of qspiFRAM)
+    uint8_t dummy_cycles;
+};
+// Defaults to extfram.c, where SPI runs at SMCLK/4 with the 16MHz CPU
+static SpiFram spi_fram = { CPU_CLOCK_MSP430 / 4, 1, 0 };
+
+struct SpiFramStats {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t data_bytes;
+    // SPI clock cycles for everything and for opcodes, addresses and dummy cycles only
+    uint64_t clocks;
+    uint64_t overhead_clocks;
+};
+// per simulated device, added to spi_fram_total_stats when the device finishes
+static thread_local SpiFramStats spi_fram_stats;
+static SpiFramStats spi_fram_total_stats;
+static std::mutex spi_fram_total_stats_mutex;
+
+static void my_memcpy_ex(const InferenceContext *ctx, void* dest, const void* src, size_t n, uint8_t write_to_nvm);
+
+static uint8_t* open_file_nvm(bool read_only) {
+    return reinterpret_cast<uint8_t*>(map_file("nvm.bin", NVM_SIZE, read_only));
+}
+
+// Nothing survives process restarts, so this is for runs with -i or a fresh start each time
+static uint8_t* open_memory_nvm(bool) {
+    void* ptr = mmap(NULL, NVM_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        perror("mmap() failed");
+        return NULL;
+    }
+    return reinterpret_cast<uint8_t*>(ptr);
+}
+
+// For NVM mapped into the address space, either from a file or anonymous
+static void read_mapped_nvm(InferenceContext *ctx, void *vm_buffer, uint32_t nvm_offset, size_t n) {
+    my_memcpy_ex(ctx, vm_buffer, ctx->nvm + nvm_offset, n, 0);
+}
+
+static void write_mapped_nvm(InferenceContext *ctx, const void *vm_buffer, uint32_t nvm_offset, size_t n) {
+    my_memcpy_ex(ctx, ctx->nvm + nvm_offset, vm_buffer, n, 1);
+}
+
+static int parse_spi_fram_settings(const char* settings) {
+    // Fields not specified keep default values
+    unsigned int clock = spi_fram.clock, lines = spi_fram.lines, dummy_cycles = spi_fram.dummy_cycles;
+    sscanf(settings, ",%u,%u,%u", &clock, &lines, &dummy_cycles);
+    if (!clock || (lines != 1 && lines != 2 && lines != 4) || dummy_cycles > UINT8_MAX) {
+        my_printf("Invalid SPI FRAM settings: clock=%u, lines=%u, dummy cycles=%u" NEWLINE, clock, lines, dummy_cycles);
+        return 1;
+    }
+    spi_fram = { clock, static_cast<uint8_t>(lines), static_cast<uint8_t>(dummy_cycles) };
+    return 0;
+}
+
+/* Bus costs only, for comparing access patterns. Energy and latency of
+ * transfers are still from the DMA models above, as power failures depend on
+ * them and counting both would charge twice. */
+static void spi_fram_command(const InferenceContext *ctx, size_t n, uint8_t is_write) {
+    if (!ctx->dma_counter_enabled) {
+        return;
+    }
+    const uint8_t lines = spi_fram.lines;
+    // 8-bit opcode and 24-bit address
+    uint64_t overhead_clocks = (8 + 24) / lines;
+    if (is_write) {
+        // WREN is a separate command before each WRITE
+        overhead_clocks += 8 / lines;
+        spi_fram_stats.writes++;
+    } else {
+        overhead_clocks += spi_fram.dummy_cycles;
+        spi_fram_stats.reads++;
+    }
+    spi_fram_stats.data_bytes += n;
+    spi_fram_stats.overhead_clocks += overhead_clocks;
+    spi_fram_stats.clocks += overhead_clocks + (n * 8 + lines - 1) / lines;
+}
+
+// Data of the FRAM is kept in memory mapped as for the memory backend
+static void read_spi_fram(InferenceContext *ctx, void *vm_buffer, uint32_t nvm_offset, size_t n) {
+    spi_fram_command(ctx, n, 0);
+    read_mapped_nvm(ctx, vm_buffer, nvm_offset, n);
+}
+
+static void write_spi_fram(InferenceContext *ctx, const void *vm_buffer, uint32_t nvm_offset, size_t n) {
+    spi_fram_command(ctx, n, 1);
+    write_mapped_nvm(ctx, vm_buffer, nvm_offset, n);
+}
+
+static void collect_spi_fram_stats(void) {
+    std::lock_guard<std::mutex> lock(spi_fram_total_stats_mutex);
+    spi_fram_total_stats.reads += spi_fram_stats.reads;
+    spi_fram_total_stats.writes += spi_fram_stats.writes;
+    spi_fram_total_stats.data_bytes += spi_fram_stats.data_bytes;
+    spi_fram_total_stats.clocks += spi_fram_stats.clocks;
+    spi_fram_total_stats.overhead_clocks += spi_fram_stats.overhead_clocks;
+    memset(&spi_fram_stats, 0, sizeof(SpiFramStats));
+}
+
+static void report_spi_fram(void) {
+    const SpiFramStats& stats = spi_fram_total_stats;
+    uint64_t n_commands = stats.reads + stats.writes;
+    if (!n_commands) {
+        return;
+    }
+    my_printf("SPI FRAM (%" PRIu32 "Hz, %d lines, %d dummy cycles): %" PRIu64 " reads, %" PRIu64 " writes, %" PRIu64 " bytes, "
+              "bus time %.3fs, command/address overhead %.2f%%, %.1f bytes per command" NEWLINE,
+              spi_fram.clock, spi_fram.lines, spi_fram.dummy_cycles, stats.reads, stats.writes, stats.data_bytes,
+              1.0 * stats.clocks / spi_fram.clock, 100.0 * stats.overhead_clocks / stats.clocks,
+              1.0 * stats.data_bytes / n_commands);
+}
+
+static const NvmBackend nvm_backends[] = {
+    { "file", open_file_nvm, NULL, read_mapped_nvm, write_mapped_nvm, NULL, NULL },
+    { "memory", open_memory_nvm, NULL, read_mapped_nvm, write_mapped_nvm, NULL, NULL },
+    { "spi", open_memory_nvm, parse_spi_fram_settings, read_spi_fram, write_spi_fram, collect_spi_fram_stats, report_spi_fram },
+};
+static const NvmBackend* nvm_backend = &nvm_backends[0];
+
+static int parse_nvm_backend(const char* spec) {
+    size_t name_len = strcspn(spec, ",");
+    const NvmBackend* found = NULL;
+    for (const NvmBackend& backend : nvm_backends) {
+        if (strlen(backend.name) == name_len && !strncmp(spec, backend.name, name_len)) {
+            found = &backend;
+        }
+    }
+    if (!found) {
+        my_printf("Unknown NVM backend %s" NEWLINE, spec);
+        return 1;
+    }
+    nvm_backend = found;
+    if (nvm_backend->parse_settings) {
+        return nvm_backend->parse_settings(spec + name_len);
+    }
+    if (spec[name_len]) {
+        my_printf("NVM backend %s takes no settings" NEWLINE, nvm_backend->name);
+        return 1;
+    }
+    return 0;
+}
+
+static void collect_nvm_backend_stats(void) {
+    if (nvm_backend->collect_stats) {
+        nvm_backend->collect_stats();
+    }
+}
+
+// Statistics of devices on other threads should be collected before
+static void report_nvm_backend(void) {
+    collect_nvm_backend_stats();
+    if (nvm_backend->report) {
+        nvm_backend->report();
+    }
+}
+
+static double cap_energy(double v_top, double v_bottom) {
+    return 0.5 * capacitor.capacitance * (v_top * v_top - v_bottom * v_bottom);
+}
+
+// Time for charging the capacitor from v_off to v_on. See cap_recharge_time() in capacitor.py
+static double cap_recharge_time(void) {
+    return -1 * capacitor.resistance * capacitor.capacitance *
+        log((capacitor.v_on - capacitor.v_supply) / (capacitor.v_off - capacitor.v_supply));
+}
+
+static double simulated_time(void) {
+    return simulated_costs.active_time + simulated_costs.recharge_time;
+}
+
+// Energy harvested in [start, start + duration), based on the power trace
+static double harvested_energy(double start, double duration) {
+    double energy = 0, cur = start, end = start + duration;
+    uint64_t slot = static_cast<uint64_t>(start / POWER_TRACE_INTERVAL);
+    while (cur < end) {
+        double slot_end = MIN_VAL((slot + 1) * POWER_TRACE_INTERVAL, end);
+        energy += power_trace[slot % power_trace.size()] * (slot_end - cur);
+        cur = slot_end;
+        slot++;
+    }
+    return energy;
+}
+
+// Time for the harvested power in the trace to charge the capacitor up to v_on
+static double trace_recharge_time(void) {
+    double needed = cap_energy(capacitor.v_on, capacitor.v_off) - MAX_VAL(capacitor_energy, 0);
+    double start = simulated_time(), cur = start;
+    uint64_t slot = static_cast<uint64_t>(start / POWER_TRACE_INTERVAL);
+    while (needed > 0) {
+        double power = power_trace[slot % power_trace.size()];
+        double slot_end = (slot + 1) * POWER_TRACE_INTERVAL;
+        double energy = power * (slot_end - cur);
+        if (energy >= needed) {
+            cur += needed / power;
+            break;
+        }
+        needed -= energy;
+        cur = slot_end;
+        slot++;
+    }
+    return cur - start;
+}
+
+[[ noreturn ]] static void power_failure(void) {
+    if (energy_budget_enabled) {
+        simulated_costs.recharge_time += power_trace.empty() ? cap_recharge_time() : trace_recharge_time();
+    }
+    if (in_process_power_cycles) {
+        // simulated power failure - reboot
+        longjmp(boot_point, 1);
+    }
+    exit_with_status(2);
+}
+
+static void record_costs(double energy, double cycles) {
+    simulated_costs.energy += energy;
+    simulated_costs.active_time += cycles / CPU_CLOCK_MSP430;
+}
+
+static void consume_energy(const InferenceContext *ctx, double energy, double cycles) {
+    // Nothing to charge for during first_run(), which simulates flashing
+    if (!ctx->dma_counter_enabled) {
+        return;
+    }
+    if (energy_budget_armed && !power_trace.empty()) {
+        // harvesting continues while the system is running
+        capacitor_energy += harvested_energy(simulated_time(), cycles / CPU_CLOCK_MSP430);
+        capacitor_energy = MIN_VAL(capacitor_energy, cap_energy(capacitor.v_supply, capacitor.v_off));
+    }
+    record_costs(energy, cycles);
+    if (energy_budget_armed) {
+        capacitor_energy -= energy;
+        if (capacitor_energy < 0) {
+            power_failure();
+        }
+    }
+}
+
+static void consume_dma_read_energy(const InferenceContext *ctx, size_t n) {
+    uint32_t n_words = (n + 1) / 2;
+    consume_energy(ctx, E_DMA_READ_M * n_words + E_DMA_READ_B, L_DMA_READ_M * n_words + L_DMA_READ_B);
+}
+
+static void consume_dma_write_energy(const InferenceContext *ctx, size_t n) {
+    if (!ctx->dma_counter_enabled) {
+        return;
+    }
+    uint32_t n_words = (n + 1) / 2;
+    double energy = E_DMA_WRITE_M * n_words + E_DMA_WRITE_B;
+    if (!energy_budget_armed || energy <= capacitor_energy) {
+        consume_energy(ctx, energy, L_DMA_WRITE_M * n_words + L_DMA_WRITE_B);
+        return;
+    }
+    // The capacitor is drained during this write. Let my_memcpy_ex() tear the write after the
+    // words that can still be afforded.
+    double affordable_words = floor((capacitor_energy - E_DMA_WRITE_B) / E_DMA_WRITE_M);
+    uint32_t affordable_bytes = (affordable_words > 0) ? 2 * static_cast<uint32_t>(affordable_words) : 0;
+    record_costs(capacitor_energy, L_DMA_WRITE_M * affordable_bytes / 2 + L_DMA_WRITE_B);
+    capacitor_energy = 0;
+    shutdown_counter = MIN_VAL(shutdown_counter, affordable_bytes);
+}
+
+void consume_lea_energy(uint32_t n_invocations, uint32_t vector_len) {
+    consume_energy(get_context(), n_invocations * (E_LEA_VECMAC_M * vector_len + E_LEA_VECMAC_B),
+                   n_invocations * (L_LEA_VECMAC_M * vector_len + L_LEA_VECMAC_B));
+}
+
+void consume_cpu_energy(CpuOp op, uint32_t n_ops) {
+    uint8_t op_idx = static_cast<uint8_t>(op);
+    consume_energy(get_context(), n_ops * E_CPU_OPS[op_idx], n_ops * L_CPU_OPS[op_idx]);
+}
+
+static void power_on(const InferenceContext *ctx) {
+    capacitor_energy = cap_energy(capacitor.v_on, capacitor.v_off);
+    consume_energy(ctx, E_REBOOT, L_REBOOT);
+}
+
+static int parse_capacitor(const char* spec) {
+    // Fields not specified keep default values
+    sscanf(spec, "%lf,%lf,%lf,%lf,%lf", &capacitor.capacitance, &capacitor.resistance,
+           &capacitor.v_supply, &capacitor.v_on, &capacitor.v_off);
+    if (!(capacitor.v_supply > capacitor.v_on && capacitor.v_on > capacitor.v_off && capacitor.v_off > 0)) {
+        my_printf("Invalid voltages: Vsup=%f, Von=%f, Voff=%f" NEWLINE, capacitor.v_supply, capacitor.v_on, capacitor.v_off);
+        return 1;
+    }
+    if (cap_energy(capacitor.v_on, capacitor.v_off) <= E_REBOOT) {
+        my_printf("The capacitor cannot provide enough energy for rebooting" NEWLINE);
+        return 1;
+    }
+    return 0;
+}
+
+static int load_power_trace(const char* path) {
+    std::ifstream trace_file(path);
+    double power, total_power = 0;
+    while (trace_file >> power) {
+        power_trace.push_back(power);
+        total_power += power;
+    }
+    if (!trace_file.eof()) {
+        my_printf("Failed to parse power trace %s" NEWLINE, path);
+        return 1;
+    }
+    // Recharging never finishes otherwise
+    if (!(total_power > 0)) {
+        my_printf("No harvested power in trace %s" NEWLINE, path);
+        return 1;
+    }
+    return 0;
+}
+
+static void print_inference_stats(uint16_t n_samples) {
+    uint16_t n_records = MIN_VAL(n_samples, inference_records.size());
+    if (!n_records) {
+        return;
+    }
+    std::vector<double> latencies;
+    double last_finish_time = 0;
+    uint32_t last_power_failures = 0, max_power_cycles = 0;
+    for (uint16_t idx = 0; idx < n_records; idx++) {
+        const InferenceRecord& record = inference_records[idx];
+        latencies.push_back(record.finish_time - last_finish_time);
+        max_power_cycles = MAX_VAL(max_power_cycles, record.power_failures - last_power_failures + 1);
+        last_finish_time = record.finish_time;
+        last_power_failures = record.power_failures;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    // nearest-rank percentiles
+    double p50 = latencies[(n_records * 50 + 99) / 100 - 1], p99 = latencies[(n_records * 99 + 99) / 100 - 1];
+    my_printf("Per-inference latency: p50=%.3fs p99=%.3fs; power cycles per inference: avg=%.1f max=%" PRIu32 NEWLINE,
+              p50, p99, 1.0 * (last_power_failures + n_records) / n_records, max_power_cycles);
+}
+
+/* For evaluating the test set with several simulated devices in parallel */
+struct TestShard {
+    InferenceContext ctx;
+    std::vector<uint8_t> nvm;
+#if ENABLE_COUNTERS
+    std::vector<Counters> counters;
+#endif
+    TestProgress progress;
+    uint16_t end_sample;
+};
+
+static void run_test_shard(TestShard* shard) {
+    shard->nvm.resize(NVM_SIZE);
+    shard->ctx.nvm = shard->nvm.data();
+    set_context(&shard->ctx);
+    init_context(&shard->ctx);
+#if ENABLE_COUNTERS
+    shard->counters.resize(COUNTERS_LEN);
+    counters_data = shard->counters.data();
+#endif
+    // Each device starts from a freshly flashed NVM image, so results do not depend on other devices
+    first_run(&shard->ctx);
+    run_cnn_test_samples(&shard->ctx, shard->end_sample, &shard->progress);
+    collect_nvm_backend_stats();
+}
+
+static int run_cnn_tests_in_parallel(uint16_t n_samples, uint16_t n_workers) {
+    if (!n_samples) {
+        n_samples = PLAT_LABELS_DATA_LEN;
+    }
+    n_workers = MIN_VAL(n_workers, n_samples);
+
+    std::vector<TestShard> shards(n_workers);
+    std::vector<std::thread> workers;
+    for (uint16_t idx = 0; idx < n_workers; idx++) {
+        TestShard& shard = shards[idx];
+        // Contiguous ranges of samples, with sizes differing by at most one
+        shard.progress = { static_cast<uint16_t>(1u * n_samples * idx / n_workers), 0, 0 };
+        shard.end_sample = 1u * n_samples * (idx + 1) / n_workers;
+        workers.emplace_back(run_test_shard, &shard);
+    }
+
+    TestProgress progress = { n_samples, 0, 0 };
+    for (uint16_t idx = 0; idx < n_workers; idx++) {
+        workers[idx].join();
+        progress.correct += shards[idx].progress.correct;
+        progress.total += shards[idx].progress.total;
+    }
+#if ENABLE_COUNTERS
+    // Counters are reset when an inference starts, so a serial run leaves those of the last sample
+    memcpy(counters_data, shards.back().counters.data(), sizeof(Counters) * COUNTERS_LEN);
+#endif
+    int ret = report_test_results(&progress);
+    report_nvm_backend();
+    return ret;
+}
+
+static int run_cnn_tests_intermittently(InferenceContext *ctx, uint16_t n_samples) {
+    static TestProgress progress_continuous, progress;
+    static uint64_t nvm_writes_continuous, nvm_value_writes_continuous;
+    static SimulatedCosts costs_continuous;
+    static uint16_t last_next_sample;
+    static uint32_t last_power_failures;
+    static std::chrono::steady_clock::time_point start_time;
+    static int ret;
+
+    // A run with continuous power, as the reference for correctness and costs
+    first_run(ctx);
+    nvm_writes = nvm_value_writes = 0;
+    ret = run_cnn_tests(ctx, n_samples, &progress_continuous);
+    if (ret) {
+        return ret;
+    }
+    nvm_writes_continuous = nvm_writes;
+    nvm_value_writes_continuous = nvm_value_writes;
+    costs_continuous = simulated_costs;
+
+    first_run(ctx);
+    nvm_writes = nvm_value_writes = 0;
+    memset(&simulated_costs, 0, sizeof(SimulatedCosts));
+    memset(&spi_fram_stats, 0, sizeof(SpiFramStats));
+    inference_records.clear();
+    energy_budget_armed = energy_budget_enabled;
+    last_next_sample = 0;
+    last_power_failures = 0;
+    start_time = std::chrono::steady_clock::now();
+
+    // Local variables in this function are not reliable after longjmp(), and thus static ones are used above
+    if (setjmp(boot_point)) {
+        power_failures++;
+        if (progress.next_sample != last_next_sample) {
+            last_next_sample = progress.next_sample;
+            last_power_failures = power_failures;
+        } else if (power_failures - last_power_failures >= POWER_CYCLES_LIMIT) {
+            my_printf("The program does not run intermittently" NEWLINE);
+            return 3;
+        }
+    }
+    // Booting: everything in VM is gone
+    reset_vm(ctx);
+    shutdown_counter = power_cycle_period;
+    if (energy_budget_enabled) {
+        power_on(ctx);
+    }
+    load_model_from_nvm(ctx);
+    ret = run_cnn_tests(ctx, n_samples, &progress);
+    // no more power failures from now on
+    shutdown_counter = UINT32_MAX;
+    energy_budget_armed = 0;
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    my_printf("Power failures: %" PRIu32 ", elapsed: %.3fs, %.1f failures/s" NEWLINE,
+              power_failures, elapsed, power_failures / elapsed);
+    /* Only writes to intermediate values are compared for re-execution costs. Writes for progress states
+     * depend on footprint intervals, which are adapted to power cycles (see adapt_hawaii_footprint_interval),
+     * and thus differ between runs with and without power failures even without re-execution. */
+    int64_t reexecution_cost = static_cast<int64_t>(nvm_value_writes - nvm_value_writes_continuous);
+    my_printf("NVM writes: %" PRIu64 " (continuous power: %" PRIu64 ")" NEWLINE, nvm_writes, nvm_writes_continuous);
+    my_printf("  intermediate values: %" PRIu64 " (continuous power: %" PRIu64 "), re-execution cost: %" PRId64 " bytes (%.2f%%)" NEWLINE,
+              nvm_value_writes, nvm_value_writes_continuous, reexecution_cost, 100.0 * reexecution_cost / nvm_value_writes_continuous);
+    my_printf("  progress states: %" PRIu64 " (continuous power: %" PRIu64 ")" NEWLINE,
+              nvm_writes - nvm_value_writes, nvm_writes_continuous - nvm_value_writes_continuous);
+    double simulated_latency = simulated_costs.active_time + simulated_costs.recharge_time;
+    // Samples finished in this run, at least 1 so that an empty run does not divide by 0
+    uint16_t n_finished = MAX_VAL(progress.next_sample, 1);
+    my_printf("Simulated latency: %.3fs (active: %.3fs, recharging: %.3fs), %.3fs per inference; continuous power: %.3fs" NEWLINE,
+              simulated_latency, simulated_costs.active_time, simulated_costs.recharge_time,
+              simulated_latency / n_finished, costs_continuous.active_time);
+    my_printf("Simulated energy: %.6fJ (continuous power: %.6fJ)" NEWLINE, simulated_costs.energy, costs_continuous.energy);
+    print_inference_stats(progress.next_sample);
+    report_nvm_backend();
+    if (progress.correct != progress_continuous.correct || progress.total != progress_continuous.total) {
+        my_printf("Results differ from those with continuous power: correct=%" PRIu32 " total=%" PRIu32 NEWLINE,
+                  progress_continuous.correct, progress_continuous.total);
+        return 1;
+    }
+    return ret;
+}
+
 int main(int argc, char* argv[]) {
-    int ret = 0, opt_ch, button_pushed = 0, read_only = 0, n_samples = 0;
+    int ret = 0, opt_ch, button_pushed = 0, read_only = 0, n_samples = 0, n_workers = 0;
     Model *model;
 
-    while((opt_ch = getopt(argc, argv, "bfrc:s:")) != -1) {
+    while((opt_ch = getopt(argc, argv, "bfire:c:j:n:s:t:")) != -1) {
         switch (opt_ch) {
             case 'b':
                 button_pushed = 1;
                 break;
+            case 'i':
+                in_process_power_cycles = 1;
+                break;
+            case 'e':
+                if (parse_capacitor(optarg)) {
+                    return 1;
+                }
+                energy_budget_enabled = 1;
+                in_process_power_cycles = 1;
+                break;
+            case 't':
+                if (load_power_trace(optarg)) {
+                    return 1;
+                }
+                energy_budget_enabled = 1;
+                in_process_power_cycles = 1;
+                break;
             case 'r':
                 read_only = 1;
                 break;
@@ -80,6 +668,14 @@ int main(int argc, char* argv[]) {
             case 'c':
                 shutdown_counter = atol(optarg);
                 break;
+            case 'j':
+                n_workers = atoi(optarg);
+                break;
+            case 'n':
+                if (parse_nvm_backend(optarg)) {
+                    return 1;
+                }
+                break;
             case 's':
 #ifdef USE_PROTOBUF
                 out_file.open(optarg);
@@ -89,7 +685,7 @@ int main(int argc, char* argv[]) {
                 return 1;
 #endif
             default:
-                my_printf("Usage: %s [-r] [n_samples]" NEWLINE, argv[0]);
+                my_printf("Usage: %s [-r] [-i] [-c shutdown_counter] [-e C,R,Vsup,Von,Voff] [-t power_trace] [-j n_workers] [-n file|memory|spi[,clock,lines,dummy_cycles]] [n_samples]" NEWLINE, argv[0]);
                 return 1;
         }
     }
@@ -97,7 +693,9 @@ int main(int argc, char* argv[]) {
         n_samples = atoi(argv[optind]);
     }
 
-    nvm = reinterpret_cast<uint8_t*>(map_file("nvm.bin", NVM_SIZE, read_only));
+    set_context(&main_context);
+    init_context(&main_context);
+    main_context.nvm = nvm_backend->open(read_only);
 #if ENABLE_COUNTERS
     counters_data = reinterpret_cast<Counters*>(map_file("counters.bin", COUNTERS_LEN*sizeof(Counters), false));
 #endif
@@ -115,7 +713,26 @@ int main(int argc, char* argv[]) {
     }
 #endif
 
-    model = load_model_from_nvm();
+    if (n_workers > 0) {
+        // Power failures and saved outputs are states shared by all workers
+        if (in_process_power_cycles || shutdown_counter != UINT32_MAX || out_file.is_open()) {
+            my_printf("-j supports only continuous power without -s" NEWLINE);
+            return 1;
+        }
+        return run_cnn_tests_in_parallel(n_samples, n_workers);
+    }
+
+    if (in_process_power_cycles) {
+        if (shutdown_counter == UINT32_MAX && !energy_budget_enabled) {
+            my_printf("-i requires -c or -e to specify when power fails" NEWLINE);
+            return 1;
+        }
+        power_cycle_period = shutdown_counter;
+        shutdown_counter = UINT32_MAX;
+        return run_cnn_tests_intermittently(&main_context, n_samples);
+    }
+
+    model = load_model_from_nvm(&main_context);
 
     // emulating button_pushed - treating as a fresh run
     if (button_pushed) {
@@ -124,10 +741,11 @@ int main(int argc, char* argv[]) {
 
     if (!model->version) {
         // the first time
-        first_run();
+        first_run(&main_context);
     }
 
-    ret = run_cnn_tests(n_samples);
+    ret = run_cnn_tests(&main_context, n_samples);
+    report_nvm_backend();
 
     return ret;
 }
@@ -141,50 +759,60 @@ int main(int argc, char* argv[]) {
     exit(exit_code);
 }
 
-void my_memcpy_ex(void* dest, const void* src, size_t n, uint8_t write_to_nvm) {
-    if (!dma_counter_enabled) {
+static void my_memcpy_ex(const InferenceContext *ctx, void* dest, const void* src, size_t n, uint8_t write_to_nvm) {
+    if (!ctx->dma_counter_enabled) {
         memcpy(dest, src, n);
         return;
     }
 
-    // Not using memcpy here so that it is more likely that power fails during
-    // memcpy, which is the case for external FRAM
-    uint8_t *dest_u = reinterpret_cast<uint8_t*>(dest);
-    const uint8_t *src_u = reinterpret_cast<const uint8_t*>(src);
-    for (size_t idx = 0; idx < n; idx++) {
-        dest_u[idx] = src_u[idx];
-        if (write_to_nvm) {
-            shutdown_counter--;
-            if (!shutdown_counter) {
-                exit_with_status(2);
-            }
+    // UINT32_MAX indicates no scheduled power failures. Don't count down in that case, or long runs
+    // (ex: the whole CIFAR-10 test set) would hit a power failure after 4 GiB of NVM writes.
+    if (!write_to_nvm || shutdown_counter == UINT32_MAX || n < shutdown_counter) {
+        memcpy(dest, src, n);
+        if (write_to_nvm && shutdown_counter != UINT32_MAX) {
+            shutdown_counter -= n;
         }
+        return;
     }
+
+    // Power fails during this copy, which is the case for external FRAM. Write
+    // bytes up to the tear point, the same as copying byte by byte and checking
+    // the counter after each byte.
+    memcpy(dest, src, shutdown_counter);
+    shutdown_counter = 0;
+    power_failure();
 }
 
 void my_memcpy(void* dest, const void* src, size_t n) {
-    my_memcpy_ex(dest, src, n, 0);
+    const InferenceContext *ctx = get_context();
+    consume_dma_read_energy(ctx, n);
+    my_memcpy_ex(ctx, dest, src, n, 0);
 }
 
-void read_from_nvm(void *vm_buffer, uint32_t nvm_offset, size_t n) {
+void read_from_nvm(InferenceContext *ctx, void *vm_buffer, uint32_t nvm_offset, size_t n) {
 #if ENABLE_COUNTERS
     counters()->dma_invocations_r++;
     counters()->dma_bytes_r += n;
     my_printf_debug("Recorded DMA invocation with %ld bytes" NEWLINE, n);
 #endif
-    my_memcpy_ex(vm_buffer, nvm + nvm_offset, n, 0);
+    consume_dma_read_energy(ctx, n);
+    nvm_backend->read(ctx, vm_buffer, nvm_offset, n);
 }
 
-void write_to_nvm(const void *vm_buffer, uint32_t nvm_offset, size_t n, uint16_t timer_delay) {
+void write_to_nvm(InferenceContext *ctx, const void *vm_buffer, uint32_t nvm_offset, size_t n, uint16_t timer_delay) {
     check_nvm_write_address(nvm_offset, n);
 #if ENABLE_COUNTERS
     counters()->dma_invocations_w++;
     counters()->dma_bytes_w += n;
     my_printf_debug("Recorded DMA invocation with %ld bytes" NEWLINE, n);
 #endif
-    my_memcpy_ex(nvm + nvm_offset, vm_buffer, n, 1);
-    if (dma_counter_enabled) {
+    consume_dma_write_energy(ctx, n);
+    nvm_backend->write(ctx, vm_buffer, nvm_offset, n);
+    if (ctx->dma_counter_enabled) {
         nvm_writes += n;
+        if (nvm_offset < SAMPLES_OFFSET) {
+            nvm_value_writes += n;
+        }
     }
 }
 
@@ -192,11 +820,11 @@ uint64_t get_nvm_writes(void) {
     return nvm_writes;
 }
 
-void my_erase() {
-    memset(nvm, 0, NVM_SIZE);
+void my_erase(InferenceContext *ctx) {
+    memset(ctx->nvm, 0, NVM_SIZE);
 }
 
-void copy_samples_data(void) {
+void copy_samples_data(InferenceContext *ctx) {
     std::ifstream samples_file("samples.bin");
     const uint16_t samples_buflen = 1024;
     char samples_buffer[samples_buflen];
@@ -204,7 +832,7 @@ void copy_samples_data(void) {
     while (true) {
         samples_file.read(samples_buffer, samples_buflen);
         int16_t read_len = samples_file.gcount();
-        write_to_nvm(samples_buffer, samples_offset, read_len);
+        write_to_nvm(ctx, samples_buffer, samples_offset, read_len);
         samples_offset += read_len;
         my_printf_debug("Copied %d bytes of samples data" NEWLINE, read_len);
         if (read_len < samples_buflen) {
@@ -213,7 +841,17 @@ void copy_samples_data(void) {
     }
 }
 
-void notify_model_finished(void) {}
+void notify_model_finished(InferenceContext *ctx) {
+    if (!in_process_power_cycles) {
+        return;
+    }
+    // Called again if power fails before the finished model is committed, and the later one wins
+    uint16_t sample_idx = ctx->sample_idx;
+    if (inference_records.size() <= sample_idx) {
+        inference_records.resize(sample_idx + 1);
+    }
+    inference_records[sample_idx] = { simulated_time(), power_failures };
+}
 
 [[ noreturn ]] void ERROR_OCCURRED(void) {
     exit_with_status(1);
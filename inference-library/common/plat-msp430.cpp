@@ -12,6 +12,7 @@
 #include "cnn_common.h"
 #include "platform.h"
 #include "platform-private.h"
+#include "inference_context.h"
 #include "data.h"
 #include "my_debug.h"
 #include "Tools/myuart.h"
@@ -27,6 +28,8 @@ DATA_SECTION_NVM Counters _counters_data[COUNTERS_LEN];
 Counters *counters_data = _counters_data;
 #endif
 
+InferenceContext inference_context;
+
 #ifdef __MSP430__
 
 #define MY_DMA_CHANNEL DMA_CHANNEL_0
@@ -74,7 +77,7 @@ void my_memcpy(void* dest, const void* src, size_t n) {
 #endif
 }
 
-void read_from_nvm(void* vm_buffer, uint32_t nvm_offset, size_t n) {
+void read_from_nvm(InferenceContext *ctx, void* vm_buffer, uint32_t nvm_offset, size_t n) {
 #if ENABLE_COUNTERS
     counters()->dma_invocations_r++;
     counters()->dma_bytes_r += n;
@@ -85,7 +88,7 @@ void read_from_nvm(void* vm_buffer, uint32_t nvm_offset, size_t n) {
     SPI_READ(&addr, reinterpret_cast<uint8_t*>(vm_buffer), n);
 }
 
-void write_to_nvm(const void* vm_buffer, uint32_t nvm_offset, size_t n, uint16_t timer_delay) {
+void write_to_nvm(InferenceContext *ctx, const void* vm_buffer, uint32_t nvm_offset, size_t n, uint16_t timer_delay) {
     SPI_ADDR addr;
     addr.L = nvm_offset;
     check_nvm_write_address(nvm_offset, n);
@@ -105,12 +108,12 @@ uint64_t get_nvm_writes(void) {
     return 0;
 }
 
-void my_erase() {
+void my_erase(InferenceContext *ctx) {
     eraseFRAM2(0x00);
 }
 
-void copy_samples_data(void) {
-    write_to_nvm_segmented(samples_data, SAMPLES_OFFSET, SAMPLES_DATA_LEN);
+void copy_samples_data(InferenceContext *ctx) {
+    write_to_nvm_segmented(ctx, samples_data, SAMPLES_OFFSET, SAMPLES_DATA_LEN);
 }
 
 [[ noreturn ]] void ERROR_OCCURRED(void) {
@@ -156,19 +159,21 @@ void IntermittentCNNTest() {
         WDTCTL = 0;
     }
     uartinit();
-    Model* model = load_model_from_nvm();
+    init_context(&inference_context);
+    InferenceContext *ctx = &inference_context;
+    Model* model = load_model_from_nvm(ctx);
     if (!GPIO_getInputPinValue(GPIO_RESET_PORT, GPIO_RESET_PIN)) {
         my_printf(NEWLINE "run_counter = %d" NEWLINE, model->run_counter);
 
-        first_run();
+        first_run(ctx);
 
-        notify_model_finished();
+        notify_model_finished(ctx);
 
         // for energy profiling
         //while(GPIO_getInputPinValue(GPIO_ENERGY_PROFILE_PORT, GPIO_ENERGY_PROFILE_PIN));
 
         for (uint8_t idx = 0; idx < STABLE_POWER_ITERATIONS; idx++) {
-            run_cnn_tests(1);
+            run_cnn_tests(&inference_context, 1);
         }
 
         my_printf("Done testing run" NEWLINE);
@@ -177,7 +182,7 @@ void IntermittentCNNTest() {
     }
 
     while (1) {
-        run_cnn_tests(1);
+        run_cnn_tests(&inference_context, 1);
     }
 }
 
@@ -185,7 +190,7 @@ void button_pushed(uint16_t button1_status, uint16_t button2_status) {
     my_printf_debug("button1_status=%d button2_status=%d" NEWLINE, button1_status, button2_status);
 }
 
-void notify_model_finished(void) {
+void notify_model_finished(InferenceContext *ctx) {
     my_printf("." NEWLINE);
     GPIO_setOutputHighOnPin(GPIO_COUNTER_PORT, GPIO_COUNTER_PIN);
     //my_printf("%d" NEWLINE, GPIO_getInputPinValue(GPIO_COUNTER_PORT, GPIO_COUNTER_PIN));
@@ -193,7 +198,7 @@ void notify_model_finished(void) {
     GPIO_setOutputLowOnPin(GPIO_COUNTER_PORT, GPIO_COUNTER_PIN);
 }
 
-void notify_layer_finished(void) {
+void notify_layer_finished(InferenceContext *ctx) {
     my_printf("L" NEWLINE);
     GPIO_setOutputHighOnPin(GPIO_LAYER_COUNTER_PORT, GPIO_LAYER_COUNTER_PIN);
     our_delay_cycles(5E-3 * getFrequency(FreqLevel));
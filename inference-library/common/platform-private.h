@@ -3,25 +3,31 @@
 #include <cstdint>
 #include <cstdlib>
 
+struct InferenceContext;
+
 /* offsets for data on NVM */
 
 // growing up (like heap). Not starting from zero as first few 16 bytes are for testing (see testSPI() function)
 #define INTERMEDIATE_VALUES_OFFSET 256
-#define SAMPLES_OFFSET (INTERMEDIATE_VALUES_OFFSET + NUM_SLOTS * INTERMEDIATE_VALUES_SIZE)
+#define SAMPLES_OFFSET (INTERMEDIATE_VALUES_OFFSET + INTERMEDIATE_VALUES_ARENA_SIZE)
 
 // growing down (like stack)
 #define FIRST_RUN_OFFSET (NVM_SIZE - 2)
 #define MODEL_OFFSET (FIRST_RUN_OFFSET - 2 * MODEL_DATA_LEN)
 #define INTERMEDIATE_PARAMETERS_INFO_OFFSET (MODEL_OFFSET - INTERMEDIATE_PARAMETERS_INFO_DATA_LEN)
 #define NODES_OFFSET (INTERMEDIATE_PARAMETERS_INFO_OFFSET - NODES_DATA_LEN)
+#if HAWAII_JOURNAL
+// A ring of JournalEntry
+#define JOURNAL_LEN 32
+#define JOURNAL_OFFSET (NODES_OFFSET - JOURNAL_LEN * sizeof(JournalEntry))
+#define FOOTPRINT_INTERVALS_OFFSET (JOURNAL_OFFSET - sizeof(FootprintIntervals))
+#elif HAWAII
+#define FOOTPRINT_INTERVALS_OFFSET (NODES_OFFSET - sizeof(FootprintIntervals))
+#endif
 
-struct Model;
-
-extern Model model_vm;
-
-void read_from_nvm(void* vm_buffer, uint32_t nvm_offset, size_t n);
-void write_to_nvm(const void* vm_buffer, uint32_t nvm_offset, size_t n, uint16_t timer_delay = 0);
+void read_from_nvm(InferenceContext *ctx, void* vm_buffer, uint32_t nvm_offset, size_t n);
+void write_to_nvm(InferenceContext *ctx, const void* vm_buffer, uint32_t nvm_offset, size_t n, uint16_t timer_delay = 0);
 // DMA controller on MSP432 can handle at most 1024 words at a time
-void write_to_nvm_segmented(const uint8_t* vm_buffer, uint32_t nvm_offset, uint16_t total_len, uint16_t segment_size = 1024);
-void my_erase(void);
-void copy_samples_data(void);
+void write_to_nvm_segmented(InferenceContext *ctx, const uint8_t* vm_buffer, uint32_t nvm_offset, uint16_t total_len, uint16_t segment_size = 1024);
+void my_erase(InferenceContext *ctx);
+void copy_samples_data(InferenceContext *ctx);
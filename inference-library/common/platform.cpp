@@ -5,26 +5,27 @@
 #include "platform-private.h"
 #include "cnn_common.h"
 #include "my_debug.h"
-#include "intermittent-cnn.h" // for sample_idx
+#include "op_utils.h"
+#include "inference_context.h"
 
 // put offset checks here as extra headers are used
 static_assert(NODES_OFFSET > SAMPLES_OFFSET + SAMPLES_DATA_LEN, "Incorrect NVM layout");
 
-Model model_vm;
-uint8_t dma_counter_enabled = 1;
-
 template<typename T>
 static uint32_t nvm_addr(uint8_t, uint16_t);
 
 template<typename T>
-T* vm_addr(uint16_t data_idx);
+T* vm_addr(InferenceContext *ctx, uint16_t data_idx);
+
+template<typename T>
+VersionedDataCache<T>* versioned_data_cache(InferenceContext *ctx, uint16_t data_idx);
 
 // typeinfo does not always give names I want
 template<typename T>
 const char* datatype_name(void);
 
-static uint32_t intermediate_values_offset(uint8_t slot_id) {
-    return INTERMEDIATE_VALUES_OFFSET + slot_id * INTERMEDIATE_VALUES_SIZE;
+static uint32_t intermediate_values_offset(const ParameterInfo* param) {
+    return INTERMEDIATE_VALUES_OFFSET + param->params_offset;
 }
 
 static uint32_t intermediate_parameters_info_addr(uint8_t i) {
@@ -37,8 +38,13 @@ uint32_t nvm_addr<Model>(uint8_t i, uint16_t) {
 }
 
 template<>
-Model* vm_addr<Model>(uint16_t data_idx) {
-    return &model_vm;
+Model* vm_addr<Model>(InferenceContext *ctx, uint16_t data_idx) {
+    return &ctx->model_vm;
+}
+
+template<>
+VersionedDataCache<Model>* versioned_data_cache<Model>(InferenceContext *ctx, uint16_t) {
+    return &ctx->model_cache;
 }
 
 template<>
@@ -46,12 +52,12 @@ const char* datatype_name<Model>(void) {
     return "model";
 }
 
-void my_memcpy_to_param(ParameterInfo *param, uint16_t offset_in_word, const void *src, size_t n, uint16_t timer_delay) {
+void my_memcpy_to_param(InferenceContext *ctx, ParameterInfo *param, uint16_t offset_in_word, const void *src, size_t n, uint16_t timer_delay) {
     MY_ASSERT(param->bitwidth == 16);
     MY_ASSERT(param->slot < SLOT_CONSTANTS_MIN);
-    uint32_t total_offset = param->params_offset + offset_in_word * sizeof(int16_t);
+    uint32_t total_offset = offset_in_word * sizeof(int16_t);
     MY_ASSERT(total_offset + n <= param->params_len);
-    write_to_nvm(src, intermediate_values_offset(param->slot) + total_offset, n, timer_delay);
+    write_to_nvm(ctx, src, intermediate_values_offset(param) + total_offset, n, timer_delay);
 #if ENABLE_COUNTERS
 #if JAPARI
     uint16_t n_footprints = n / (BATCH_SIZE + 1);
@@ -63,37 +69,35 @@ void my_memcpy_to_param(ParameterInfo *param, uint16_t offset_in_word, const voi
 #endif
 }
 
-void my_memcpy_from_intermediate_values(void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n) {
-    read_from_nvm(dest, intermediate_values_offset(param->slot) + offset_in_word * sizeof(int16_t), n);
+void my_memcpy_to_param_callback(ParameterInfo *param, uint16_t offset_in_word, const void *src, size_t n, uint16_t timer_delay) {
+    my_memcpy_to_param(get_context(), param, offset_in_word, src, n, timer_delay);
 }
 
-void read_from_samples(void *dest, uint16_t offset_in_word, size_t n) {
-    read_from_nvm(dest, SAMPLES_OFFSET + (sample_idx % PLAT_LABELS_DATA_LEN) * 2*TOTAL_SAMPLE_SIZE + offset_in_word * sizeof(int16_t), n);
+void my_memcpy_from_intermediate_values(InferenceContext *ctx, void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n) {
+    read_from_nvm(ctx, dest, intermediate_values_offset(param) + offset_in_word * sizeof(int16_t), n);
 }
 
-ParameterInfo* get_intermediate_parameter_info(uint8_t i) {
-    ParameterInfo* dst = intermediate_parameters_info_vm + i;
-    read_from_nvm(dst, intermediate_parameters_info_addr(i), sizeof(ParameterInfo));
+void read_from_samples(InferenceContext *ctx, void *dest, uint16_t offset_in_word, size_t n) {
+    read_from_nvm(ctx, dest, SAMPLES_OFFSET + (ctx->sample_idx % PLAT_LABELS_DATA_LEN) * 2*TOTAL_SAMPLE_SIZE + offset_in_word * sizeof(int16_t), n);
+}
+
+ParameterInfo* get_intermediate_parameter_info(InferenceContext *ctx, uint8_t i) {
+    ParameterInfo* dst = ctx->intermediate_parameters_info_vm + i;
+    read_from_nvm(ctx, dst, intermediate_parameters_info_addr(i), sizeof(ParameterInfo));
     my_printf_debug("Load intermediate parameter info %d from NVM" NEWLINE, i);
     MY_ASSERT(dst->parameter_info_idx == i + N_INPUT,
               "Expect parameter index %d but got %d" NEWLINE, i + N_INPUT, dst->parameter_info_idx);
     return dst;
 }
 
-void commit_intermediate_parameter_info(uint8_t i) {
-    const ParameterInfo* src = intermediate_parameters_info_vm + i;
+void commit_intermediate_parameter_info(InferenceContext *ctx, uint8_t i) {
+    const ParameterInfo* src = ctx->intermediate_parameters_info_vm + i;
     MY_ASSERT(src->parameter_info_idx == i + N_INPUT);
-    write_to_nvm(src, intermediate_parameters_info_addr(i), sizeof(ParameterInfo));
+    write_to_nvm(ctx, src, intermediate_parameters_info_addr(i), sizeof(ParameterInfo));
     my_printf_debug("Committing intermediate parameter info %d to NVM" NEWLINE, i);
 }
 
-template<typename T>
-static uint8_t get_newer_copy_id(uint16_t data_idx) {
-    uint8_t version1, version2;
-    read_from_nvm(&version1, nvm_addr<T>(0, data_idx) + offsetof(T, version), sizeof(uint8_t));
-    read_from_nvm(&version2, nvm_addr<T>(1, data_idx) + offsetof(T, version), sizeof(uint8_t));
-    my_printf_debug("Versions of shadow %s copies for data item %d: %d, %d" NEWLINE, datatype_name<T>(), data_idx, version1, version2);
-
+static uint8_t get_newer_copy_id(uint8_t version1, uint8_t version2) {
     if (abs(static_cast<int>(version1 - version2)) == 1) {
         if (version1 > version2) {
             return 0;
@@ -110,6 +114,21 @@ static uint8_t get_newer_copy_id(uint16_t data_idx) {
     }
 }
 
+template<typename T>
+static VersionedDataCache<T>* load_versioned_data_cache(InferenceContext *ctx, uint16_t data_idx) {
+    VersionedDataCache<T>* cache = versioned_data_cache<T>(ctx, data_idx);
+    if (cache->loaded) {
+        return cache;
+    }
+
+    read_from_nvm(ctx, &cache->copies[0], nvm_addr<T>(0, data_idx), sizeof(T));
+    read_from_nvm(ctx, &cache->copies[1], nvm_addr<T>(1, data_idx), sizeof(T));
+    my_printf_debug("Versions of shadow %s copies for data item %d: %d, %d" NEWLINE, datatype_name<T>(), data_idx, cache->copies[0].version, cache->copies[1].version);
+    cache->newer_copy_id = get_newer_copy_id(cache->copies[0].version, cache->copies[1].version);
+    cache->loaded = 1;
+    return cache;
+}
+
 template<typename T>
 void bump_version(T *data) {
     data->version++;
@@ -120,72 +139,124 @@ void bump_version(T *data) {
 }
 
 template<typename T>
-T* get_versioned_data(uint16_t data_idx) {
-    T *dst = vm_addr<T>(data_idx);
+T* get_versioned_data(InferenceContext *ctx, uint16_t data_idx) {
+    T *dst = vm_addr<T>(ctx, data_idx);
 
-    uint8_t newer_copy_id = get_newer_copy_id<T>(data_idx);
-    read_from_nvm(dst, nvm_addr<T>(newer_copy_id, data_idx), sizeof(T));
+    const VersionedDataCache<T>* cache = load_versioned_data_cache<T>(ctx, data_idx);
+    uint8_t newer_copy_id = cache->newer_copy_id;
+    memcpy(dst, &cache->copies[newer_copy_id], sizeof(T));
     my_printf_debug("Using %s copy %d, version %d" NEWLINE, datatype_name<T>(), newer_copy_id, dst->version);
     return dst;
 }
 
 template<typename T>
-void commit_versioned_data(uint16_t data_idx) {
-    uint8_t newer_copy_id = get_newer_copy_id<T>(data_idx);
-    uint8_t older_copy_id = newer_copy_id ^ 1;
+void commit_versioned_data(InferenceContext *ctx, uint16_t data_idx) {
+    VersionedDataCache<T>* cache = load_versioned_data_cache<T>(ctx, data_idx);
+    uint8_t older_copy_id = cache->newer_copy_id ^ 1;
 
-    T* vm_ptr = vm_addr<T>(data_idx);
+    T* vm_ptr = vm_addr<T>(ctx, data_idx);
     bump_version<T>(vm_ptr);
 
-    write_to_nvm(vm_ptr, nvm_addr<T>(older_copy_id, data_idx), sizeof(T));
-    my_printf_debug("Committing version %d to %s copy %d" NEWLINE, vm_ptr->version, datatype_name<T>(), older_copy_id);
+    /* Only bytes from the first one different from the older copy are written.
+     * The version is the last field and always changes, so a power failure
+     * during the write leaves the older copy with its old version, and the
+     * newer copy is still used after reboot. */
+    const uint8_t *new_data = reinterpret_cast<const uint8_t*>(vm_ptr),
+                  *old_data = reinterpret_cast<const uint8_t*>(&cache->copies[older_copy_id]);
+    uint16_t start = 0, end = offsetof(T, version) + sizeof(vm_ptr->version);
+    while (start < offsetof(T, version) && new_data[start] == old_data[start]) {
+        start++;
+    }
+    write_to_nvm(ctx, new_data + start, nvm_addr<T>(older_copy_id, data_idx) + start, end - start);
+    memcpy(&cache->copies[older_copy_id], vm_ptr, sizeof(T));
+    // The same as loading versions again from NVM
+    cache->newer_copy_id = get_newer_copy_id(cache->copies[0].version, cache->copies[1].version);
+    my_printf_debug("Committing version %d to %s copy %d (%d bytes)" NEWLINE, vm_ptr->version, datatype_name<T>(), older_copy_id, end - start);
 }
 
-Model* load_model_from_nvm(void) {
-    Model* ret = get_versioned_data<Model>(0);
+Model* load_model_from_nvm(InferenceContext *ctx) {
+    Model* ret = get_versioned_data<Model>(ctx, 0);
     return ret;
 }
 
-Model* get_model(void) {
-    return &model_vm;
+Model* get_model(InferenceContext *ctx) {
+    return &ctx->model_vm;
 }
 
-void commit_model(void) {
+void commit_model(InferenceContext *ctx) {
+    const Model *model = get_model(ctx);
 #if ENABLE_COUNTERS && DEMO
-    if (!model_vm.running) {
-        reset_counters();
+    if (!model->running) {
+        reset_counters(ctx);
     }
 #endif
-    if (!model_vm.running) {
-        notify_model_finished();
+    if (!model->running) {
+        notify_model_finished(ctx);
     }
-    commit_versioned_data<Model>(0);
+    commit_versioned_data<Model>(ctx, 0);
 }
 
-void first_run(void) {
-    dma_counter_enabled = 0;
+void first_run(InferenceContext *ctx) {
+    ctx->dma_counter_enabled = 0;
     my_printf_debug("First run, resetting everything..." NEWLINE);
 #if ENABLE_COUNTERS
     total_jobs = 0;
 #endif
-    my_erase();
-    copy_samples_data();
+    my_erase(ctx);
+    copy_samples_data(ctx);
+
+    // Shadow copies in NVM are rewritten, and thus loaded again at next accesses
+    ctx->model_cache.loaded = 0;
+#if HAWAII_JOURNAL
+    ctx->journal_loaded = 0;
+#elif HAWAII
+    for (uint16_t layer_idx = 0; layer_idx < MODEL_NODES_LEN; layer_idx++) {
+        ctx->footprint_caches[layer_idx].loaded = 0;
+    }
+#endif
+#if HAWAII
+    ctx->footprint_intervals_loaded = 0;
+    // No boot yet, which should not be taken as the start of the first layer
+    uint16_t boot_layer_idx = MODEL_NODES_LEN;
+    write_to_nvm(ctx, &boot_layer_idx, FOOTPRINT_INTERVALS_OFFSET + offsetof(FootprintIntervals, boot_layer_idx), sizeof(uint16_t));
+#endif
 
-    write_to_nvm_segmented(intermediate_parameters_info_data, intermediate_parameters_info_addr(0),
+    write_to_nvm_segmented(ctx, intermediate_parameters_info_data, intermediate_parameters_info_addr(0),
                            INTERMEDIATE_PARAMETERS_INFO_DATA_LEN, sizeof(ParameterInfo));
-    write_to_nvm(model_data, nvm_addr<Model>(0, 0), MODEL_DATA_LEN);
-    write_to_nvm(model_data, nvm_addr<Model>(1, 0), MODEL_DATA_LEN);
-    dma_counter_enabled = 1;
+    write_to_nvm(ctx, model_data, nvm_addr<Model>(0, 0), MODEL_DATA_LEN);
+    write_to_nvm(ctx, model_data, nvm_addr<Model>(1, 0), MODEL_DATA_LEN);
+    ctx->dma_counter_enabled = 1;
 
-    load_model_from_nvm(); // refresh model_vm
-    commit_model();
+    load_model_from_nvm(ctx); // refresh model_vm
+    commit_model(ctx);
 
     my_printf_debug("Init for " CONFIG "/" METHOD " with batch size=%d" NEWLINE, BATCH_SIZE);
 }
 
-void write_to_nvm_segmented(const uint8_t* vm_buffer, uint32_t nvm_offset, uint16_t total_len, uint16_t segment_size) {
+void init_context(InferenceContext* ctx) {
+#ifdef POSIX_BUILD
+    // NVM survives power failures
+    uint8_t* nvm = ctx->nvm;
+#endif
+    memset(ctx, 0, sizeof(InferenceContext));
+#ifdef POSIX_BUILD
+    ctx->nvm = nvm;
+#endif
+    ctx->dma_counter_enabled = 1;
+#if INDIRECT_RECOVERY
+    ctx->after_recovery = 1;
+#endif
+    ctx->conv_params.matrix_mpy_results = lea_buffer + LEA_BUFFER_SIZE;
+}
+
+void reset_vm(InferenceContext *ctx) {
+    init_context(ctx);
+    reset_op_utils_vm();
+}
+
+void write_to_nvm_segmented(InferenceContext *ctx, const uint8_t* vm_buffer, uint32_t nvm_offset, uint16_t total_len, uint16_t segment_size) {
     for (uint16_t idx = 0; idx < total_len; idx += segment_size) {
-        write_to_nvm(vm_buffer + idx, nvm_offset + idx, MIN_VAL(total_len - idx, segment_size));
+        write_to_nvm(ctx, vm_buffer + idx, nvm_offset + idx, MIN_VAL(total_len - idx, segment_size));
     }
 }
 
@@ -194,90 +265,321 @@ void record_overflow_handling_overhead(uint32_t cycles) {
 }
 
 #if HAWAII
-Node::Footprint footprints_vm[MODEL_NODES_LEN];
+template<>
+Node::Footprint* vm_addr<Node::Footprint>(InferenceContext *ctx, uint16_t layer_idx) {
+    return &ctx->footprints_vm[layer_idx];
+}
+
+static_assert(FOOTPRINT_INTERVALS_OFFSET > SAMPLES_OFFSET + SAMPLES_DATA_LEN, "Incorrect NVM layout");
+
+#if HAWAII_JOURNAL
+// Sequence numbers cycle through 1~255, and should differ between laps at each index
+static_assert(JOURNAL_LEN < UINT8_MAX, "Journal too long for JournalEntry::seq");
+
+/* Footprints are appended to a ring of entries, each for the layer being run.
+ * A footprint is in the newest entry if it is for that layer, or otherwise 0,
+ * as layers run in order and entries for previous layers are not needed any
+ * more. Thus the journal is compacted implicitly at layer boundaries, and no
+ * live entries are overwritten. */
+static uint32_t journal_entry_addr(uint8_t entry_idx) {
+    return JOURNAL_OFFSET + entry_idx * sizeof(JournalEntry);
+}
 
+static uint8_t next_journal_seq(uint8_t seq) {
+    // 0 is for empty entries
+    return seq % UINT8_MAX + 1;
+}
+
+static JournalEntry* load_journal(InferenceContext *ctx) {
+    JournalEntry* newest = &ctx->journal_newest;
+    if (ctx->journal_loaded) {
+        return newest;
+    }
+
+    /* Entries are appended in ring order, so the newest one is the last one with
+     * sequence numbers increasing by one from the first entry. The sequence
+     * number is the last field, and a torn append leaves the old one there. */
+    uint8_t seq, next_seq;
+    read_from_nvm(ctx, &seq, journal_entry_addr(0) + offsetof(JournalEntry, seq), sizeof(uint8_t));
+    if (!seq) {
+        // Empty, and the first entry will be at index 0
+        ctx->journal_head = JOURNAL_LEN - 1;
+        newest->layer_idx = UINT8_MAX;
+        newest->seq = 0;
+    } else {
+        uint8_t entry_idx;
+        for (entry_idx = 0; entry_idx < JOURNAL_LEN - 1; entry_idx++) {
+            read_from_nvm(ctx, &next_seq, journal_entry_addr(entry_idx + 1) + offsetof(JournalEntry, seq), sizeof(uint8_t));
+            if (next_seq != next_journal_seq(seq)) {
+                break;
+            }
+            seq = next_seq;
+        }
+        ctx->journal_head = entry_idx;
+        read_from_nvm(ctx, newest, journal_entry_addr(entry_idx), sizeof(JournalEntry));
+    }
+    my_printf_debug("Newest journal entry %d with seq %d for layer %d" NEWLINE, ctx->journal_head, newest->seq, newest->layer_idx);
+    ctx->journal_loaded = 1;
+    return newest;
+}
+
+static void append_journal(InferenceContext *ctx, uint16_t layer_idx, uint8_t tiling, uint16_t sub_layer_idx, uint16_t value) {
+    JournalEntry* newest = load_journal(ctx);
+    ctx->journal_head = (ctx->journal_head + 1) % JOURNAL_LEN;
+    newest->sub_layer_idx = sub_layer_idx;
+    newest->value = value;
+    newest->layer_idx = layer_idx;
+    newest->tiling = tiling;
+    newest->seq = next_journal_seq(newest->seq);
+    write_to_nvm(ctx, newest, journal_entry_addr(ctx->journal_head), sizeof(JournalEntry));
+    my_printf_debug("Appended journal entry %d with seq %d" NEWLINE, ctx->journal_head, newest->seq);
+}
+#else
 template<>
 uint32_t nvm_addr<Node::Footprint>(uint8_t i, uint16_t layer_idx) {
     return NODES_OFFSET + layer_idx * sizeof(Node) + offsetof(Node, footprint) + i * sizeof(Node::Footprint);
 }
 
 template<>
-Node::Footprint* vm_addr<Node::Footprint>(uint16_t layer_idx) {
-    return &footprints_vm[layer_idx];
+VersionedDataCache<Node::Footprint>* versioned_data_cache<Node::Footprint>(InferenceContext *ctx, uint16_t layer_idx) {
+    return &ctx->footprint_caches[layer_idx];
 }
 
 template<>
 const char* datatype_name<Node::Footprint>(void) {
     return "footprint";
 }
+#endif // HAWAII_JOURNAL
+
+static void commit_footprint(InferenceContext *ctx, uint16_t layer_idx) {
+#if HAWAII_JOURNAL
+    const Node::Footprint* footprint_vm = vm_addr<Node::Footprint>(ctx, layer_idx);
+    append_journal(ctx, layer_idx, footprint_vm->tiling, footprint_vm->sub_layer_idx, footprint_vm->value);
+#else
+    commit_versioned_data<Node::Footprint>(ctx, layer_idx);
+#endif
+}
+
+static const Node::Footprint* load_footprint(InferenceContext *ctx, uint16_t layer_idx) {
+#if HAWAII_JOURNAL
+    const JournalEntry* newest = load_journal(ctx);
+    Node::Footprint* footprint_vm = vm_addr<Node::Footprint>(ctx, layer_idx);
+    if (newest->layer_idx == layer_idx) {
+        footprint_vm->tiling = newest->tiling;
+        footprint_vm->sub_layer_idx = newest->sub_layer_idx;
+        footprint_vm->value = newest->value;
+    } else {
+        footprint_vm->tiling = 0;
+        footprint_vm->sub_layer_idx = footprint_vm->value = 0;
+    }
+    return footprint_vm;
+#else
+    return get_versioned_data<Node::Footprint>(ctx, layer_idx);
+#endif
+}
 
-void reset_hawaii_sub_layer_footprint(uint16_t layer_idx) {
-    Node::Footprint* footprint_vm = footprints_vm + layer_idx;
+void reset_hawaii_sub_layer_footprint(InferenceContext *ctx, uint16_t layer_idx) {
+    Node::Footprint* footprint_vm = vm_addr<Node::Footprint>(ctx, layer_idx);
     footprint_vm->value = 0;
+    // Jobs not recorded yet are in the finished sub layer
+    ctx->non_recorded_jobs = 0;
     my_printf_debug("Reset HAWAII sub layer footprint ..." NEWLINE);
     my_printf_debug("footprint_vm->value: %d" NEWLINE, footprint_vm->value);
     MY_ASSERT(footprint_vm->value < INTERMEDIATE_VALUES_SIZE);
-    commit_versioned_data<Node::Footprint>(layer_idx);
+    commit_footprint(ctx, layer_idx);
     my_printf_debug("Write HAWAII layer footprint %d for layer %d" NEWLINE, footprint_vm->value, layer_idx);
     MY_ASSERT(footprint_vm->value % BATCH_SIZE == 0);
     my_printf_debug("Finish reseting HAWAII sub layer footprint" NEWLINE);
 }
 
-void write_hawaii_sub_layer_footprint(uint16_t layer_idx, int16_t sub_layer_value) {
-    Node::Footprint* footprint_vm = footprints_vm + layer_idx;
+void write_hawaii_sub_layer_footprint(InferenceContext *ctx, uint16_t layer_idx, int16_t sub_layer_value) {
+    Node::Footprint* footprint_vm = vm_addr<Node::Footprint>(ctx, layer_idx);
     footprint_vm->sub_layer_idx += sub_layer_value;
     footprint_vm->value = 0;
+    ctx->non_recorded_jobs = 0;
     my_printf_debug("footprint_vm->sub_layer_idx/value: %d/%d" NEWLINE, footprint_vm->sub_layer_idx, footprint_vm->value);
     MY_ASSERT(footprint_vm->value < INTERMEDIATE_VALUES_SIZE);
-    commit_versioned_data<Node::Footprint>(layer_idx);
+    commit_footprint(ctx, layer_idx);
     my_printf_debug("Write HAWAII layer footprint %d/%d for layer %d" NEWLINE, footprint_vm->sub_layer_idx, footprint_vm->value, layer_idx);
     MY_ASSERT(footprint_vm->value % BATCH_SIZE == 0);
     my_printf_debug("Finish writing HAWAII sub layer footprint" NEWLINE);
 }
 
-void write_hawaii_layer_footprint(uint16_t layer_idx, int16_t n_jobs) {
+void write_hawaii_layer_footprint(InferenceContext *ctx, uint16_t layer_idx, int16_t n_jobs) {
 #if ENABLE_COUNTERS
     counters()->footprint_preservation += 1;
 #endif
-    Node::Footprint* footprint_vm = footprints_vm + layer_idx;
+    Node::Footprint* footprint_vm = vm_addr<Node::Footprint>(ctx, layer_idx);
     footprint_vm->value += n_jobs;
     my_printf_debug("footprint_vm->value: %d" NEWLINE, footprint_vm->value);
     MY_ASSERT(footprint_vm->value < INTERMEDIATE_VALUES_SIZE);
-    commit_versioned_data<Node::Footprint>(layer_idx);
+    commit_footprint(ctx, layer_idx);
     my_printf_debug("Write HAWAII layer footprint %d for layer %d" NEWLINE, footprint_vm->value, layer_idx);
     MY_ASSERT(footprint_vm->value % BATCH_SIZE == 0);
 }
 
-uint16_t read_hawaii_sub_layer_footprint(uint16_t layer_idx) {
-    uint16_t footprint = get_versioned_data<Node::Footprint>(layer_idx)->sub_layer_idx;
+uint16_t read_hawaii_sub_layer_footprint(InferenceContext *ctx, uint16_t layer_idx) {
+    uint16_t footprint = load_footprint(ctx, layer_idx)->sub_layer_idx;
     my_printf_debug("HAWAII sub layer footprint=%d for layer %d" NEWLINE, footprint, layer_idx);
     return footprint;
 }
 
-uint16_t read_hawaii_layer_footprint(uint16_t layer_idx) {
-    uint16_t footprint = get_versioned_data<Node::Footprint>(layer_idx)->value;
+uint16_t read_hawaii_layer_footprint(InferenceContext *ctx, uint16_t layer_idx) {
+    uint16_t footprint = load_footprint(ctx, layer_idx)->value;
+    // Jobs after the footprint are to be run again
+    ctx->non_recorded_jobs = 0;
     my_printf_debug("HAWAII layer footprint=%d for layer %d" NEWLINE, footprint, layer_idx);
     MY_ASSERT(footprint % BATCH_SIZE == 0);
     return footprint;
 }
 
-uint16_t read_hawaii_sub_layer_footprint_vm(uint16_t layer_idx) {
-    Node::Footprint* footprint_vm = footprints_vm + layer_idx;
+uint16_t read_hawaii_sub_layer_footprint_vm(InferenceContext *ctx, uint16_t layer_idx) {
+    Node::Footprint* footprint_vm = vm_addr<Node::Footprint>(ctx, layer_idx);
     my_printf_debug("HAWAII sub layer footprint=%d for layer %d" NEWLINE, footprint_vm->sub_layer_idx, layer_idx);
     return footprint_vm->sub_layer_idx;
 }
 
-uint16_t read_hawaii_layer_footprint_vm(uint16_t layer_idx) {
-    Node::Footprint* footprint_vm = footprints_vm + layer_idx;
+uint16_t read_hawaii_layer_footprint_vm(InferenceContext *ctx, uint16_t layer_idx) {
+    Node::Footprint* footprint_vm = vm_addr<Node::Footprint>(ctx, layer_idx);
     my_printf_debug("HAWAII layer footprint=%d for layer %d" NEWLINE, footprint_vm->value, layer_idx);
     return footprint_vm->value;
 }
 
-void reset_hawaii_layer_footprint(uint16_t layer_idx) {
+// Footprints are committed about this many times in a power cycle, to bound re-execution after power failures
+#define FOOTPRINT_COMMITS_PER_POWER_CYCLE 8
+#define MAX_FOOTPRINT_INTERVAL_SHIFT 7
+
+static void write_footprint_interval_shift(InferenceContext *ctx, uint16_t layer_idx, uint8_t shift) {
+    uint8_t* shift_vm = ctx->footprint_intervals.shifts + layer_idx;
+    if (*shift_vm == shift) {
+        return;
+    }
+    *shift_vm = shift;
+    write_to_nvm(ctx, shift_vm, FOOTPRINT_INTERVALS_OFFSET + offsetof(FootprintIntervals, shifts) + layer_idx, sizeof(uint8_t));
+    my_printf_debug("Footprint interval for layer %d: %d batches" NEWLINE, layer_idx, 1 << shift);
+}
+
+uint16_t hawaii_footprint_interval(InferenceContext *ctx, uint16_t layer_idx) {
+    if (!ctx->footprint_intervals_loaded) {
+        return BATCH_SIZE;
+    }
+    return BATCH_SIZE << ctx->footprint_intervals.shifts[layer_idx];
+}
+
+static void write_preferred_tiling(InferenceContext *ctx, uint16_t layer_idx, uint8_t tiling) {
+    uint8_t* tiling_vm = ctx->footprint_intervals.tilings + layer_idx;
+    *tiling_vm = tiling;
+    write_to_nvm(ctx, tiling_vm, FOOTPRINT_INTERVALS_OFFSET + offsetof(FootprintIntervals, tilings) + layer_idx, sizeof(uint8_t));
+    my_printf_debug("Preferred tiling for layer %d: %d" NEWLINE, layer_idx, tiling);
+}
+
+/* Called after the footprint of the current layer is loaded. At the first
+ * time after boot, the interval for the layer is adjusted so that the progress
+ * in the last power cycle, if it is in the same sub layer, would be committed
+ * FOOTPRINT_COMMITS_PER_POWER_CYCLE times. Returns 1 if there is no progress
+ * in the last power cycle. */
+uint8_t adapt_hawaii_footprint_interval(InferenceContext *ctx, uint16_t layer_idx) {
+    FootprintIntervals* intervals = &ctx->footprint_intervals;
+    if (ctx->footprint_intervals_loaded) {
+        return 0;
+    }
+    read_from_nvm(ctx, intervals, FOOTPRINT_INTERVALS_OFFSET, sizeof(FootprintIntervals));
+    ctx->footprint_intervals_loaded = 1;
+
+    const Node::Footprint* footprint_vm = vm_addr<Node::Footprint>(ctx, layer_idx);
+    if (intervals->boot_layer_idx == layer_idx && intervals->boot_sub_layer_idx == footprint_vm->sub_layer_idx &&
+            footprint_vm->value >= intervals->boot_value) {
+        uint16_t progress = (footprint_vm->value - intervals->boot_value) / BATCH_SIZE;
+        my_printf_debug("Progress in the last power cycle: %d batches" NEWLINE, progress);
+        uint8_t shift = 0;
+        while (shift < MAX_FOOTPRINT_INTERVAL_SHIFT && (FOOTPRINT_COMMITS_PER_POWER_CYCLE << (shift + 1)) <= progress) {
+            shift++;
+        }
+        write_footprint_interval_shift(ctx, layer_idx, shift);
+        if (!progress) {
+            // Skip writing the same record, which may take all energy left
+            return 1;
+        }
+    }
+
+    intervals->boot_layer_idx = layer_idx;
+    intervals->boot_sub_layer_idx = footprint_vm->sub_layer_idx;
+    intervals->boot_value = footprint_vm->value;
+    write_to_nvm(ctx, intervals, FOOTPRINT_INTERVALS_OFFSET, offsetof(FootprintIntervals, shifts));
+    return 0;
+}
+
+/* Called after a layer finishes. A layer without power failures in it uses a
+ * longer interval and larger tiles next time. */
+void finish_hawaii_footprint_interval(InferenceContext *ctx, uint16_t layer_idx) {
+    FootprintIntervals* intervals = &ctx->footprint_intervals;
+    if (!ctx->footprint_intervals_loaded) {
+        return;
+    }
+    if (intervals->boot_layer_idx == layer_idx) {
+        // Resumed after boot. Later layers (also in later inferences) are run in this power cycle entirely
+        intervals->boot_layer_idx = MODEL_NODES_LEN;
+        return;
+    }
+    uint8_t shift = intervals->shifts[layer_idx];
+    if (shift < MAX_FOOTPRINT_INTERVAL_SHIFT) {
+        write_footprint_interval_shift(ctx, layer_idx, shift + 1);
+    }
+    if (intervals->tilings[layer_idx]) {
+        write_preferred_tiling(ctx, layer_idx, intervals->tilings[layer_idx] - 1);
+    }
+}
+
+/* Conv layers use one of the tilings in the node until the layer finishes, as
+ * sub layer footprints count tiles. Tilings are from large to small. Larger
+ * tiles load fewer filters and overlapping inputs, while a tile should be
+ * finished within a power cycle, or the layer makes no progress. Thus a layer
+ * not started yet switches to smaller tiles if it made no progress in the last
+ * power cycle, and larger tiles are used again after the layer finishes
+ * without power failures. */
+uint8_t read_hawaii_layer_tiling(InferenceContext *ctx, uint16_t layer_idx, uint8_t n_tilings) {
+    Node::Footprint* footprint_vm = vm_addr<Node::Footprint>(ctx, layer_idx);
+    load_footprint(ctx, layer_idx);
+    if (footprint_vm->sub_layer_idx || footprint_vm->value) {
+        my_printf_debug("Resuming with tiling %d for layer %d" NEWLINE, footprint_vm->tiling, layer_idx);
+        return footprint_vm->tiling;
+    }
+
+    uint8_t stalled = adapt_hawaii_footprint_interval(ctx, layer_idx);
+    uint8_t tiling = ctx->footprint_intervals.tilings[layer_idx];
+    if (stalled && tiling + 1 < n_tilings) {
+        tiling++;
+        write_preferred_tiling(ctx, layer_idx, tiling);
+    }
+    MY_ASSERT(tiling < n_tilings);
+    my_printf_debug("Using tiling %d for layer %d" NEWLINE, tiling, layer_idx);
+    if (tiling != footprint_vm->tiling) {
+        footprint_vm->tiling = tiling;
+        commit_footprint(ctx, layer_idx);
+    }
+    return tiling;
+}
+
+void reset_hawaii_layer_footprint(InferenceContext *ctx, uint16_t layer_idx) {
+#if HAWAII_JOURNAL
+    // Only the newest entry may be for this layer
+    const JournalEntry* newest = load_journal(ctx);
+    if (newest->layer_idx == layer_idx && (newest->tiling || newest->sub_layer_idx || newest->value)) {
+        append_journal(ctx, layer_idx, 0, 0, 0);
+    }
+    my_printf_debug("Reset HAWAII layer footprint for layer %d" NEWLINE, layer_idx);
+#else
     Node::Footprint footprint;
+    footprint.tiling = footprint.dummy = 0;
     footprint.sub_layer_idx = footprint.value = footprint.version = 0;
-    write_to_nvm(&footprint, nvm_addr<Node::Footprint>(0, layer_idx), sizeof(Node::Footprint));
-    write_to_nvm(&footprint, nvm_addr<Node::Footprint>(1, layer_idx), sizeof(Node::Footprint));
+    write_to_nvm(ctx, &footprint, nvm_addr<Node::Footprint>(0, layer_idx), sizeof(Node::Footprint));
+    write_to_nvm(ctx, &footprint, nvm_addr<Node::Footprint>(1, layer_idx), sizeof(Node::Footprint));
+    // Keep cached copies in sync without reading them back
+    VersionedDataCache<Node::Footprint>* cache = versioned_data_cache<Node::Footprint>(ctx, layer_idx);
+    cache->copies[0] = cache->copies[1] = footprint;
+    cache->newer_copy_id = get_newer_copy_id(0, 0);
+    cache->loaded = 1;
     my_printf_debug("Reset HAWAII layer footprint for layer %d" NEWLINE, layer_idx);
+#endif // HAWAII_JOURNAL
 }
 #endif
@@ -11,30 +11,55 @@
 
 struct ParameterInfo;
 struct Model;
+struct InferenceContext;
 struct Counters;
-extern uint8_t dma_counter_enabled;
 
 [[ noreturn ]] void ERROR_OCCURRED(void);
+// For data not in NVM, charged to the device of this thread as consume_lea_energy()
 void my_memcpy(void* dest, const void* src, size_t n);
-void my_memcpy_to_param(ParameterInfo *param, uint16_t offset_in_word, const void *src, size_t n, uint16_t timer_delay);
-void my_memcpy_from_intermediate_values(void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n);
-void read_from_samples(void *dest, uint16_t offset_in_word, size_t n);
-ParameterInfo* get_intermediate_parameter_info(uint8_t i);
-void commit_intermediate_parameter_info(uint8_t i);
-Model* get_model(void);
-Model* load_model_from_nvm(void);
-void commit_model(void);
-void first_run(void);
-void notify_model_finished(void);
-void notify_layer_finished(void);
+void my_memcpy_to_param(InferenceContext *ctx, ParameterInfo *param, uint16_t offset_in_word, const void *src, size_t n, uint16_t timer_delay);
+void my_memcpy_from_intermediate_values(InferenceContext *ctx, void *dest, const ParameterInfo *param, uint16_t offset_in_word, size_t n);
+// For DSPLib and CMSIS-DSP, which call back with data_preservation_func and thus the context of this thread
+void my_memcpy_to_param_callback(ParameterInfo *param, uint16_t offset_in_word, const void *src, size_t n, uint16_t timer_delay);
+void read_from_samples(InferenceContext *ctx, void *dest, uint16_t offset_in_word, size_t n);
+ParameterInfo* get_intermediate_parameter_info(InferenceContext *ctx, uint8_t i);
+void commit_intermediate_parameter_info(InferenceContext *ctx, uint8_t i);
+Model* get_model(InferenceContext *ctx);
+Model* load_model_from_nvm(InferenceContext *ctx);
+void commit_model(InferenceContext *ctx);
+void first_run(InferenceContext *ctx);
+// Drop everything in VM, which is lost on power failures (see init_context())
+void reset_vm(InferenceContext *ctx);
+void notify_model_finished(InferenceContext *ctx);
+void notify_layer_finished(InferenceContext *ctx);
 uint64_t get_nvm_writes(void);
+
+// Energy accounting for simulating harvested power on the host (see plat-linux.cpp).
+// Called from DSP wrappers without contexts, and thus charged to the device of this thread.
+enum class CpuOp {
+    ADD,
+    MUL,
+    DIV,
+    MAX,
+};
+#ifdef POSIX_BUILD
+void consume_lea_energy(uint32_t n_invocations, uint32_t vector_len);
+void consume_cpu_energy(CpuOp op, uint32_t n_ops);
+#else
+static inline void consume_lea_energy(uint32_t, uint32_t) {}
+static inline void consume_cpu_energy(CpuOp, uint32_t) {}
+#endif
 #if HAWAII
-void write_hawaii_layer_footprint(uint16_t layer_idx, int16_t n_jobs);
-void write_hawaii_sub_layer_footprint(uint16_t layer_idx, int16_t sub_layer_value);
-uint16_t read_hawaii_layer_footprint(uint16_t layer_idx);
-uint16_t read_hawaii_sub_layer_footprint(uint16_t layer_idx);
-uint16_t read_hawaii_layer_footprint_vm(uint16_t layer_idx);
-uint16_t read_hawaii_sub_layer_footprint_vm(uint16_t layer_idx);
-void reset_hawaii_layer_footprint(uint16_t layer_idx);
-void reset_hawaii_sub_layer_footprint(uint16_t layer_idx);
+void write_hawaii_layer_footprint(InferenceContext *ctx, uint16_t layer_idx, int16_t n_jobs);
+void write_hawaii_sub_layer_footprint(InferenceContext *ctx, uint16_t layer_idx, int16_t sub_layer_value);
+uint16_t read_hawaii_layer_footprint(InferenceContext *ctx, uint16_t layer_idx);
+uint16_t read_hawaii_sub_layer_footprint(InferenceContext *ctx, uint16_t layer_idx);
+uint16_t read_hawaii_layer_footprint_vm(InferenceContext *ctx, uint16_t layer_idx);
+uint16_t read_hawaii_sub_layer_footprint_vm(InferenceContext *ctx, uint16_t layer_idx);
+void reset_hawaii_layer_footprint(InferenceContext *ctx, uint16_t layer_idx);
+void reset_hawaii_sub_layer_footprint(InferenceContext *ctx, uint16_t layer_idx);
+uint16_t hawaii_footprint_interval(InferenceContext *ctx, uint16_t layer_idx);
+uint8_t adapt_hawaii_footprint_interval(InferenceContext *ctx, uint16_t layer_idx);
+void finish_hawaii_footprint_interval(InferenceContext *ctx, uint16_t layer_idx);
+uint8_t read_hawaii_layer_tiling(InferenceContext *ctx, uint16_t layer_idx, uint8_t n_tilings);
 #endif
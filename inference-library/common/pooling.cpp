@@ -6,21 +6,7 @@
 #include "op_utils.h"
 #include "my_dsplib.h"
 #include "platform.h"
-
-struct MaxPoolParams {
-    uint16_t output_h;
-    uint16_t output_w;
-    uint16_t start_channel;
-    uint8_t n_channels;
-    uint8_t need_nhwc2nchw;
-    uint16_t new_H;
-    uint16_t new_W;
-    const MaxPoolFlags* flags;
-    const ParameterInfo *data;
-    const ParameterInfo *output;
-    Model *model;
-};
-static MaxPoolParams maxpool_params_obj;
+#include "inference_context.h"
 
 enum {
     KERNEL_SHAPE_H = 0,
@@ -29,14 +15,14 @@ enum {
     STRIDE_W = 1,
 };
 
-void alloc_maxpool(Model *model, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
+void alloc_maxpool(InferenceContext *ctx, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
 
     const ParameterInfo *data = input[0];
 
     const uint16_t H = data->dims[2], W = data->dims[3];
     uint16_t CHANNEL = data->dims[1];
 
-    MaxPoolParams* maxpool_params = &maxpool_params_obj;
+    MaxPoolParams* maxpool_params = &ctx->maxpool_params;
     maxpool_params->flags = &(node->flags.extra.maxpool);
 
     maxpool_params->new_H = H / maxpool_params->flags->strides[STRIDE_H];
@@ -44,7 +30,7 @@ void alloc_maxpool(Model *model, const ParameterInfo *input[], ParameterInfo *ou
     maxpool_params->need_nhwc2nchw = (node->flags.generic == NHWC2NCHW);
 
     output->params_len = maxpool_params->new_H * maxpool_params->new_W * CHANNEL * sizeof(int16_t);
-    output->slot = get_next_slot(model, data);
+    output->slot = get_next_slot(ctx);
     output->dims[0] = 1;
     output->dims[1] = CHANNEL;
     output->dims[2] = maxpool_params->new_H;
@@ -77,7 +63,8 @@ static uint8_t maxpool_patch(MaxPoolParams *maxpool_params) {
         for (uint16_t sW = 0; sW < maxpool_params->flags->kernel_shape[KERNEL_SHAPE_W]; sW++) {
             uint16_t val_offset = (maxpool_params->output_h*maxpool_params->flags->strides[STRIDE_H]+sH) * offset_h +
                                   (maxpool_params->output_w*maxpool_params->flags->strides[STRIDE_W]+sW) * offset_w + maxpool_params->start_channel;
-            my_memcpy_from_param(maxpool_params->model, input_buffer, maxpool_params->data, val_offset, maxpool_params->n_channels * sizeof(int16_t));
+            my_memcpy_from_param(maxpool_params->ctx, input_buffer, maxpool_params->data, val_offset, maxpool_params->n_channels * sizeof(int16_t));
+            consume_cpu_energy(CpuOp::MAX, maxpool_params->n_channels);
             output_channel_offset = 0;
             for (uint8_t input_channel_offset = 0; input_channel_offset < maxpool_params->n_channels; input_channel_offset++) {
                 int16_t val = input_buffer[input_channel_offset];
@@ -94,6 +81,119 @@ static uint8_t maxpool_patch(MaxPoolParams *maxpool_params) {
     return output_channel_offset;
 }
 
+/* Line buffer engine: input rows for the current output row are kept in a ring of kernel_h rows in
+ * lea_buffer, so that each input row is fetched exactly once even if windows overlap. An output row
+ * is computed with element-wise max over kernel rows and then over kernel columns. */
+static uint8_t maxpool_line_buffer_usable(const MaxPoolParams *maxpool_params) {
+    const uint16_t CHANNEL = maxpool_params->data->dims[1], H = maxpool_params->data->dims[2], W = maxpool_params->data->dims[3];
+    const uint16_t new_H = maxpool_params->new_H, new_W = maxpool_params->new_W;
+    const uint8_t kH = maxpool_params->flags->kernel_shape[KERNEL_SHAPE_H], kW = maxpool_params->flags->kernel_shape[KERNEL_SHAPE_W];
+    const uint8_t stride_h = maxpool_params->flags->strides[STRIDE_H], stride_w = maxpool_params->flags->strides[STRIDE_W];
+    if (!new_H || !new_W) {
+        return 0;
+    }
+    // For windows beyond the input, maxpool_patch reads values of the next row, which is kept as is
+    if ((new_H - 1) * stride_h + kH > H || (new_W - 1) * stride_w + kW > W) {
+        return 0;
+    }
+#if INDIRECT_RECOVERY
+    // Recovery from state bits needs NCHW outputs written in order, while outputs here are written row by row
+    if (maxpool_params->need_nhwc2nchw) {
+        return 0;
+    }
+#endif
+    uint32_t row_len = static_cast<uint32_t>((new_W - 1) * stride_w + kW) * CHANNEL;
+    return (kH + 1) * row_len + new_W * CHANNEL <= LEA_BUFFER_SIZE;
+}
+
+// Returns the number of finished output values
+static uint16_t maxpool_rows(MaxPoolParams *maxpool_params, ParameterInfo *output, uint16_t first_unfinished_value_offset) {
+    InferenceContext *ctx = maxpool_params->ctx;
+    const ParameterInfo *data = maxpool_params->data;
+    const uint16_t CHANNEL = data->dims[1], W = data->dims[3];
+    const uint16_t new_H = maxpool_params->new_H, new_W = maxpool_params->new_W;
+    const uint8_t kH = maxpool_params->flags->kernel_shape[KERNEL_SHAPE_H], kW = maxpool_params->flags->kernel_shape[KERNEL_SHAPE_W];
+    const uint8_t stride_h = maxpool_params->flags->strides[STRIDE_H], stride_w = maxpool_params->flags->strides[STRIDE_W];
+    // Only input columns covered by some window are loaded
+    const uint16_t row_len = ((new_W - 1) * stride_w + kW) * CHANNEL;
+    const uint16_t output_row_len = new_W * CHANNEL;
+
+    int16_t* const lines = lea_buffer;
+    int16_t* const column_max = lines + kH * row_len;
+    int16_t* const output_buffer = column_max + row_len;
+    // For NCHW outputs, values of an output row are gathered per channel in column_max, which is not used after that
+    int16_t* const nchw_buffer = column_max;
+
+    // Outputs are computed row by row. For NHWC outputs, values before first_unfinished_value_offset
+    // in the first row are not written again. For NCHW outputs, footprints count values of finished rows.
+    uint16_t output_h = first_unfinished_value_offset / output_row_len;
+    uint16_t output_offset = first_unfinished_value_offset;
+#if HAWAII
+    uint16_t recorded_values = first_unfinished_value_offset;
+#endif
+    uint16_t next_input_h = output_h * stride_h;
+    for (; output_h < new_H; output_h++) {
+        uint16_t first_input_h = output_h * stride_h;
+        next_input_h = MAX_VAL(next_input_h, first_input_h);
+        my_printf_debug("output_h=% 3d input_h=[% 3d, % 3d) loading from % 3d" NEWLINE, output_h, first_input_h, first_input_h + kH, next_input_h);
+        for (; next_input_h < first_input_h + kH; next_input_h++) {
+            my_memcpy_from_param(ctx, lines + next_input_h % kH * row_len, data, next_input_h * W * CHANNEL, row_len * sizeof(int16_t));
+        }
+
+        const int16_t *vertical_max = lines + first_input_h % kH * row_len;
+        for (uint8_t sH = 1; sH < kH; sH++) {
+            my_vmax_q15(vertical_max, lines + (first_input_h + sH) % kH * row_len, column_max, row_len);
+            vertical_max = column_max;
+        }
+        for (uint16_t output_w = 0; output_w < new_W; output_w++) {
+            const int16_t *window = vertical_max + output_w * stride_w * CHANNEL;
+            int16_t *dest = output_buffer + output_w * CHANNEL;
+            if (kW == 1) {
+                my_memcpy(dest, window, CHANNEL * sizeof(int16_t));
+            }
+            const int16_t *horizontal_max = window;
+            for (uint8_t sW = 1; sW < kW; sW++) {
+                my_vmax_q15(horizontal_max, window + sW * CHANNEL, dest, CHANNEL);
+                horizontal_max = dest;
+            }
+        }
+#if MY_DEBUG >= MY_DEBUG_VERBOSE
+        my_printf_debug("max=");
+        for (uint16_t idx = 0; idx < output_row_len; idx++) {
+            my_printf_debug("% 6d ", output_buffer[idx]);
+        }
+        my_printf_debug(NEWLINE);
+#endif
+
+        uint16_t row_offset = output_h * output_row_len;
+        if (!maxpool_params->need_nhwc2nchw) {
+            uint16_t n_skipped = output_offset - row_offset;
+            my_memcpy_to_param(ctx, output, output_offset, output_buffer + n_skipped, (output_row_len - n_skipped) * sizeof(int16_t), 0);
+        } else {
+            // NHWC -> NCHW
+            for (uint16_t channel = 0; channel < CHANNEL; channel++) {
+                my_deinterleave_q15(output_buffer, channel, CHANNEL, nchw_buffer + channel * new_W, new_W);
+            }
+            if (new_H == 1) {
+                my_memcpy_to_param(ctx, output, 0, nchw_buffer, output_row_len * sizeof(int16_t), 0);
+            } else {
+                for (uint16_t channel = 0; channel < CHANNEL; channel++) {
+                    my_memcpy_to_param(ctx, output, channel * new_H * new_W + output_h * new_W, nchw_buffer + channel * new_W, new_W * sizeof(int16_t), 0);
+                }
+            }
+        }
+        output_offset = row_offset + output_row_len;
+#if HAWAII
+        uint16_t finished_values = output_offset / BATCH_SIZE * BATCH_SIZE;
+        if (finished_values > recorded_values) {
+            write_hawaii_layer_footprint(ctx, ctx->model_vm.layer_idx, finished_values - recorded_values);
+            recorded_values = finished_values;
+        }
+#endif
+    }
+    return output_offset;
+}
+
 #if STATEFUL
 static inline void offset_vector(int16_t* const buffer, int16_t offset, uint8_t len, const uint16_t output_offset, const uint16_t next_output_turning_point) {
     int16_t cur_offset = offset;
@@ -119,54 +219,59 @@ static inline void offset_vector(int16_t* const buffer, int16_t offset, uint8_t
 }
 #endif
 
-void handle_maxpool(Model *model, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
+void handle_maxpool(InferenceContext *ctx, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
     my_printf_debug("MaxPool!" NEWLINE);
 
     /* XXX: add flags; assume no padding for now */
     const ParameterInfo *data = input[0];
 
-    MaxPoolParams* maxpool_params = &maxpool_params_obj;
+    MaxPoolParams* maxpool_params = &ctx->maxpool_params;
     maxpool_params->data = data;
     maxpool_params->output = output;
-    maxpool_params->model = model;
+    maxpool_params->ctx = ctx;
 
     const uint16_t CHANNEL = data->dims[1], OUTPUT_CHANNEL = output->dims[1];
 
     uint16_t output_h = 0, output_w = 0, c = 0;
     uint16_t output_offset = 0;
 
+    uint32_t first_unfinished_value_offset = 0;
 #if INTERMITTENT
-    uint32_t first_unfinished_value_offset = batch_start(job_index_to_offset(output, run_recovery(model, output)));
+    first_unfinished_value_offset = batch_start(job_index_to_offset(output, run_recovery(ctx, output)));
     if (first_unfinished_value_offset * sizeof(int16_t) == output->params_len) {
         // give up early, or initial_real_tile_c may be zero and results in SIGFPE
         goto finished;
     }
+#endif
 
-    uint16_t initial_c, initial_h, initial_w;
-
-    output_offset = first_unfinished_value_offset;
-    if (!maxpool_params->need_nhwc2nchw) {
-        initial_c = first_unfinished_value_offset % OUTPUT_CHANNEL;
-        first_unfinished_value_offset /= OUTPUT_CHANNEL;
-        initial_w = first_unfinished_value_offset % maxpool_params->new_W;
-        first_unfinished_value_offset /= maxpool_params->new_W;
-        initial_h = first_unfinished_value_offset % maxpool_params->new_H;
+    if (maxpool_line_buffer_usable(maxpool_params)) {
+        output_offset = maxpool_rows(maxpool_params, output, first_unfinished_value_offset);
     } else {
-        initial_w = first_unfinished_value_offset % maxpool_params->new_W;
-        first_unfinished_value_offset /= maxpool_params->new_W;
-        initial_h = first_unfinished_value_offset % maxpool_params->new_H;
-        first_unfinished_value_offset /= maxpool_params->new_H;
-        initial_c = first_unfinished_value_offset % OUTPUT_CHANNEL;
-    }
-    output_h = initial_h;
-    output_w = initial_w;
-    c = initial_c;
-    my_printf_debug("initial_h = %d" NEWLINE, initial_h);
-    my_printf_debug("initial_w = %d" NEWLINE, initial_w);
-    my_printf_debug("initial_c = %d" NEWLINE, initial_c);
+#if INTERMITTENT
+        uint16_t initial_c, initial_h, initial_w;
+
+        output_offset = first_unfinished_value_offset;
+        if (!maxpool_params->need_nhwc2nchw) {
+            initial_c = first_unfinished_value_offset % OUTPUT_CHANNEL;
+            first_unfinished_value_offset /= OUTPUT_CHANNEL;
+            initial_w = first_unfinished_value_offset % maxpool_params->new_W;
+            first_unfinished_value_offset /= maxpool_params->new_W;
+            initial_h = first_unfinished_value_offset % maxpool_params->new_H;
+        } else {
+            initial_w = first_unfinished_value_offset % maxpool_params->new_W;
+            first_unfinished_value_offset /= maxpool_params->new_W;
+            initial_h = first_unfinished_value_offset % maxpool_params->new_H;
+            first_unfinished_value_offset /= maxpool_params->new_H;
+            initial_c = first_unfinished_value_offset % OUTPUT_CHANNEL;
+        }
+        output_h = initial_h;
+        output_w = initial_w;
+        c = initial_c;
+        my_printf_debug("initial_h = %d" NEWLINE, initial_h);
+        my_printf_debug("initial_w = %d" NEWLINE, initial_w);
+        my_printf_debug("initial_c = %d" NEWLINE, initial_c);
 #endif
 
-    {
         if (!maxpool_params->need_nhwc2nchw) {
             // NHWC
             for (; output_h < maxpool_params->new_H; output_h++) {
@@ -186,9 +291,9 @@ void handle_maxpool(Model *model, const ParameterInfo *input[], ParameterInfo *o
                     }
                     my_printf_debug(NEWLINE);
 #endif
-                    my_memcpy_to_param(output, output_offset, lea_buffer, len * sizeof(int16_t), 0);
+                    my_memcpy_to_param(ctx, output, output_offset, lea_buffer, len * sizeof(int16_t), 0);
 #if HAWAII
-                    hawaii_record_footprints(model, len);
+                    hawaii_record_footprints(ctx, len);
 #endif
                     output_offset += len;
                     c = 0;
@@ -213,10 +318,10 @@ void handle_maxpool(Model *model, const ParameterInfo *input[], ParameterInfo *o
                         }
                         my_printf_debug("output_offset=% 5d ", output_offset);
                         my_printf_debug("max=% 6d " NEWLINE, lea_buffer[0]);
-                        put_q15_param(output, output_offset, lea_buffer[0]);
+                        put_q15_param(ctx, output, output_offset, lea_buffer[0]);
 #if HAWAII
                         if (offset_has_state(output_offset)) {
-                            write_hawaii_layer_footprint(model->layer_idx, BATCH_SIZE);
+                            write_hawaii_layer_footprint(ctx, ctx->model_vm.layer_idx, BATCH_SIZE);
                         }
 #endif
                         output_offset++;
@@ -235,18 +340,18 @@ void handle_maxpool(Model *model, const ParameterInfo *input[], ParameterInfo *o
 
 #if INTERMITTENT
 finished:
-    flip_state_bit(model, output);
+    flip_state_bit(ctx, output);
 #endif
 
     my_printf_debug("handle_maxpool output" NEWLINE);
     if (!maxpool_params->need_nhwc2nchw) {
-        dump_params_nhwc_debug(model, output, node->output_name);
+        dump_params_nhwc_debug(ctx, output, node->output_name);
     } else {
-        dump_params_debug(model, output, node->output_name);
+        dump_params_debug(ctx, output, node->output_name);
     }
 }
 
-void alloc_globalaveragepool(Model *model, const ParameterInfo *input[], ParameterInfo *output, const Node*) {
+void alloc_globalaveragepool(InferenceContext *ctx, const ParameterInfo *input[], ParameterInfo *output, const Node*) {
     const ParameterInfo *data = input[0];
 
     MY_ASSERT(data->dims[0] == 1);
@@ -255,52 +360,105 @@ void alloc_globalaveragepool(Model *model, const ParameterInfo *input[], Paramet
     output->dims[0] = output->dims[2] = output->dims[3] = 1;
     output->dims[1] = output_len;
     output->params_len = output_len * sizeof(int16_t);
+#if HAWAII
+    // Two copies of 32-bit partial sums after outputs (see handle_globalaveragepool)
+    output->params_len += 2 * output_len * sizeof(int32_t);
+#endif
     output->bitwidth = 16;
-    output->slot = get_next_slot(model, data);
+    output->slot = get_next_slot(ctx);
 }
 
-void handle_globalaveragepool(Model *model, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
+static void accumulate_pixels(int32_t *accumulators, const int16_t *buffer, uint16_t CHANNEL, uint16_t n_pixels) {
+    consume_cpu_energy(CpuOp::ADD, CHANNEL * n_pixels);
+    for (uint16_t pixel = 0; pixel < n_pixels; pixel++) {
+        for (uint16_t channel = 0; channel < CHANNEL; channel++) {
+            int16_t val = buffer[channel];
+#if STATEFUL
+            start_cpu_counter();
+            if (offset_has_state(channel)) {
+                strip_state(&val);
+            }
+            val *= 2;
+            stop_cpu_counter(&Counters::stripping);
+#endif
+            accumulators[channel] += val;
+        }
+        buffer += CHANNEL;
+    }
+}
+
+#if HAWAII
+// Offset (in words) of the copy of partial sums for input values before data_offset
+static uint16_t gap_accumulators_offset(uint16_t CHANNEL, uint16_t data_offset, uint16_t chunk_len) {
+    uint16_t n_finished_chunks = (data_offset + chunk_len - 1) / chunk_len;
+    return CHANNEL + n_finished_chunks % 2 * CHANNEL * sizeof(int32_t) / sizeof(int16_t);
+}
+#endif
+
+void handle_globalaveragepool(InferenceContext *ctx, const ParameterInfo *input[], ParameterInfo *output, const Node* node) {
     my_printf_debug("GlobalAveragePool!" NEWLINE);
 
     const ParameterInfo *data = input[0];
 
+    uint16_t CHANNEL = data->dims[1], H = data->dims[2], W = data->dims[3];
+    uint16_t len = H * W;
+
+    /* NHWC inputs are loaded in chunks of whole pixels, and sums of all
+     * channels are accumulated at once. Under HAWAII, sums are preserved in
+     * the output slot after each chunk, alternating between two copies so
+     * that a chunk interrupted before its footprint is re-executed from
+     * intact sums. */
+    int32_t *accumulators = reinterpret_cast<int32_t*>(lea_buffer);
+    int16_t *output_buffer = lea_buffer + 2 * CHANNEL,
+            *input_buffer = output_buffer + CHANNEL;
+    uint16_t chunk_pixels = MIN_VAL((LEA_BUFFER_SIZE - 3 * CHANNEL) / CHANNEL, len);
+    MY_ASSERT(chunk_pixels > 0);
+    uint16_t chunk_len = chunk_pixels * CHANNEL, data_len = len * CHANNEL;
+    MY_ASSERT(chunk_len % BATCH_SIZE == 0);
+
+    uint16_t data_offset = 0;
+#if HAWAII
+    data_offset = batch_start(job_index_to_offset(output, run_recovery(ctx, output)));
+    my_printf_debug("first_unfinished_value_offset: %d" NEWLINE, data_offset);
+    MY_ASSERT(data_offset % chunk_len == 0 || data_offset == data_len);
+    if (data_offset) {
+        my_memcpy_from_param(ctx, accumulators, output, gap_accumulators_offset(CHANNEL, data_offset, chunk_len), CHANNEL * sizeof(int32_t));
+    } else
+#endif
+    {
+        my_fill_q15(0, lea_buffer, 2 * CHANNEL);
+    }
+
+    while (data_offset < data_len) {
+        uint16_t cur_chunk_len = MIN_VAL(chunk_len, data_len - data_offset);
+        my_printf_debug("input_offset=%d len=%d" NEWLINE, data_offset, cur_chunk_len);
+        my_memcpy_from_param(ctx, input_buffer, data, data_offset, cur_chunk_len * sizeof(int16_t));
+        accumulate_pixels(accumulators, input_buffer, CHANNEL, cur_chunk_len / CHANNEL);
+        data_offset += cur_chunk_len;
+#if HAWAII
+        my_memcpy_to_param(ctx, output, gap_accumulators_offset(CHANNEL, data_offset, chunk_len), accumulators, CHANNEL * sizeof(int32_t), 0);
+        write_hawaii_layer_footprint(ctx, ctx->model_vm.layer_idx, cur_chunk_len);
+#endif
+    }
+
 #if STATEFUL
     int16_t offset;
     uint16_t next_output_turning_point;
     uint8_t output_turning_point_idx;
     SlotInfo *output_slot_info;
-    find_initial_state_bit(&offset, &output_turning_point_idx, &next_output_turning_point, &output_slot_info, 0 /*TODO: first_unfinished_value_offset*/, model, output);
+    find_initial_state_bit(&offset, &output_turning_point_idx, &next_output_turning_point, &output_slot_info, 0, ctx, output);
     offset = -offset;
 #endif
 
-    uint16_t CHANNEL = data->dims[1], H = data->dims[2], W = data->dims[3];
-    uint16_t len = H * W;
-    uint16_t output_channel = 0;
-    for (uint16_t input_channel = 0; input_channel < CHANNEL; input_channel++) {
+    for (uint16_t output_channel = 0; output_channel < CHANNEL; output_channel++) {
         int16_t output_val;
 #if JAPARI
-        if (offset_has_state(input_channel)) {
-            output_val = -param_state_bit(model, output, output_channel);
+        if (offset_has_state(output_channel)) {
+            output_val = -param_state_bit(ctx, output, output_channel);
         } else
 #endif
         {
-            uint32_t total = 0;
-            for (uint16_t h = 0; h < H; h++) {
-                for (uint16_t w = 0; w < W; w++) {
-                    // Input is from Conv, which uses NHWC
-                    int16_t val = get_q15_param(model, data, h * W * CHANNEL + w * CHANNEL + input_channel);
-#if STATEFUL
-                    start_cpu_counter();
-                    if (offset_has_state(input_channel)) {
-                        strip_state(&val);
-                    }
-                    val *= 2;
-                    stop_cpu_counter(&Counters::stripping);
-#endif
-                    total += val;
-                }
-            }
-            output_val = total / len;
+            output_val = accumulators[output_channel] / len;
 #if STATEFUL
             output_val /= 2;
             if (offset_has_state(output_channel)) {
@@ -309,11 +467,15 @@ void handle_globalaveragepool(Model *model, const ParameterInfo *input[], Parame
             }
 #endif
         }
-        put_q15_param(output, output_channel, output_val);
-        output_channel++;
+        output_buffer[output_channel] = output_val;
     }
+    my_memcpy_to_param(ctx, output, 0, output_buffer, CHANNEL * sizeof(int16_t), 0);
+#if HAWAII
+    // partial sums are no longer needed
+    output->params_len = CHANNEL * sizeof(int16_t);
+#endif
 
-    flip_state_bit(model, output);
+    flip_state_bit(ctx, output);
 
-    dump_params_debug(model, output, node->output_name);
+    dump_params_debug(ctx, output, node->output_name);
 }
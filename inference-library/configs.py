@@ -4,7 +4,7 @@ from utils import (
     load_har,
 )
 
-# intermediate_values_size should < 65536, or TI's compiler gets confused
+# intermediate_values_size limits the output of a node, and should < 65536, or TI's compiler gets confused
 configs = {
     'pruned_cifar10': {
         'onnx_model': {
@@ -13,7 +13,6 @@ configs = {
         },
         'scale': 2,
         'input_scale': 4,
-        'num_slots': 3,
         'intermediate_values_size': 65000,
         'data_loader': load_data_cifar10,
         'n_all_samples': 10000,
@@ -29,7 +28,6 @@ configs = {
         },
         'scale': 1.6,
         'input_scale': 120,
-        'num_slots': 2,
         'intermediate_values_size': 65535,
         'data_loader': load_data_google_speech_cnn,
         'n_all_samples': 4890,
@@ -45,7 +43,6 @@ configs = {
         },
         'scale': 2,
         'input_scale': 16,
-        'num_slots': 2,
         'intermediate_values_size': 20000,
         'data_loader': load_har,
         'n_all_samples': 2947,
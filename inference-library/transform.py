@@ -15,7 +15,7 @@ import warnings
 import sys
 import os
 # warnings.simplefilter("ignore", UserWarning)
-from typing import List
+from typing import Dict, List
 from scipy.sparse import bsr_matrix
 
 import onnx
@@ -29,7 +29,8 @@ cwd = os.getcwd()
 from configs import configs
 sys.path.append(cwd + '/../')
 from pruning.config import config as model_configs
-from utils import extract_data, find_initializer, find_node_by_output, find_node_by_input, find_tensor_value_info, load_model, get_model_ops, OPS_WITH_MERGE, DataLayout
+from utils import extract_data, find_initializer, find_node_by_output, find_node_by_input, find_tensor_value_info, load_model, get_model_ops, OPS_WITH_MERGE, DataLayout, \
+    to_bytes, nhwc2conv_tiles, quantize_conv_filters, pack_weights
 
 logging.basicConfig()
 logger = logging.getLogger(__name__)
@@ -58,12 +59,17 @@ class Constants:
     MAX_ROW_LEN_CONV = 0
     MAX_N_FILTER_GROUP = 0
     NUM_INPUTS = 0  # will be filled during parsing
+    # Slots and the area for intermediate values, filled by plan_intermediate_values()
+    NUM_SLOTS = 0
+    INTERMEDIATE_VALUES_ARENA_SIZE = 0
     N_INPUT = 0
     # Match the size of external FRAM
     NVM_SIZE = 512 * 1024
     N_SAMPLES = 20
     # to make the code clearer; used in Conv
     TEMP_FILTER_WIDTH = 1
+    # Spatial tilings for each Conv node. Filter layouts depend on channels only, so tilings share them
+    CONV_TILINGS_LEN = 2
     LEA_BUFFER_SIZE = 0
     CPU_BUFFER_SIZE = 0
     ARM_PSTATE_LEN = 8704
@@ -74,6 +80,8 @@ class Constants:
     BATCH_SIZE = 1
     STATEFUL = 0
     HAWAII = 0
+    # HAWAII footprints in an append-only journal instead of shadow copies in nodes (--journal)
+    HAWAII_JOURNAL = 0
     JAPARI = 0
     INTERMITTENT = 0
     INDIRECT_RECOVERY = 0
@@ -97,6 +105,9 @@ other_flags = [
     # parameter flags
     'CHANNEL_FIRST',
     'SEPARATE_TILING',  # Tiles in different channels are actually in different slots
+
+    # node flags for Conv with fused epilogues (see fuse_conv_epilogues)
+    'FUSED_RELU',
 ]
 
 def op_flag(flag):
@@ -122,13 +133,22 @@ def _Q15(arr, name):
     return (arr * 2 ** 15).astype(int)
 
 # https://stackoverflow.com/a/11481471/3786245
+class ConvTiling(ctypes.Structure):
+    _fields_ = [
+        ("output_tile_w", ctypes.c_uint8),
+        ("output_tile_h", ctypes.c_uint8),
+        # precomputed as the runtime avoids divisions (no hardware divider on MSP430)
+        ("n_tiles_w", ctypes.c_uint8),
+        ("n_tiles_h", ctypes.c_uint8),
+    ]
+
 class ConvNodeFlags(ctypes.Structure):
     _fields_ = [
         ("input_tile_c", ctypes.c_uint16),
         ("output_tile_c", ctypes.c_uint16),
-        ("output_tile_w", ctypes.c_uint16),
-        ("output_tile_h", ctypes.c_uint16),
         ("pads", ctypes.c_uint8 * 4),
+        # candidates from large to small; the runtime picks one for each run of the layer
+        ("tilings", ConvTiling * Constants.CONV_TILINGS_LEN),
     ]
 
 class MaxPoolFlags(ctypes.Structure):
@@ -172,7 +192,7 @@ class NodeFlags_bits(ctypes.LittleEndianStructure):
 class NodeFlags(ctypes.Union):
     _fields_ = [
         ("b", NodeFlags_bits),
-        ("as_bytes", ctypes.c_uint8 * 16),
+        ("as_bytes", ctypes.c_uint8 * 20),
     ]
 
     def __repr__(self):
@@ -220,6 +240,10 @@ parser.add_argument('--debug', action='store_true')
 parser.add_argument('--sparse', action='store_true')
 parser.add_argument('--stable-power', action='store_true')
 parser.add_argument('--pbin', action='store_true')
+parser.add_argument('--journal', action='store_true',
+                    help='record HAWAII footprints in an append-only journal')
+parser.add_argument('--weight-bitwidth', type=int, choices=(16, 8, 4), default=16,
+                    help='store Conv filters as int8 or packed int4 with a scale for each output channel')
 intermittent_methodology = parser.add_mutually_exclusive_group(required=True)
 intermittent_methodology.add_argument('--baseline', action='store_true')
 intermittent_methodology.add_argument('--hawaii', action='store_true')
@@ -247,12 +271,18 @@ if args.stateful:
 if args.hawaii:
     Constants.HAWAII = 1
     Constants.METHOD = "HAWAII"
+if args.journal:
+    if not args.hawaii:
+        parser.error('--journal is only for --hawaii')
+    Constants.HAWAII_JOURNAL = 1
 if args.japari:
     Constants.JAPARI = 1
     Constants.METHOD = "JAPARI"
     config['intermediate_values_size'] *= 2
 if args.sparse:
     Constants.SPARSE = 1
+    if args.weight_bitwidth < 16:
+        parser.error('--weight-bitwidth is not supported for sparse filters')
 if args.stable_power:
     Constants.STABLE_POWER = 1
 Constants.INTERMITTENT = Constants.STATEFUL | Constants.HAWAII | Constants.JAPARI
@@ -369,8 +399,50 @@ for n in new_nodes:
 
 nodes = [ONNXNodeWrapper(n) for n in new_nodes]
 
+def needs_nhwc2nchw(n):
+    # Should match how NHWC2NCHW is set for nodes before Reshape below
+    for consumer in nodes:
+        if n.output[0] not in consumer.input:
+            continue
+        if consumer.op_type == 'Reshape':
+            return True
+        if consumer.op_type in inplace_update_ops and needs_nhwc2nchw(consumer):
+            return True
+    return False
+
+def fuse_conv_epilogues():
+    """Merge Relu after Conv into the Conv node, so that it is applied to
+    output tiles before tiles are written to NVM. MaxPool is not merged, as
+    its windows overlap across output tiles, whose final values exist only
+    after partial sums are merged, possibly over several power cycles."""
+    global nodes
+
+    # Values carry state bits or footprints with indirect recovery
+    if Constants.INDIRECT_RECOVERY:
+        return
+
+    fused_nodes = []
+    for n in nodes:
+        if n.op_type != 'Conv':
+            continue
+        consumers = [consumer for consumer in nodes if n.output[0] in consumer.input]
+        if len(consumers) != 1 or consumers[0].op_type != 'Relu' or needs_nhwc2nchw(consumers[0]):
+            continue
+        relu = consumers[0]
+        logger.info('Fusing %s into %s', relu.name or relu.op_type, n.name or n.op_type)
+        n.flags.b.generic += op_flag('FUSED_RELU')
+        # Set on the wrapper to keep the ONNX graph as is
+        n.output = list(relu.output)
+        fused_nodes.append(relu)
+
+    nodes = [n for n in nodes if n not in fused_nodes]
+
+fuse_conv_epilogues()
+
 conv_param_names = set()
 gemm_param_names = set()
+# Conv nodes indexed by names of filters, for tile sizes used in filter layouts
+conv_filter_nodes = {}
 
 for idx, inp in enumerate(onnx_model.graph.input):
     names[inp.name] = idx
@@ -413,6 +485,7 @@ for idx, n in enumerate(nodes):
         output = n.output
     if n.op_type == 'Conv':
         conv_param_names.add(n.input[1])
+        conv_filter_nodes[n.input[1]] = n
         infer_auto_pad(n)
         strides = get_attr(n, 'strides')
         n.flags.b.stride = (ctypes.c_uint8*2)(*strides)
@@ -478,7 +551,8 @@ def determine_conv_tile_c(n, node_idx):
         is_separate_tiling = False
         if not find_initializer(onnx_model, n.input[0]):
             input_node = find_node_by_output(onnx_model.graph.node, n.input[0])
-            if input_node and input_node.op_type == 'Concat':
+            # Otherwise, inputs of Concat are placed as one tensor (see place_concat_inputs)
+            if input_node and input_node.op_type == 'Concat' and Constants.INDIRECT_RECOVERY:
                 is_separate_tiling = True
 
         shape = output_value_info.type.tensor_type.shape
@@ -537,9 +611,19 @@ def determine_conv_tile_c(n, node_idx):
             if output_tile_w < 1 or input_tile_w < 1:
                 print("Input channel or output channel may be too large")
                 exit()
-        node_flags.output_tile_w = output_tile_w
-        node_flags.output_tile_h = output_tile_h
         node_flags.output_tile_c = output_tile_c
+        # The first tiling is the tuned one. Later ones are smaller, for losing less work in power
+        # failures under weak power.
+        for tiling in node_flags.tilings:
+            assert output_tile_w < 256 and output_tile_h < 256
+            tiling.output_tile_w = output_tile_w
+            tiling.output_tile_h = output_tile_h
+            tiling.n_tiles_w = (OUTPUT_W + output_tile_w - 1) // output_tile_w
+            tiling.n_tiles_h = (OUTPUT_H + output_tile_h - 1) // output_tile_h
+            output_tile_w = max(1, (output_tile_w + 1) // 2)
+            output_tile_h = max(1, (output_tile_h + 1) // 2)
+        # For sizes of intermediate values (see intermediate_values_len)
+        n.output_shape = (OUTPUT_H, OUTPUT_W, OUTPUT_CHANNEL)
     else:
         print("Please select configed model.")
         exit()
@@ -547,8 +631,7 @@ def determine_conv_tile_c(n, node_idx):
     '''
     print('input_tile_c: {}'.format(node_flags.input_tile_c))
     print('output_tile_c: {}'.format(node_flags.output_tile_c))
-    print('output_tile_w: {}'.format(node_flags.output_tile_w))
-    print('output_tile_h: {}'.format(node_flags.output_tile_h))
+    print('tilings: {}'.format([(tiling.output_tile_w, tiling.output_tile_h) for tiling in node_flags.tilings]))
     '''
 
 def determine_gemm_tile_sizes(n, node_idx):
@@ -623,6 +706,184 @@ for idx, node in enumerate(graph):
         used_node = graph[inp - Constants.N_INPUT]
         used_node.max_output_id = max([used_node.max_output_id, node.max_output_id])
 
+@dataclasses.dataclass
+class IntermediateValues:
+    producer: int
+    size: int  # in bytes
+    last_use: int
+    slot: int = -1
+    offset: int = -1  # from INTERMEDIATE_VALUES_OFFSET
+    # For outputs of Concat inputs placed in that of Concat (see place_concat_inputs)
+    channel_stride: int = 0
+    channel_offsets: Dict[int, int] = dataclasses.field(default_factory=dict)  # by producers
+
+def tensor_len(name):
+    shape = find_tensor_value_info(onnx_model, name).type.tensor_type.shape
+    # Symbolic dimensions (ex: N) have dim_value 0, and batches are processed one by one
+    return 2 * math.prod(dim.dim_value or 1 for dim in shape.dim)
+
+def intermediate_values_len(n, input_len, channel_stride=None):
+    """Upper bounds of params_len set by allocators (alloc_* in common/), in
+    bytes. Allocators not setting params_len keep that of the first input."""
+    if n.op_type == 'Conv':
+        OUTPUT_H, OUTPUT_W, OUTPUT_CHANNEL = n.output_shape
+        # Values of a pixel are further apart for outputs placed in that of Concat
+        OUTPUT_CHANNEL = channel_stride or OUTPUT_CHANNEL
+        node_flags = n.flags.b.extra.conv
+        if Constants.STABLE_POWER:
+            ret = 2 * OUTPUT_H * OUTPUT_W * OUTPUT_CHANNEL
+        else:
+            # two copies of outputs and a tile of partial sums
+            tiling = node_flags.tilings[0]
+            ret = 2 * (2 * OUTPUT_H * OUTPUT_W * OUTPUT_CHANNEL + tiling.output_tile_h * tiling.output_tile_w * node_flags.output_tile_c)
+    elif n.op_type == 'MaxPool':
+        _, CHANNEL, H, W = find_tensor_value_info(onnx_model, n.input[0]).type.tensor_type.shape.dim
+        strides = n.flags.b.extra.maxpool.strides
+        ret = 2 * (H.dim_value // strides[0]) * (W.dim_value // strides[1]) * CHANNEL.dim_value
+    elif n.op_type == 'GlobalAveragePool':
+        CHANNEL = find_tensor_value_info(onnx_model, n.input[0]).type.tensor_type.shape.dim[1].dim_value
+        ret = 2 * CHANNEL
+        if Constants.HAWAII:
+            # 32-bit partial sums
+            ret += 2 * 4 * CHANNEL
+    elif n.op_type == 'Gemm':
+        B = find_initializer(onnx_model, n.input[1])
+        ret = 2 * B.dims[1] * math.ceil(B.dims[0] / n.flags.b.extra.gemm.tile_channel)
+    elif n.op_type == 'GemmMerge':
+        ret = tensor_len(n.output[0])
+    else:
+        return input_len
+    if Constants.JAPARI:
+        # Values are interleaved with footprints (see intermediate_values_size above)
+        ret *= 2
+    return ret
+
+def can_overwrite_input(n):
+    """Whether the output can overwrite the first input if nobody else uses it"""
+    # Values carry state bits or footprints with indirect recovery
+    if Constants.INDIRECT_RECOVERY:
+        return False
+    if n.op_type == 'Relu':
+        # Blocks re-executed after power failures are idempotent. Transposing moves values across blocks.
+        return not (n.flags.b.generic & op_flag('NHWC2NCHW'))
+    if n.op_type in ('BatchNormalization', 'Add'):
+        # Not idempotent, and power failures may interrupt writing a batch of values
+        return Constants.STABLE_POWER
+    return False
+
+def place_concat_inputs(idx, values):
+    """Place outputs of Concat inputs in one buffer, so that Concat needs no
+    copies. Values of an input follow those of the previous input in each pixel
+    (NHWC), and Conv nodes producing inputs write pixels with a stride of all
+    channels (see OUTPUT_CHANNEL_STRIDE in common/)."""
+    n = nodes[idx]
+    assert get_attr(n, 'axis') == 1, f'{n.name} should concatenate channels'
+    n_channels = [find_tensor_value_info(onnx_model, name).type.tensor_type.shape.dim[1].dim_value for name in n.input]
+    channel_stride = sum(n_channels)
+    value = values[graph[idx].inputs[0] - Constants.N_INPUT]
+    channel_offset = 0
+    for inp, channels in zip(graph[idx].inputs, n_channels):
+        producer_idx = inp - Constants.N_INPUT
+        producer = nodes[producer_idx]
+        assert producer_idx >= 0 and producer.op_type == 'Conv', f'Inputs of {n.name} should be outputs of Conv'
+        assert sum(inp in other.inputs for other in graph) == 1, f'Output of {producer.name} should be used by {n.name} only'
+        value.producer = min(value.producer, producer_idx)
+        value.size = max(value.size, 2 * channel_offset + intermediate_values_len(producer, None, channel_stride))
+        value.channel_offsets[producer_idx] = channel_offset
+        values[producer_idx] = value
+        channel_offset += channels
+    value.channel_stride = channel_stride
+    assert value.size <= config['intermediate_values_size'], f'Output of {n.name} is too large ({value.size} bytes)'
+    return value
+
+def plan_intermediate_values():
+    """Assign each node output a slot and an offset in a shared area, packing
+    outputs by lifetimes. Slots are still distinct for outputs used at the
+    same time, for states of slots (SlotInfo) in indirect recovery."""
+
+    # Outputs of Concat and in-place operations reuse those of inputs
+    values = []
+    for idx, n in enumerate(nodes):
+        inp = graph[idx].inputs[0]
+        # With indirect recovery, values of Concat inputs are in different slots and kept as is
+        if n.op_type == 'Concat' and not Constants.INDIRECT_RECOVERY:
+            values.append(place_concat_inputs(idx, values))
+            continue
+        if n.op_type in inplace_update_ops or n.op_type == 'Concat':
+            values.append(values[inp - Constants.N_INPUT] if inp >= Constants.N_INPUT else None)
+            continue
+        if inp >= Constants.N_INPUT:
+            input_len = values[inp - Constants.N_INPUT].size
+        else:
+            input_len = tensor_len(n.input[0])
+        size = intermediate_values_len(n, input_len)
+        assert size <= config['intermediate_values_size'], f'Output of {n.name} is too large ({size} bytes)'
+        values.append(IntermediateValues(producer=idx, size=size, last_use=idx))
+
+    for idx, node in enumerate(graph):
+        for inp in node.inputs:
+            if inp >= Constants.N_INPUT and values[inp - Constants.N_INPUT]:
+                values[inp - Constants.N_INPUT].last_use = max(values[inp - Constants.N_INPUT].last_use, idx)
+    # Inputs of Concat other than the first one are read via the output of Concat
+    for idx in reversed(range(len(graph))):
+        if nodes[idx].op_type != 'Concat' or not values[idx]:
+            continue
+        for inp in graph[idx].inputs[1:]:
+            if inp >= Constants.N_INPUT:
+                values[inp - Constants.N_INPUT].last_use = max(values[inp - Constants.N_INPUT].last_use, values[idx].last_use)
+    # The model output is read after the last node
+    if values[-1]:
+        values[-1].last_use = len(graph)
+
+    # Elementwise operations update inputs used by nobody later in place
+    for idx, n in enumerate(nodes):
+        inp = graph[idx].inputs[0]
+        if inp < Constants.N_INPUT or not can_overwrite_input(n):
+            continue
+        input_value, value = values[inp - Constants.N_INPUT], values[idx]
+        if input_value.last_use != idx:
+            continue
+        assert value.size <= input_value.size
+        logger.info('Running %s in place', n.name)
+        input_value.last_use = value.last_use
+        values = [input_value if other is value else other for other in values]
+
+    buffers = [value for idx, value in enumerate(values) if value and value.producer == idx]
+    def overlapped(a, b):
+        return a.producer <= b.last_use and b.producer <= a.last_use
+
+    # A slot is reused once the previous output in it is no longer used
+    slot_last_uses = []
+    for buffer in buffers:
+        for slot, last_use in enumerate(slot_last_uses):
+            if last_use < buffer.producer:
+                break
+        else:
+            slot = len(slot_last_uses)
+            slot_last_uses.append(None)
+        slot_last_uses[slot] = buffer.last_use
+        buffer.slot = slot
+    assert len(slot_last_uses) <= Constants.SLOT_CONSTANTS_MIN
+
+    # Large outputs first, each at the lowest offset not overlapping outputs used at the same time
+    placed = []
+    for buffer in sorted(buffers, key=lambda buffer: (-buffer.size, buffer.producer)):
+        offset = 0
+        for other in sorted((other for other in placed if overlapped(buffer, other)), key=lambda other: other.offset):
+            if offset + buffer.size <= other.offset:
+                break
+            offset = max(offset, other.offset + other.size)
+        buffer.offset = offset
+        placed.append(buffer)
+
+    Constants.NUM_SLOTS = len(slot_last_uses)
+    Constants.INTERMEDIATE_VALUES_ARENA_SIZE = max((buffer.offset + buffer.size for buffer in buffers), default=0)
+    logger.info('Intermediate values: %d slots, %d bytes (%d bytes without planning)', Constants.NUM_SLOTS,
+                Constants.INTERMEDIATE_VALUES_ARENA_SIZE, Constants.NUM_SLOTS * max((buffer.size for buffer in buffers), default=0))
+    return values
+
+intermediate_values = plan_intermediate_values()
+
 parameters = [None for _ in range(Constants.N_INPUT)]
 
 for params in onnx_model.graph.initializer:
@@ -634,19 +895,6 @@ for params in onnx_model.graph.initializer:
 
 pprint.pprint(graph)
 
-def to_bytes(arr, size=16):
-    if not np.shape(arr):
-        arr = [arr]
-    FORMAT_CHARS = {
-        8: 'B',  # unsigned char
-        16: 'h',
-        32: 'i',
-        64: 'q'
-    }
-    if size not in FORMAT_CHARS:
-        raise ValueError(f'Unsupported size {size}')
-    return struct.pack('%u%c' % (len(arr), FORMAT_CHARS[size]), *arr)
-
 def nchw2nhwc(arr, dims):
     arr = np.reshape(arr, dims)  # Change flattened to 4-D
     arr = np.transpose(arr, axes=(0, 2, 3, 1))  # NCHW -> NHWC
@@ -698,7 +946,7 @@ model = outputs['model']
 model.write(to_bytes(0))  # Model.running
 model.write(to_bytes(0))  # Model.run_counter
 model.write(to_bytes(0))  # Model.layer_idx
-for _ in range(config['num_slots']): # Model.slots_info
+for _ in range(Constants.NUM_SLOTS): # Model.slots_info
     if Constants.INDIRECT_RECOVERY:
         model.write(to_bytes(1, size=8)) # SlotInfo.state_bit
         model.write(to_bytes(0, size=8)) # SlotInfo.n_turning_points
@@ -878,15 +1126,109 @@ param_limits = {}
 def get_param_limit(model, node, float_data):
     return max([abs(data) for data in float_data]) * 1.5
 
-def write_scale(dest, scale):
+def to_scale_params(scale):
     shift = 0
     while scale >= 1:
         shift += 1
         scale /= 2
-    dest.write(to_bytes(int(scale*2**15)))             # scale.fract
+    return int(scale*2**15), shift
+
+def write_scale(dest, scale):
+    fract, shift = to_scale_params(scale)
+    dest.write(to_bytes(fract))             # scale.fract
     dest.write(to_bytes(shift, size=8))     # scale.shift
     dest.write(to_bytes(0, size=8))         # scale.dummy
 
+# Filter scales for Conv nodes producing Concat inputs (see determine_conv_input_scales)
+unified_params_scales = {}
+
+def determine_params_scale(params):
+    if params.name in unified_params_scales:
+        return unified_params_scales[params.name]
+    used_node = find_node_by_input(onnx_model.graph.node, params.name)
+    if used_node.op_type in ('Conv', 'Gemm'):
+        return config['scale']
+    elif used_node.op_type in ('BatchNormalization'):
+        return get_param_limit(onnx_model, used_node, get_float_data(params))
+    else:
+        return config['scale']
+
+def scale_on_device(fract, shift):
+    # Scale::toFloat(). Scales are computed with float (float32) on devices,
+    # and values derived from scales should be computed in the same way
+    return np.float32(fract) * np.float32(1 << shift) / np.float32(32768)
+
+def rescale_on_device(scale):
+    # Scale::fromFloat() followed by Scale::toFloat()
+    scale = np.float32(scale)
+    shift = 0
+    while scale >= 1:
+        scale = np.float32(scale / np.float32(2))
+        shift += 1
+    return scale_on_device(int(scale * np.float32(32768)), shift)
+
+def determine_conv_input_scales():
+    """Follow how operator handlers propagate scales, to find scales of conv
+    inputs on devices. Returned values are indexed by names of conv biases.
+    They are stored as scales of conv biases, and handle_conv asserts that
+    they match scales of conv inputs on devices."""
+    scales = {}
+    def get_scale(name):
+        if name not in scales:
+            params = parameters[names[name]]
+            scale = config['input_scale'] if params is None else determine_params_scale(params)
+            scales[name] = scale_on_device(*to_scale_params(scale))
+        return scales[name]
+
+    def unify_scale(name, output_scale):
+        # Values of Concat inputs are not rescaled (see place_concat_inputs). Instead, the Conv
+        # producing an input with a smaller scale uses a larger filter scale
+        if scales[name] == output_scale:
+            return
+        producer = nodes[names[name] - Constants.N_INPUT]
+        X = get_scale(producer.input[0])
+        fract, shift = to_scale_params(output_scale / X)
+        # Scales on devices are rounded
+        for candidate in (fract, fract + 1, fract - 1):
+            filter_scale = scale_on_device(candidate, shift)
+            if rescale_on_device(X * filter_scale) == output_scale:
+                break
+        else:
+            raise Exception(f'Cannot find a filter scale for {producer.name} with output scale {output_scale}')
+        logger.info('Filter scale for %s: %f => %f', producer.name, get_scale(producer.input[1]), filter_scale)
+        scales[producer.input[1]] = unified_params_scales[producer.input[1]] = filter_scale
+        scales[name] = output_scale
+
+    conv_input_scales = {}
+    for n in nodes:
+        X = get_scale(n.input[0])
+        if n.op_type in ('Conv', 'Gemm'):
+            if n.op_type == 'Conv' and len(n.input) > 2:
+                conv_input_scales[n.input[2]] = X
+            output_scale = rescale_on_device(X * get_scale(n.input[1]))
+        elif n.op_type == 'Concat':
+            output_scale = max(get_scale(name) for name in n.input)
+            if not Constants.INDIRECT_RECOVERY:
+                for name in n.input:
+                    unify_scale(name, output_scale)
+        elif n.op_type == 'BatchNormalization':
+            var_scale_sqrt = rescale_on_device(np.sqrt(get_scale(n.input[4])))
+            output_scale = rescale_on_device(rescale_on_device(get_scale(n.input[1]) * X) / var_scale_sqrt)
+        else:
+            output_scale = X
+        for output in n.output:
+            scales[output] = output_scale
+    return conv_input_scales
+
+def prescale_conv_bias(int_data, input_scale):
+    # Conv inputs are extended with _Q15(-1.0) for biases, so biases in filters
+    # are -bias/input_scale. Converting float to int16_t truncates on devices.
+    prescaled = np.trunc(np.float32(-np.asarray(int_data)) / input_scale)
+    assert np.all((prescaled >= -32768) & (prescaled <= 32767))
+    return prescaled.astype(int)
+
+conv_input_scales = determine_conv_input_scales()
+
 model_parameters_info = outputs['model_parameters_info']
 for params in parameters:
     if params is None:  # input
@@ -925,20 +1267,27 @@ for params in parameters:
                 logger.info('Reorder conv param %s', params.name)
                 float_data = nchw2nhwc(float_data, params.dims)
 
-            used_node = find_node_by_input(onnx_model.graph.node, params.name)
-            if used_node.op_type in ('Conv', 'Gemm'):
-                params_scale = config['scale']
-            elif used_node.op_type in ('BatchNormalization'):
-                params_scale = get_param_limit(onnx_model, used_node, float_data)
-            else:
-                params_scale = config['scale']
+            params_scale = determine_params_scale(params)
             '''
             if used_node.op_type in ('Gemm', 'BatchNormalization'):
                 print("=================== {} ===================".format(params.name))
                 print(float_data)
                 print("max: {}, min: {}".format(max(float_data), min(float_data)))
             '''
-            int_data_Q15 = _Q15(np.array(float_data) / params_scale, 'Parameter')
+            bitwidth = 16
+            if params.name in conv_param_names and not args.sparse and args.weight_bitwidth < 16:
+                bitwidth = args.weight_bitwidth
+                int_data_Q15, channel_scales = quantize_conv_filters(np.array(float_data) / params_scale, params.dims, bitwidth)
+            else:
+                int_data_Q15 = _Q15(np.array(float_data) / params_scale, 'Parameter')
+            if params.name in conv_param_names and not args.sparse:
+                # Each filter tile can then be loaded with a single DMA
+                int_data_Q15 = nhwc2conv_tiles(int_data_Q15, params.dims, conv_filter_nodes[params.name].flags.b.extra.conv)
+            if params.name in conv_input_scales and not args.sparse:
+                int_data_Q15 = prescale_conv_bias(int_data_Q15, conv_input_scales[params.name])
+                # Pre-scaled biases are no longer relative to their own scale. The scale of conv inputs is
+                # stored instead, and handle_conv checks it against the scale propagated on devices.
+                params_scale = conv_input_scales[params.name]
 
             if args.sparse:
                 cols = []
@@ -959,11 +1308,16 @@ for params in parameters:
             data_len = len(int_data_Q15)
             assert data_len > 0
             slot = parameters_slot
+            if bitwidth == 16:
+                params_data = to_bytes(int_data_Q15)
+            else:
+                # Scales of output channels follow packed filters (see get_channel_scales)
+                params_data = pack_weights(int_data_Q15, bitwidth) + to_bytes(channel_scales.tolist())
 
             model_parameters_info.write(to_bytes(slot.offset, size=32))  # params_offset
             if Constants.param_bin:
                 model_parameters_info.write(to_bytes(0, size=32))  # params_fram_offset
-            model_parameters_info.write(to_bytes(data_len * 2, size=32))  # A _q15 is 16-bit
+            model_parameters_info.write(to_bytes(len(params_data), size=32))
             # XXX: adjuct the length of cols and rows
             if args.sparse:
                 model_parameters_info.write(to_bytes(slot.cols_offset, size=32))  # cols_offset
@@ -979,9 +1333,9 @@ for params in parameters:
                 slot.rows_offset += 2 * len(rows)
                 slot.first_tile_index_offset += 2 * len(first_tile_index)
 
-            slot.target.write(to_bytes(int_data_Q15))
-            slot.offset += 2 * len(int_data_Q15)
-            model_parameters_info.write(to_bytes(16, size=8)) # bitwidth
+            slot.target.write(params_data)
+            slot.offset += len(params_data)
+            model_parameters_info.write(to_bytes(bitwidth, size=8)) # bitwidth
         elif params.data_type == onnx.TensorProto.INT64:
             if params.int64_data:
                 int64_data = params.int64_data
@@ -1114,9 +1468,8 @@ struct Node;
             val = config[item]
             if not isinstance(val, (int, float, np.int64, np.int32)):
                 continue
-        # Making it long to avoid overflow for expressions like
-        # INTERMEDIATE_VALUES_SIZE * NUM_SLOTS on 16-bit systems
-        suffix = 'l' if item == 'intermediate_values_size' else ''
+        # Making it long to avoid overflow for expressions on 16-bit systems
+        suffix = 'l' if item in ('intermediate_values_size', 'INTERMEDIATE_VALUES_ARENA_SIZE') else ''
         output_h.write(f'#define {item.upper()} ')
         if isinstance(val, str):
             output_h.write(f'"{val}"')
@@ -1138,8 +1491,8 @@ struct Node;
         output_h.write(f'#define Op{op} {idx}\n')
 
     for op in ops:
-        output_h.write('void alloc_{}(struct Model *model, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);\n'.format(op.lower()))
-        output_h.write('void handle_{}(struct Model *model, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);\n'.format(op.lower()))
+        output_h.write('void alloc_{}(struct InferenceContext *ctx, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);\n'.format(op.lower()))
+        output_h.write('void handle_{}(struct InferenceContext *ctx, const struct ParameterInfo *input[], struct ParameterInfo *output, const struct Node* node);\n'.format(op.lower()))
     output_c.write('const handler handlers[] = {\n')
     for op in ops:
         output_c.write(f'    handle_{op},\n'.lower())
@@ -1148,24 +1501,35 @@ struct Node;
     for op in ops:
         output_c.write(f'    alloc_{op},\n'.lower())
     output_c.write('};\n')
+    output_c.write('const IntermediateValuesPlacement intermediate_values_placements[] = {\n')
+    for idx, value in enumerate(intermediate_values):
+        if value:
+            # Outputs of Concat inputs start at their channels in the output of Concat
+            channel_offset = value.channel_offsets.get(idx, 0)
+            channel_stride = value.channel_stride if idx in value.channel_offsets else 0
+            output_c.write(f'    {{ {value.offset + 2 * channel_offset}, {value.size - 2 * channel_offset}, {channel_stride}, {value.slot} }},\n')
+        else:
+            # Outputs not in slots (ex: in-place operations on the test set) are not planned
+            output_c.write('    { 0, 0, 0, 0 },\n')
+    output_c.write('};\n')
     for op in ops:
         if op in inplace_update_ops:
             output_c.write(textwrap.dedent(f'''
-                void alloc_{op.lower()}(struct Model *model, const struct ParameterInfo *[], struct ParameterInfo *output, const struct Node*) {{
-                    SlotInfo *cur_slot_info = get_slot_info(model, output->slot);
+                void alloc_{op.lower()}(struct InferenceContext *ctx, const struct ParameterInfo *[], struct ParameterInfo *output, const struct Node*) {{
+                    SlotInfo *cur_slot_info = get_slot_info(ctx, output->slot);
                     if (cur_slot_info) {{
-                        cur_slot_info->user = model->layer_idx;
+                        cur_slot_info->user = get_model(ctx)->layer_idx;
                     }}
                 }}
             '''))
         else:
             output_c.write(textwrap.dedent(f'''
-                void __attribute__((weak)) alloc_{op.lower()}(struct Model *model, const struct ParameterInfo *[], struct ParameterInfo *output, const struct Node*) {{
+                void __attribute__((weak)) alloc_{op.lower()}(struct InferenceContext *ctx, const struct ParameterInfo *[], struct ParameterInfo *output, const struct Node*) {{
                     ERROR_OCCURRED();
                 }}
             '''))
         output_c.write(textwrap.dedent(f'''
-            void __attribute__((weak)) handle_{op.lower()}(struct Model *model, const struct ParameterInfo *[], struct ParameterInfo *output, const struct Node*) {{
+            void __attribute__((weak)) handle_{op.lower()}(struct InferenceContext *ctx, const struct ParameterInfo *[], struct ParameterInfo *output, const struct Node*) {{
                 ERROR_OCCURRED();
             }}
         '''))
@@ -383,3 +383,54 @@ def import_model_output_pb2():
         return model_output_pb2
     finally:
         sys.path = orig_sys_path
+
+def to_bytes(arr, size=16):
+    if not np.shape(arr):
+        arr = [arr]
+    FORMAT_CHARS = {
+        8: 'B',  # unsigned char
+        16: 'h',
+        32: 'i',
+        64: 'q'
+    }
+    if size not in FORMAT_CHARS:
+        raise ValueError(f'Unsupported size {size}')
+    return struct.pack('%u%c' % (len(arr), FORMAT_CHARS[size]), *arr)
+
+def nhwc2conv_tiles(arr, dims, conv_flags):
+    """Reorder NHWC filters so that filter values needed by a conv tile
+    (output_tile_c filters x input_tile_c channels at a kernel position) are
+    contiguous, and stored in the layout of the filter buffer in VM, i.e.,
+    input_tile_c rows of output_tile_c values"""
+    n_filters, channel, kH, kW = dims
+    arr = np.reshape(arr, (n_filters, kH, kW, channel))
+    tiles = []
+    for filter_tile_offset in range(0, n_filters, conv_flags.output_tile_c):
+        for input_tile_c_offset in range(0, channel, conv_flags.input_tile_c):
+            for kX in range(kH):
+                for kY in range(kW):
+                    tile = arr[filter_tile_offset:filter_tile_offset + conv_flags.output_tile_c, kX, kY,
+                               input_tile_c_offset:input_tile_c_offset + conv_flags.input_tile_c]
+                    tiles.append(tile.T.flatten())
+    return np.concatenate(tiles)
+
+def quantize_conv_filters(arr, dims, bitwidth):
+    """Quantize filters, already divided by the scale of the whole tensor, to
+    signed integers of the given bitwidth. Each output channel gets a _q15
+    scale, and values are widened on devices as
+    ((q << (16 - bitwidth)) * channel_scale) >> 15"""
+    arr = np.reshape(arr, (dims[0], -1))
+    qmax = 2 ** (bitwidth - 1)
+    channel_scales = np.clip(np.ceil(np.max(np.abs(arr), axis=1) * 32768), 1, 32767).astype(int)
+    quantized = np.round(arr * 32768 / channel_scales[:, np.newaxis] * qmax)
+    return np.clip(quantized, -qmax, qmax - 1).astype(int).flatten(), channel_scales
+
+def pack_weights(arr, bitwidth):
+    """Pack int8 or int4 values into bytes, with the lower nibble first for int4.
+    The result is padded to whole words for DMA"""
+    arr = np.asarray(arr, dtype=int) & ((1 << bitwidth) - 1)
+    if bitwidth == 4:
+        arr = np.append(arr, np.zeros(len(arr) % 2, dtype=int))
+        arr = arr[0::2] | (arr[1::2] << 4)
+    arr = np.append(arr, np.zeros(len(arr) % 2, dtype=int))
+    return to_bytes(arr.tolist(), size=8)
@@ -0,0 +1,103 @@
+"""Re-quantize q15 Conv filters in a generated data.cpp/data.h to int8 or int4
+with per-channel scales, as transform.py --weight-bitwidth does. Other
+parameters are copied as is, so that the same model can be compared across
+filter bitwidths without regenerating it. Filter counters in the commit that
+added int8/int4 filters are from:
+
+    python3 utils/requantize-conv-filters.py build /tmp/int8 8
+    python3 utils/requantize-conv-filters.py build /tmp/int4 4
+
+Then point the host build to the new data.cpp/data.h instead of build/."""
+
+import argparse
+import pathlib
+import re
+import struct
+import sys
+import types
+
+import numpy as np
+
+sys.path.append(str(pathlib.Path(__file__).resolve().parents[1]))
+from utils import to_bytes, nhwc2conv_tiles, quantize_conv_filters, pack_weights
+
+def load_array(data_cpp, name):
+    m = re.search(r'_%s\[(\d+)\] = \{(.*?)\};' % name, data_cpp, re.S)
+    return bytearray(int(x, 0) for x in m.group(2).split(',') if x.strip())
+
+def replace_array(data_cpp, name, data):
+    body = ''.join('  ' + ' '.join('0x%02x,' % b for b in data[i:i+16]) + '\n' for i in range(0, len(data), 16))
+    return re.sub(r'_%s\[\d+\] = \{.*?\};' % name, lambda m: '_%s[%d] = {\n%s};' % (name, len(data), body), data_cpp, count=1, flags=re.S)
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('src', help='Directory with data.cpp and data.h from transform.py')
+    parser.add_argument('dst', help='Directory for re-quantized data.cpp and data.h')
+    parser.add_argument('bitwidth', type=int, choices=[4, 8])
+    args = parser.parse_args()
+
+    src = pathlib.Path(args.src)
+    dst = pathlib.Path(args.dst)
+    data_cpp = (src / 'data.cpp').read_text()
+    data_h = (src / 'data.h').read_text()
+    defines = dict(re.findall(r'#define (\w+) (\S+)', data_h))
+
+    parameters = load_array(data_cpp, 'parameters_data')
+    parameters_info = load_array(data_cpp, 'model_parameters_info_data')
+    nodes = load_array(data_cpp, 'nodes_data')
+
+    n_nodes = int(defines['MODEL_NODES_LEN'])
+    n_parameters = int(defines['N_INPUT'])
+    node_len = len(nodes) // n_nodes
+    parameter_info_len = len(parameters_info) // n_parameters
+
+    # Offsets of fields in struct Node and ConvNodeFlags (see cnn_common.h)
+    inputs_offset = int(defines['NODE_NAME_LEN']) * 2 + 2
+    op_type_offset = inputs_offset + int(defines['NUM_INPUTS']) * 2 + 2
+    conv_flags_offset = op_type_offset + 2 + 4
+
+    conv_flags = {}
+    for node_idx in range(n_nodes):
+        node_offset = node_idx * node_len
+        op_type, = struct.unpack_from('<H', nodes, node_offset + op_type_offset)
+        if op_type != int(defines['OpConv']):
+            continue
+        filter_idx, = struct.unpack_from('<h', nodes, node_offset + inputs_offset + 2)
+        input_tile_c, output_tile_c = struct.unpack_from('<HH', nodes, node_offset + conv_flags_offset)
+        conv_flags[filter_idx] = types.SimpleNamespace(input_tile_c=input_tile_c, output_tile_c=output_tile_c)
+
+    # Parameters are rewritten in the order of their offsets, so that shrunk filters leave no holes
+    def params_offset(param_idx):
+        return struct.unpack_from('<I', parameters_info, param_idx * parameter_info_len)[0]
+
+    new_parameters = bytearray()
+    for param_idx in sorted(range(n_parameters), key=params_offset):
+        info_offset = param_idx * parameter_info_len
+        offset, length, bitwidth, slot = struct.unpack_from('<IIBB', parameters_info, info_offset)
+        if slot != int(defines['SLOT_PARAMETERS']):
+            continue
+        data = bytes(parameters[offset:offset + length])
+        struct.pack_into('<I', parameters_info, info_offset, len(new_parameters))
+        if param_idx in conv_flags:
+            assert bitwidth == 16, f'Filters of parameter {param_idx} are already quantized'
+            dims = struct.unpack_from('<4H', parameters_info, info_offset + 10)
+            # Undo nhwc2conv_tiles to get back NHWC filters
+            tile_order = nhwc2conv_tiles(np.arange(np.prod(dims)), dims, conv_flags[param_idx])
+            filters = np.empty(len(tile_order))
+            filters[tile_order] = np.frombuffer(data, dtype='<i2') / 32768
+            quantized, channel_scales = quantize_conv_filters(filters, dims, args.bitwidth)
+            data = pack_weights(nhwc2conv_tiles(quantized, dims, conv_flags[param_idx]), args.bitwidth) + to_bytes(channel_scales.tolist())
+            struct.pack_into('<IB', parameters_info, info_offset + 4, len(data), args.bitwidth)
+        new_parameters += data
+
+    data_cpp = replace_array(data_cpp, 'parameters_data', new_parameters)
+    data_cpp = replace_array(data_cpp, 'model_parameters_info_data', parameters_info)
+    data_h = re.sub(r'#define PARAMETERS_DATA_LEN \d+', '#define PARAMETERS_DATA_LEN %d' % len(new_parameters), data_h)
+
+    dst.mkdir(parents=True, exist_ok=True)
+    (dst / 'data.cpp').write_text(data_cpp)
+    (dst / 'data.h').write_text(data_h)
+    print(f'Parameters: {len(parameters)} -> {len(new_parameters)} bytes')
+
+if __name__ == '__main__':
+    main()
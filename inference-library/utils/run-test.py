@@ -45,6 +45,17 @@ def build_and_test(config, suffix, intermittent):
         ] + run_cmd
     check_call(run_cmd, env={'TMPDIR': '/var/tmp'})
 
+    if not intermittent and '--hawaii' in config:
+        # Power failures simulated in the process. Power cycles are short enough that footprint
+        # intervals change in the middle of layers. Fails if results differ from those with continuous power
+        check_call(['./build/intermittent-cnn', '-i', '-c', '900', '2'])
+        # A small capacitor with little harvested power at first. Power cycles without progress at
+        # the start of the first Conv layer switch it to smaller tiles (see read_hawaii_layer_tiling).
+        # Later power failures in the layer resume with the tiling recorded in the footprint
+        power_trace = pathlib.Path('build') / 'power-trace.txt'
+        power_trace.write_text('0.0002\n' * 2000 + '0.006\n' * 20000)
+        check_call(['./build/intermittent-cnn', '-e', '0.0001', '-t', power_trace, '2'])
+
 def main():
     # preparation
     suffix = os.environ['LOG_SUFFIX']